@@ -0,0 +1,43 @@
+// helpers shared by the check programs: CHECK reports a check that fails
+// and counts it, check_exit prints the verdict of the program.
+
+#ifndef CHECK_INCLUDE
+#define CHECK_INCLUDE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int nfailed = 0;
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n",              \
+                    __FILE__, __LINE__, #cond);                       \
+            nfailed++;                                                \
+        }                                                             \
+    } while (0)
+
+// copy the n bytes at the start of in to a new temporary file
+static inline FILE* truncated(FILE* in, long n) {
+    FILE* out = tmpfile();
+    int c;
+
+    if (out == NULL) return NULL;
+    rewind(in);
+    while (n-- > 0 && (c = getc(in)) != EOF) putc(c, out);
+    rewind(out);
+    return out;
+}
+
+// print the verdict of the program name and return its exit status
+static inline int check_exit(const char* name) {
+    if (nfailed > 0) {
+        fprintf(stderr, "%s: %d checks failed\n", name, nfailed);
+        return EXIT_FAILURE;
+    }
+    printf("%s: ok\n", name);
+    return EXIT_SUCCESS;
+}
+
+#endif
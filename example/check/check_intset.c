@@ -0,0 +1,118 @@
+// 'check_intset' writes intsets of every container kind with
+// Intset_write and reads them back with Intset_read: the copy must hold
+// the same members, and any cut of the file must be rejected.
+//
+//     ../../bin/check_intset
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intset.h"
+
+#include "check.h"
+
+// members of an intset, in the order Intset_map visits them
+struct members {
+    unsigned* x;
+    long n, capacity;
+};
+
+static void collect(unsigned x, void* cl) {
+    struct members* m = cl;
+
+    if (m->n == m->capacity) {
+        m->capacity = (m->capacity == 0) ? 1024 : 2 * m->capacity;
+        if ((m->x = realloc(m->x, m->capacity * sizeof(*m->x))) == NULL) {
+            fprintf(stderr, "check_intset: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    m->x[m->n++] = x;
+}
+
+static int same(struct intset_t* s, struct intset_t* t) {
+    struct members a = {NULL, 0, 0}, b = {NULL, 0, 0};
+    int eq;
+
+    Intset_map(s, collect, &a);
+    Intset_map(t, collect, &b);
+    eq = s->size == t->size && a.n == b.n && a.n == s->size &&
+         (a.n == 0 || memcmp(a.x, b.x, a.n * sizeof(*a.x)) == 0);
+    free(a.x);
+    free(b.x);
+    return eq;
+}
+
+// write set, read it back and try the cuts of the file, step bytes apart
+static void round_trip(struct intset_t* set, long step) {
+    struct intset_t* copy;
+    FILE *fp, *cut;
+    long bytes, length, n;
+
+    if ((fp = tmpfile()) == NULL) {
+        fprintf(stderr, "check_intset: can't create a temporary file\n");
+        exit(EXIT_FAILURE);
+    }
+    bytes = Intset_write(set, fp);
+    length = ftell(fp);
+    CHECK(bytes > 0 && bytes == length);
+
+    rewind(fp);
+    copy = Intset_read(fp);
+    CHECK(copy != NULL);
+    if (copy != NULL) {
+        CHECK(same(set, copy));
+        Intset_free(&copy);
+    }
+
+    for (n = 0; n < length; n += step) {
+        if ((cut = truncated(fp, n)) == NULL) break;
+        copy = Intset_read(cut);
+        CHECK(copy == NULL);
+        if (copy != NULL) Intset_free(&copy);
+        fclose(cut);
+    }
+    fclose(fp);
+}
+
+int main(void) {
+    struct intset_t* set;
+    FILE* fp;
+    unsigned x;
+
+    // empty
+    set = Intset_new();
+    round_trip(set, 1);
+
+    // array containers, and the edges of the 16-bit halves
+    Intset_put(set, 0);
+    Intset_put(set, 65535);
+    Intset_put(set, 65536);
+    Intset_put(set, 0xFFFFFFFFu);
+    for (x = 1000; x < 3000000; x += 7919) Intset_put(set, x);
+    round_trip(set, 1);
+
+    // a bitmap container
+    for (x = 5u << 16; x < (6u << 16); x += 3) Intset_put(set, x);
+    round_trip(set, 97);
+
+    // run containers
+    for (x = 9u << 16; x < (9u << 16) + 50000; x++) Intset_put(set, x);
+    for (x = 0x80000000u; x < 0x80000000u + 300; x++) Intset_put(set, x);
+    Intset_optimize(set);
+    round_trip(set, 13);
+    Intset_free(&set);
+
+    // not an intset at all
+    if ((fp = tmpfile()) != NULL) {
+        fputs("not an intset", fp);
+        rewind(fp);
+        set = Intset_read(fp);
+        CHECK(set == NULL);
+        if (set != NULL) Intset_free(&set);
+        fclose(fp);
+    }
+
+    return check_exit("check_intset");
+}
@@ -0,0 +1,141 @@
+// 'check_memchk' exercises the checking Mem implementation: the invalid
+// calls it must catch, resizing in place and the report of the blocks
+// still allocated. It prints the checks that fail and exits with 1 if
+// any does.
+//
+//     ../../bin/check_memchk
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "align.h"
+#include "assert.h"
+#include "except.h"
+#include "mem.h"
+
+#include "check.h"
+
+// 1 if Mem_free(ptr) raises assert_failed
+static int free_raises(void* ptr) {
+    volatile int raised = 0;
+
+    TRY
+        Mem_free(ptr, __FILE__, __LINE__);
+    EXCEPT(assert_failed)
+        raised = 1;
+    END_TRY;
+    return raised;
+}
+
+// 1 if Mem_resize(ptr, nbytes) raises assert_failed
+static int resize_raises(void* ptr, long nbytes) {
+    volatile int raised = 0;
+
+    TRY
+        Mem_resize(ptr, nbytes, __FILE__, __LINE__);
+    EXCEPT(assert_failed)
+        raised = 1;
+    END_TRY;
+    return raised;
+}
+
+static void check_invalid(void) {
+    static union align never;  // aligned, but never allocated
+    char *p, *q;
+
+    p = ALLOC(40);
+    CHECK(free_raises(p + 1));  // misaligned
+    CHECK(free_raises(&never));
+    CHECK(resize_raises(p + 1, 80));
+    CHECK(resize_raises(&never, 80));
+
+    q = p;
+    FREE(p);
+    CHECK(free_raises(q));  // freed twice
+    CHECK(resize_raises(q, 80));
+}
+
+static void check_resize(void) {
+    char *p, *q;
+    int i;
+
+    p = ALLOC(256);
+    for (i = 0; i < 256; i++) p[i] = (char)i;
+
+    // shrinking leaves the rest free right after the block, so growing
+    // back takes it again
+    q = Mem_resize(p, 64, __FILE__, __LINE__);
+    CHECK(q == p);
+    p = q;
+    q = Mem_resize(p, 256, __FILE__, __LINE__);
+    CHECK(q == p);
+    p = q;
+    for (i = 0; i < 64; i++) CHECK(p[i] == (char)i);
+
+    // a block that moves gets room to double in place next time
+    q = Mem_resize(p, 4096, __FILE__, __LINE__);
+    p = q;
+    for (i = 0; i < 64; i++) CHECK(p[i] == (char)i);
+    q = Mem_resize(p, 8192, __FILE__, __LINE__);
+    CHECK(q == p);
+    p = q;
+    for (i = 0; i < 64; i++) CHECK(p[i] == (char)i);
+    FREE(p);
+}
+
+struct leaks {
+    const void* ptrs[3];
+    long sizes[3];
+    int found[3];
+    int others;  // blocks of this file not expected
+};
+
+static void count_leak(const void* ptr, long size, const char* file, int line, void* cl) {
+    struct leaks* leaks = cl;
+    int i;
+
+    (void)line;
+    if (strcmp(file, __FILE__) != 0) return;
+    for (i = 0; i < 3; i++)
+        if (ptr == leaks->ptrs[i] && size >= leaks->sizes[i]) {
+            leaks->found[i]++;
+            return;
+        }
+    leaks->others++;
+}
+
+static void check_leak(void) {
+    struct leaks leaks;
+    void* blocks[3];
+    int i;
+
+    memset(&leaks, 0, sizeof(leaks));
+    for (i = 0; i < 3; i++) {
+        leaks.sizes[i] = 10 + 100 * i;
+        leaks.ptrs[i] = blocks[i] = ALLOC(leaks.sizes[i]);
+    }
+    Mem_leak(count_leak, &leaks);
+    for (i = 0; i < 3; i++) CHECK(leaks.found[i] == 1);
+    CHECK(leaks.others == 0);
+
+    FREE(blocks[1]);
+    memset(leaks.found, 0, sizeof(leaks.found));
+    Mem_leak(count_leak, &leaks);
+    CHECK(leaks.found[0] == 1 && leaks.found[1] == 0 && leaks.found[2] == 1);
+    CHECK(leaks.others == 0);
+
+    FREE(blocks[0]);
+    FREE(blocks[2]);
+    memset(leaks.found, 0, sizeof(leaks.found));
+    Mem_leak(count_leak, &leaks);
+    CHECK(leaks.found[0] + leaks.found[1] + leaks.found[2] == 0);
+}
+
+int main(void) {
+    check_invalid();
+    check_resize();
+    check_leak();
+
+    return check_exit("check_memchk");
+}
@@ -0,0 +1,106 @@
+// 'check_memlog' makes invalid calls to the checking Mem implementation
+// while Mem_log is on, and reads the log back: each call must come out as
+// the event it was, and a truncated log must be told from a complete one.
+//
+//     ../../bin/check_memlog
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "align.h"
+#include "mem.h"
+#include "memlog.h"
+
+#include "check.h"
+
+// an invalid call and the event it must be logged as
+struct expect {
+    int kind;
+    const void* ptr;
+    int line;
+    long size;       // for MEMLOG_FREE_FREED
+    int alloc_line;  // for MEMLOG_FREE_FREED
+};
+
+#define NCALLS 4
+
+int main(void) {
+    static union align never;  // aligned, but never allocated
+    struct expect expect[NCALLS];
+    struct memlog_event_t ev;
+    struct memlog_t* log;
+    FILE *fp, *cut, *null;
+    char *p, *q;
+    long length;
+    int alloc_line, n, r = 0;
+
+    if ((fp = tmpfile()) == NULL) {
+        fprintf(stderr, "check_memlog: can't create a temporary file\n");
+        return EXIT_FAILURE;
+    }
+    Mem_log(fp);
+
+    // each call is on the line after the one recorded in expect
+    p = ALLOC(48);
+    alloc_line = __LINE__ - 1;
+    q = p;
+    FREE(p);
+    expect[0] = (struct expect){MEMLOG_FREE_FREED, q, __LINE__ + 1, 48, alloc_line};
+    Mem_free(q, __FILE__, __LINE__);
+    expect[1] = (struct expect){MEMLOG_FREE_INVALID, &never, __LINE__ + 1, 0, 0};
+    Mem_free(&never, __FILE__, __LINE__);
+    expect[2] = (struct expect){MEMLOG_RESIZE_INVALID, q + 1, __LINE__ + 1, 0, 0};
+    Mem_resize(q + 1, 96, __FILE__, __LINE__);
+    expect[3] = (struct expect){MEMLOG_RESIZE_UNALLOC, &never, __LINE__ + 1, 0, 0};
+    Mem_resize(&never, 96, __FILE__, __LINE__);
+
+    Mem_log(NULL);  // writes out the rest
+
+    rewind(fp);
+    log = Memlog_open(fp);
+    CHECK(log != NULL);
+    null = fopen("/dev/null", "w");
+    for (n = 0; log != NULL && (r = Memlog_read(log, &ev)) == 1; n++) {
+        if (n >= NCALLS) continue;
+        CHECK(ev.kind == expect[n].kind);
+        CHECK(ev.ptr == (unsigned long long)(unsigned long)expect[n].ptr);
+        CHECK(ev.file != NULL && strcmp(ev.file, __FILE__) == 0);
+        CHECK(ev.line == expect[n].line);
+        CHECK(ev.thread == 1);
+        if (ev.kind == MEMLOG_FREE_FREED) {
+            CHECK(ev.size >= expect[n].size);
+            CHECK(ev.alloc_file != NULL && strcmp(ev.alloc_file, __FILE__) == 0);
+            CHECK(ev.alloc_line == expect[n].alloc_line);
+        }
+        if (null != NULL) Memlog_render(&ev, null);
+    }
+    if (log != NULL) {
+        CHECK(r == 0);
+        CHECK(n == NCALLS);
+        Memlog_close(&log);
+    }
+
+    // cut in the middle of the last record
+    length = ftell(fp);
+    if ((cut = truncated(fp, length - 3)) != NULL) {
+        log = Memlog_open(cut);
+        CHECK(log != NULL);
+        while (log != NULL && (r = Memlog_read(log, &ev)) == 1)
+            ;
+        CHECK(r == -1);
+        if (log != NULL) Memlog_close(&log);
+        fclose(cut);
+    }
+    // not a log at all
+    if ((cut = tmpfile()) != NULL) {
+        fputs("CIITRC01", cut);
+        rewind(cut);
+        CHECK(Memlog_open(cut) == NULL);
+        fclose(cut);
+    }
+    if (null != NULL) fclose(null);
+    fclose(fp);
+
+    return check_exit("check_memlog");
+}
@@ -0,0 +1,139 @@
+// 'check_pool' exercises the pool Mem implementation: resizing aligned
+// blocks across the size classes, resizing heap blocks while an arena is
+// pushed, and freeing blocks on another thread than the one that
+// allocated them. It is built with AddressSanitizer, which catches a copy
+// past the end of a block or a free of a block the heap never gave.
+//
+//     ../../bin/check_pool
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "mem.h"
+
+#include "check.h"
+
+#define NTHREADS 4
+#define NBLOCKS 2000  // blocks of each thread
+
+// fill the n bytes of p from seed, or tell if they still hold them
+static void fill(unsigned char* p, long n, unsigned seed) {
+    long i;
+
+    for (i = 0; i < n; i++) p[i] = (unsigned char)(seed + i);
+}
+
+static int holds(const unsigned char* p, long n, unsigned seed) {
+    long i;
+
+    for (i = 0; i < n; i++)
+        if (p[i] != (unsigned char)(seed + i)) return 0;
+    return 1;
+}
+
+static void check_aligned(void) {
+    static const long sizes[] = {1, 100, 500, 513, 3000};
+    long align, i, n;
+    unsigned char* p;
+
+    for (align = 32; align <= 4096; align *= 2)
+        for (i = 0; i < (long)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+            n = sizes[i];
+            p = Mem_alloc_aligned(n, align, __FILE__, __LINE__);
+            CHECK((unsigned long)p % align == 0);
+            fill(p, n, align + n);
+
+            // into a class, out of every class, and back
+            RESIZE(p, 2 * n);
+            CHECK(holds(p, n, align + n));
+            fill(p, 2 * n, align);
+            RESIZE(p, 8000);
+            CHECK(holds(p, 2 * n, align));
+            RESIZE(p, 40);
+            CHECK(holds(p, (2 * n < 40) ? 2 * n : 40, align));
+            FREE(p);
+        }
+}
+
+static void check_arena(void) {
+    struct arena_t* arena = Arena_new();
+    unsigned char *small, *large, *q;
+
+    small = ALLOC(32);
+    large = ALLOC(2000);
+    fill(small, 32, 1);
+    fill(large, 2000, 2);
+
+    // a heap block stays on the heap, a new block goes to the arena
+    Mem_push_arena(arena);
+    RESIZE(small, 64);
+    RESIZE(large, 300);
+    q = ALLOC(16);
+    CHECK(!Arena_owns(arena, small) && holds(small, 32, 1));
+    CHECK(!Arena_owns(arena, large) && holds(large, 300, 2));
+    CHECK(Arena_owns(arena, q));
+    FREE(q);
+    CHECK(Mem_pop_arena() == arena);
+
+    FREE(small);
+    FREE(large);
+    Arena_dispose(&arena);
+}
+
+static unsigned char* blocks[NTHREADS][NBLOCKS];
+
+// small blocks of every class and some large ones
+static long block_size(long t, long i) {
+    return (i % 10 == 0) ? 600 + 37 * i % 4000 : 1 + (t + i) % 512;
+}
+
+// thread t frees the blocks of thread t + 1, while it allocates its own
+// anew, and checks that none of them is given twice
+static void* swap(void* cl) {
+    long t = (long)cl, u = (t + 1) % NTHREADS, i;
+    unsigned char** own = malloc(NBLOCKS * sizeof(*own));
+    int* ok = malloc(sizeof(*ok));
+
+    *ok = own != NULL;
+    for (i = 0; *ok && i < NBLOCKS; i++) {
+        if (!holds(blocks[u][i], block_size(u, i), u * NBLOCKS + i)) *ok = 0;
+        FREE(blocks[u][i]);
+        own[i] = ALLOC(block_size(t, i));
+        fill(own[i], block_size(t, i), ~(t * NBLOCKS + i));
+    }
+    for (i = 0; *ok && i < NBLOCKS; i++) {
+        if (!holds(own[i], block_size(t, i), ~(t * NBLOCKS + i))) *ok = 0;
+        FREE(own[i]);
+    }
+    free(own);
+    return ok;
+}
+
+static void check_threads(void) {
+    pthread_t threads[NTHREADS];
+    long t, i;
+    void* ok;
+
+    for (t = 0; t < NTHREADS; t++)
+        for (i = 0; i < NBLOCKS; i++) {
+            blocks[t][i] = ALLOC(block_size(t, i));
+            fill(blocks[t][i], block_size(t, i), t * NBLOCKS + i);
+        }
+    for (t = 0; t < NTHREADS; t++) pthread_create(&threads[t], NULL, swap, (void*)t);
+    for (t = 0; t < NTHREADS; t++) {
+        pthread_join(threads[t], &ok);
+        CHECK(ok != NULL && *(int*)ok);
+        free(ok);
+    }
+}
+
+int main(void) {
+    check_aligned();
+    check_arena();
+    check_threads();
+
+    return check_exit("check_pool");
+}
@@ -0,0 +1,150 @@
+// 'check_trace' records calls with Mem_trace and reads the trace back
+// with Memtrace_read: each call must come out as the event it was, a
+// call that raised must leave no event and not stop the trace, and the
+// calls of several threads must all be there. Built against each Mem
+// implementation, as check_trace, check_trace_chk and check_trace_pool.
+//
+//     ../../bin/check_trace
+
+#define _DEFAULT_SOURCE  // mkstemp() with -std=c99
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "except.h"
+#include "mem.h"
+#include "memtrace.h"
+
+#include "check.h"
+
+#define NTHREADS 4
+#define NCALLS 1000  // allocations of each thread
+
+// a call and the event it must be recorded as
+struct expect {
+    int op;
+    const void* id;
+    const void* old;  // for MEMTRACE_RESIZE
+    long size;        // at least, the checking implementation rounds up
+    int line;
+};
+
+#define NEXPECT 7
+
+// thread t allocates blocks of 64 * (t + 1) bytes, which tells its events
+// apart, even rounded up by the checking implementation
+static void* work(void* cl) {
+    long t = (long)cl, i;
+    void* p;
+
+    for (i = 0; i < NCALLS; i++) {
+        p = ALLOC(64 * (t + 1));
+        FREE(p);
+    }
+    return NULL;
+}
+
+int main(void) {
+    char path[] = "/tmp/check_trace.XXXXXX";
+    struct expect expect[NEXPECT];
+    struct memtrace_event_t ev;
+    struct memtrace_t* trace;
+    struct mem_budget_t* budget;
+    pthread_t threads[NTHREADS];
+    long allocs[NTHREADS], nfrees = 0, length;
+    char *p, *q, *r;
+    volatile int raised = 0;
+    int fd, n, r_read = 0, i;
+    FILE *fp, *cut;
+
+    if ((fd = mkstemp(path)) < 0) {
+        fprintf(stderr, "check_trace: can't create a temporary file\n");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    CHECK(Mem_trace("/nonexistent/dir/trace") == -1);
+    CHECK(Mem_trace(path) == 0);
+
+    // each call is on the line after the one recorded in expect
+    p = ALLOC(100);
+    expect[0] = (struct expect){MEMTRACE_ALLOC, p, NULL, 100, __LINE__ - 1};
+    q = CALLOC(4, 25);
+    expect[1] = (struct expect){MEMTRACE_CALLOC, q, NULL, 100, __LINE__ - 1};
+    r = p;
+    RESIZE(p, 5000);
+    expect[2] = (struct expect){MEMTRACE_RESIZE, p, r, 5000, __LINE__ - 1};
+    expect[3] = (struct expect){MEMTRACE_FREE, q, NULL, 0, __LINE__ + 1};
+    FREE(q);
+
+    // a call that raises is not recorded, and the trace goes on
+    budget = Mem_budget_new(NULL, 0, 1000, NULL, NULL);
+    Mem_push_budget(budget);
+    TRY
+        CALLOC(1, 100000);
+    EXCEPT(mem_failed)
+        raised = 1;
+    END_TRY;
+    Mem_pop_budget();
+    Mem_budget_free(&budget);
+    CHECK(raised);
+
+    r = ALLOC(10);
+    expect[4] = (struct expect){MEMTRACE_ALLOC, r, NULL, 10, __LINE__ - 1};
+    expect[5] = (struct expect){MEMTRACE_FREE, p, NULL, 0, __LINE__ + 1};
+    FREE(p);
+    expect[6] = (struct expect){MEMTRACE_FREE, r, NULL, 0, __LINE__ + 1};
+    FREE(r);
+
+    for (i = 0; i < NTHREADS; i++) pthread_create(&threads[i], NULL, work, (void*)(long)i);
+    for (i = 0; i < NTHREADS; i++) pthread_join(threads[i], NULL);
+    CHECK(Mem_trace(NULL) == 0);
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "check_trace: can't open '%s'\n", path);
+        return EXIT_FAILURE;
+    }
+    trace = Memtrace_open(fp);
+    CHECK(trace != NULL);
+    memset(allocs, 0, sizeof(allocs));
+    for (n = 0; trace != NULL && (r_read = Memtrace_read(trace, &ev)) == 1; n++) {
+        if (n < NEXPECT) {
+            CHECK(ev.op == expect[n].op);
+            CHECK(ev.id == (unsigned long long)(unsigned long)expect[n].id);
+            CHECK(ev.file != NULL && strcmp(ev.file, __FILE__) == 0);
+            CHECK(ev.line == expect[n].line);
+            if (ev.op != MEMTRACE_FREE) CHECK(ev.size >= expect[n].size);
+            if (ev.op == MEMTRACE_RESIZE)
+                CHECK(ev.old == (unsigned long long)(unsigned long)expect[n].old);
+        } else if (ev.op == MEMTRACE_ALLOC && ev.size % 64 == 0 &&
+                   ev.size >= 64 && ev.size <= 64 * NTHREADS)
+            allocs[ev.size / 64 - 1]++;
+        else if (ev.op == MEMTRACE_FREE)
+            nfrees++;
+    }
+    if (trace != NULL) {
+        CHECK(r_read == 0);
+        CHECK(n == NEXPECT + 2 * NTHREADS * NCALLS);
+        for (i = 0; i < NTHREADS; i++) CHECK(allocs[i] == NCALLS);
+        CHECK(nfrees == NTHREADS * NCALLS);
+        Memtrace_close(&trace);
+    }
+
+    // cut in the middle of the last record
+    length = ftell(fp);
+    if ((cut = truncated(fp, length - 3)) != NULL) {
+        trace = Memtrace_open(cut);
+        CHECK(trace != NULL);
+        while (trace != NULL && (r_read = Memtrace_read(trace, &ev)) == 1)
+            ;
+        CHECK(r_read == -1);
+        if (trace != NULL) Memtrace_close(&trace);
+        fclose(cut);
+    }
+    fclose(fp);
+    remove(path);
+
+    return check_exit("check_trace");
+}
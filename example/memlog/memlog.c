@@ -0,0 +1,39 @@
+// 'memlog' prints the log written by the checking Mem implementation
+// after Mem_log(), as text.
+//
+//     ../../bin/memlog errors.log
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memlog.h"
+
+int main(int argc, char* argv[]) {
+    struct memlog_event_t ev;
+    struct memlog_t* log;
+    FILE* fp;
+    int r;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s log\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ((fp = fopen(argv[1], "rb")) == NULL) {
+        fprintf(stderr, "%s: can't open '%s' (%s)\n",
+                argv[0], argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if ((log = Memlog_open(fp)) == NULL) {
+        fprintf(stderr, "%s: '%s' is not a memory log\n", argv[0], argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    while ((r = Memlog_read(log, &ev)) == 1) Memlog_render(&ev, stdout);
+    if (r < 0) fprintf(stderr, "%s: '%s' is truncated\n", argv[0], argv[1]);
+
+    Memlog_close(&log);
+    fclose(fp);
+    return (r < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,282 @@
+// 'replay' drives the Mem implementation it is linked with by a trace
+// recorded with Mem_trace(), and reports the throughput and peak RSS.
+//
+//     MEM_TRACE=wf.trace ../../bin/wf big.txt > /dev/null
+//     ../../bin/replay wf.trace        (mem.c)
+//     ../../bin/replay_chk wf.trace    (memchk.c)
+//     ../../bin/replay_pool wf.trace   (mempool.c)
+
+#define _DEFAULT_SOURCE  // clock_gettime() & getrusage() with -std=c99
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "mem.h"
+#include "memtrace.h"
+
+// the bytes of a block touched by the replay, one per page, so that the
+// RSS grows as in the traced program
+#define PAGE 4096
+
+// One call to replay. The block ids of the trace are turned into indexes
+// of a table of live blocks beforehand, so the timed loop does nothing
+// but the calls. The harness itself uses malloc(), not Mem.
+struct op {
+    int kind;
+    int line;
+    long slot;
+    long size;
+    const char* file;
+};
+
+// map from the ids of live blocks to slots, open addressing
+struct idmap {
+    unsigned long long* ids;  // 0 marks an empty bucket
+    long* slots;
+    long capacity;
+    long count;
+};
+
+static void* xmalloc(size_t n) {
+    void* p = malloc(n);
+
+    if (p == NULL) {
+        fprintf(stderr, "replay: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static long bucket(struct idmap* m, unsigned long long id) {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    return (long)(id & (unsigned long long)(m->capacity - 1));
+}
+
+static long idmap_find(struct idmap* m, unsigned long long id) {
+    long i;
+
+    if (m->count == 0) return -1;
+    for (i = bucket(m, id); m->ids[i] != 0; i = (i + 1) & (m->capacity - 1))
+        if (m->ids[i] == id) return i;
+    return -1;
+}
+
+static void idmap_put(struct idmap* m, unsigned long long id, long slot) {
+    long i;
+
+    if (2 * (m->count + 1) > m->capacity) {
+        struct idmap old = *m;
+
+        m->capacity = (old.capacity == 0) ? 1024 : 2 * old.capacity;
+        m->ids = xmalloc(m->capacity * sizeof(m->ids[0]));
+        m->slots = xmalloc(m->capacity * sizeof(m->slots[0]));
+        memset(m->ids, 0, m->capacity * sizeof(m->ids[0]));
+        m->count = 0;
+        for (i = 0; i < old.capacity; i++)
+            if (old.ids[i] != 0) idmap_put(m, old.ids[i], old.slots[i]);
+        free(old.ids);
+        free(old.slots);
+    }
+    for (i = bucket(m, id); m->ids[i] != 0; i = (i + 1) & (m->capacity - 1))
+        ;
+    m->ids[i] = id;
+    m->slots[i] = slot;
+    m->count++;
+}
+
+// remove bucket i, moving back the entries probed past it
+static void idmap_remove(struct idmap* m, long i) {
+    long j, k;
+
+    for (j = i;;) {
+        m->ids[i] = 0;
+        for (;;) {
+            j = (j + 1) & (m->capacity - 1);
+            if (m->ids[j] == 0) {
+                m->count--;
+                return;
+            }
+            k = bucket(m, m->ids[j]);
+            // j stays if its home k lies cyclically in (i, j]
+            if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) continue;
+            break;
+        }
+        m->ids[i] = m->ids[j];
+        m->slots[i] = m->slots[j];
+        i = j;
+    }
+}
+
+struct script {
+    struct op* ops;
+    long n, capacity;
+    long nslots;   // slots ever used
+    long skipped;  // events about blocks allocated before the trace
+};
+
+static void emit(struct script* s, int kind, long slot, struct memtrace_event_t* ev) {
+    struct op* op;
+
+    if (s->n == s->capacity) {
+        s->capacity = (s->capacity == 0) ? 4096 : 2 * s->capacity;
+        op = xmalloc(s->capacity * sizeof(*op));
+        if (s->n > 0) memcpy(op, s->ops, s->n * sizeof(*op));
+        free(s->ops);
+        s->ops = op;
+    }
+    op = &s->ops[s->n++];
+    op->kind = kind;
+    op->slot = slot;
+    op->size = ev->size;
+    op->file = ev->file;
+    op->line = ev->line;
+}
+
+/* load: Read the trace in fp into s, one op per event, and return 0,  */
+/* or -1 if the trace is malformed. Slots of freed blocks are reused.  */
+static int load(FILE* fp, struct script* s, struct memtrace_t* trace) {
+    struct memtrace_event_t ev;
+    struct idmap live = {NULL, NULL, 0, 0};
+    long* spare = NULL;
+    long nspare = 0, slot, i;
+    int r;
+
+    while ((r = Memtrace_read(trace, &ev)) == 1) {
+        switch (ev.op) {
+            case MEMTRACE_ALLOC:
+            case MEMTRACE_CALLOC:
+                // threads can record a free after the reuse of its
+                // address, the old block then counts as freed here
+                if ((i = idmap_find(&live, ev.id)) >= 0) {
+                    slot = live.slots[i];
+                    idmap_remove(&live, i);
+                    emit(s, MEMTRACE_FREE, slot, &ev);
+                } else if (nspare > 0)
+                    slot = spare[--nspare];
+                else {
+                    slot = s->nslots++;
+                    spare = realloc(spare, s->nslots * sizeof(*spare));
+                    if (spare == NULL) return -1;
+                }
+                idmap_put(&live, ev.id, slot);
+                emit(s, ev.op, slot, &ev);
+                break;
+            case MEMTRACE_RESIZE:
+                if ((i = idmap_find(&live, ev.old)) < 0) {
+                    s->skipped++;
+                    break;
+                }
+                slot = live.slots[i];
+                idmap_remove(&live, i);
+                idmap_put(&live, ev.id, slot);
+                emit(s, MEMTRACE_RESIZE, slot, &ev);
+                break;
+            case MEMTRACE_FREE:
+                if ((i = idmap_find(&live, ev.id)) < 0) {
+                    s->skipped++;
+                    break;
+                }
+                slot = live.slots[i];
+                idmap_remove(&live, i);
+                spare[nspare++] = slot;
+                emit(s, MEMTRACE_FREE, slot, &ev);
+                break;
+        }
+    }
+    free(live.ids);
+    free(live.slots);
+    free(spare);
+    return r;
+}
+
+static void touch(char* p, long size) {
+    long i;
+
+    for (i = 0; i < size; i += PAGE) p[i] = 1;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long peak_rss(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;  // KB on Linux
+}
+
+int main(int argc, char* argv[]) {
+    struct script s = {NULL, 0, 0, 0, 0};
+    struct memtrace_t* trace;
+    struct op *op, *end;
+    double start, seconds;
+    long i, rss;
+    void** blocks;
+    FILE* fp;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ((fp = fopen(argv[1], "rb")) == NULL) {
+        fprintf(stderr, "%s: can't open '%s' (%s)\n",
+                argv[0], argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if ((trace = Memtrace_open(fp)) == NULL || load(fp, &s, trace) != 0) {
+        fprintf(stderr, "%s: '%s' is not a valid trace\n", argv[0], argv[1]);
+        return EXIT_FAILURE;
+    }
+    fclose(fp);
+
+    blocks = xmalloc((s.nslots + 1) * sizeof(*blocks));
+    memset(blocks, 0, (s.nslots + 1) * sizeof(*blocks));
+    rss = peak_rss();
+
+    start = now();
+    for (op = s.ops, end = s.ops + s.n; op < end; op++) {
+        switch (op->kind) {
+            case MEMTRACE_ALLOC:
+                blocks[op->slot] = Mem_alloc(op->size, op->file, op->line);
+                touch(blocks[op->slot], op->size);
+                break;
+            case MEMTRACE_CALLOC:
+                blocks[op->slot] = Mem_calloc(1, op->size, op->file, op->line);
+                break;
+            case MEMTRACE_RESIZE:
+                blocks[op->slot] = Mem_resize(blocks[op->slot], op->size,
+                                              op->file, op->line);
+                touch(blocks[op->slot], op->size);
+                break;
+            case MEMTRACE_FREE:
+                Mem_free(blocks[op->slot], op->file, op->line);
+                blocks[op->slot] = NULL;
+                break;
+        }
+    }
+    seconds = now() - start;
+
+    printf("calls      %ld\n", s.n);
+    printf("skipped    %ld\n", s.skipped);
+    printf("seconds    %.6f\n", seconds);
+    printf("Mcalls/s   %.2f\n", (seconds > 0) ? s.n / seconds / 1e6 : 0.0);
+    printf("peak RSS   %ld KB (%ld KB before the replay)\n", peak_rss(), rss);
+
+    // blocks the traced program never freed
+    for (i = 0; i < s.nslots; i++) Mem_free(blocks[i], __FILE__, __LINE__);
+    free(blocks);
+    free(s.ops);
+    Memtrace_close(&trace);
+
+    return EXIT_SUCCESS;
+}
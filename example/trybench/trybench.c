@@ -0,0 +1,134 @@
+// 'trybench' measures what a TRY costs: entering and leaving one when
+// nothing is raised, and raising into it, next to setjmp() and
+// sigsetjmp() called directly. Then it raises in several threads at
+// once, each catching its own exceptions.
+//
+//     ../../bin/trybench [iterations]
+//
+// To time the TRY of setjmp() instead, build the library and trybench
+// both with EXCEPT_STD_JMP, which must match or trybench fails to link:
+//
+//     make -C ../../src clean all C_FLAG="-Wall -std=c99 -DEXCEPT_STD_JMP"
+//     make clean all C_FLAG="-Wall -std=c99 -pthread -DEXCEPT_STD_JMP"
+
+#define _DEFAULT_SOURCE  // clock_gettime() & sigsetjmp() with -std=c99
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "except.h"
+
+#define NTHREADS 4
+
+static const struct except_t bench_failed = {"Bench Failed"};
+
+// keeps the compiler from dropping the loops
+static volatile long sink;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// out of line, so the raise crosses a call as in real code
+static void __attribute__((noinline)) work(long i, int raise) {
+    if (raise) RAISE(bench_failed);
+    sink += i;
+}
+
+static double bench_try(long n) {
+    double start = now();
+    long i;
+
+    for (i = 0; i < n; i++) {
+        TRY
+            work(i, 0);
+        EXCEPT(bench_failed)
+            sink--;
+        END_TRY;
+    }
+    return (now() - start) / n;
+}
+
+static double bench_raise(long n) {
+    double start = now();
+    long i;
+
+    for (i = 0; i < n; i++) {
+        TRY
+            work(i, 1);
+        EXCEPT(bench_failed)
+            sink--;
+        END_TRY;
+    }
+    return (now() - start) / n;
+}
+
+static double bench_setjmp(long n) {
+    double start = now();
+    jmp_buf env;
+    long i;
+
+    for (i = 0; i < n; i++)
+        if (setjmp(env) == 0) work(i, 0);
+    return (now() - start) / n;
+}
+
+static double bench_sigsetjmp(long n) {
+    double start = now();
+    sigjmp_buf env;
+    long i;
+
+    for (i = 0; i < n; i++)
+        if (sigsetjmp(env, 1) == 0) work(i, 0);
+    return (now() - start) / n;
+}
+
+// raise and catch n times, counting the catches
+static void* catcher(void* cl) {
+    long n = *(long*)cl, i, caught = 0;
+
+    for (i = 0; i < n; i++) {
+        TRY
+            work(i, 1);
+        EXCEPT(bench_failed)
+            caught++;
+        END_TRY;
+    }
+    *(long*)cl = caught;
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    long n = (argc > 1) ? atol(argv[1]) : 10000000;
+    long counts[NTHREADS];
+    pthread_t threads[NTHREADS];
+    int i, ok = 1;
+
+    if (n <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("TRY ... END_TRY      %6.2f ns\n", bench_try(n) * 1e9);
+    printf("TRY, RAISE, EXCEPT   %6.2f ns\n", bench_raise(n) * 1e9);
+    printf("setjmp()             %6.2f ns\n", bench_setjmp(n) * 1e9);
+    printf("sigsetjmp(env, 1)    %6.2f ns\n", bench_sigsetjmp(n) * 1e9);
+
+    for (i = 0; i < NTHREADS; i++) {
+        counts[i] = n / 10;
+        pthread_create(&threads[i], NULL, catcher, &counts[i]);
+    }
+    for (i = 0; i < NTHREADS; i++) {
+        pthread_join(threads[i], NULL);
+        ok = ok && counts[i] == n / 10;
+    }
+    printf("%d threads raising   %s\n", NTHREADS, ok ? "ok" : "FAILED");
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
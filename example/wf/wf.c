@@ -9,8 +9,12 @@
 #include "atom.h"
 #include "io.h"
 #include "mem.h"
+#include "sketch.h"
 #include "table.h"
 
+// number of most frequent words listed in approximate mode
+#define TOP_WORDS 10
+
 int first(int c) {
     return isalpha(c);
 }
@@ -65,22 +69,96 @@ void wf(char* name, FILE* fp) {
     Table_free(&table);
 }
 
+// A candidate for the most frequent words in approximate mode
+struct top_word {
+    char word[128];
+    unsigned long long count;
+};
+
+int compare_count(const void* x, const void* y) {
+    const struct top_word *l = x, *r = y;
+    return (l->count < r->count) - (l->count > r->count);
+}
+
+// Keep the TOP_WORDS words with the highest estimated counts.
+void update_top(struct top_word* top, int* ntop,
+                const char* word, unsigned long long count) {
+    int i, min;
+
+    for (i = 0, min = 0; i < *ntop; i++) {
+        if (strcmp(top[i].word, word) == 0) {
+            top[i].count = count;
+            return;
+        }
+        if (top[i].count < top[min].count) min = i;
+    }
+    if (*ntop < TOP_WORDS)
+        min = (*ntop)++;
+    else if (count <= top[min].count)
+        return;
+    strcpy(top[min].word, word);
+    top[min].count = count;
+}
+
+// Approximate mode: estimate the number of distinct words and the most
+// frequent ones in constant memory, whatever the size of the input.
+void wf_approx(char* name, FILE* fp) {
+    struct hll_t* hll;
+    struct cms_t* cms;
+    struct top_word top[TOP_WORDS];
+    char buf[128];
+    int i, ntop;
+
+    hll = Hll_new(14, NULL);
+    cms = Cms_new(1 << 16, 4, NULL);
+    ntop = 0;
+
+    while (get_word(fp, buf, sizeof(buf), first, rest)) {
+        for (i = 0; buf[i] != '\0'; i++)
+            buf[i] = tolower(buf[i]);
+        Hll_add(hll, buf);
+        Cms_add(cms, buf, 1);
+        update_top(top, &ntop, buf, Cms_estimate(cms, buf));
+    }
+
+    if (name != NULL) printf("%s:\n", name);
+    printf("~%.0f distinct words, %llu words\n", Hll_count(hll), cms->total);
+    qsort(top, ntop, sizeof(top[0]), compare_count);
+    for (i = 0; i < ntop; i++)
+        printf("~%llu\t%s\n", top[i].count, top[i].word);
+
+    Hll_free(&hll);
+    Cms_free(&cms);
+}
+
 int main(int argc, char* argv[]) {
-    int i;
+    int i, first_file;
     FILE* fp;
+    void (*count)(char*, FILE*) = wf;
+
+    // MEM_TRACE=file records the allocations for example/replay
+    if (getenv("MEM_TRACE") != NULL && Mem_trace(getenv("MEM_TRACE")) != 0)
+        fprintf(stderr, "%s: can't trace to '%s'\n", argv[0], getenv("MEM_TRACE"));
+
+    // wf [-a] [file...], -a for the approximate mode
+    first_file = 1;
+    if (argc > 1 && strcmp(argv[1], "-a") == 0) {
+        count = wf_approx;
+        first_file++;
+    }
 
-    for (i = 1; i < argc; i++) {
+    for (i = first_file; i < argc; i++) {
         fp = fopen(argv[i], "r");
         if (fp == NULL) {
             fprintf(stderr, "%s:can't open '%s' (%s)\n",
                     argv[0], argv[i], strerror(errno));
             return EXIT_FAILURE;
         } else {
-            wf(argv[i], fp);
+            count(argv[i], fp);
             fclose(fp);
         }
     }
-    if (argc == 1) wf(NULL, stdin);
+    if (argc == first_file) count(NULL, stdin);
 
     Atom_reset();
     return EXIT_SUCCESS;
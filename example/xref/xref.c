@@ -5,9 +5,9 @@
 #include <string.h>
 
 #include "atom.h"
+#include "intset.h"
 #include "io.h"
 #include "mem.h"
-#include "set.h"
 #include "table.h"
 
 //
@@ -31,34 +31,32 @@ int cmp_str(const void* x, const void* y) {
     return strcmp(*(char**)x, *(char**)y);
 }
 
-// For qsort()
-int sort_int(const void* x, const void* y) {
-    if (**(int**)x < **(int**)y)
-        return -1;
-    else if (**(int**)x > **(int**)y)
-        return 1;
-    else
-        return 0;
-}
-
-// For int set
-int cmp_int(const void* x, const void* y) {
-    return sort_int(&x, &y);
-}
-
-unsigned long hash_int(const void* x) {
-    return (unsigned long)*(int*)x;
-}
-
-// Free the ref-count set of each identifier
-void int_set_free(const void* member, void* cl) {
-    free((void*)member);
-}
-
 // Free the secondary table for file
 void set_table_free(const void* key, void** value, void* cl) {
-    Set_map(*value, int_set_free, NULL);
-    Set_free((struct set_t**)value);
+    Intset_free((struct intset_t**)value);
+}
+
+// State of print_line() while walking the lines of a file
+struct line_range {
+    int count;   // lines printed so far
+    int last;    // previous line
+    int in_run;  // previous line continued a run
+};
+
+// Print lines as " a b-c", a run of consecutive lines as its two ends
+void print_line(unsigned x, void* cl) {
+    struct line_range* r = cl;
+    int line = (int)x;
+
+    if (r->count > 0 && line - 1 == r->last) {
+        r->in_run = 1;
+    } else {
+        if (r->in_run) printf("-%d", r->last);
+        printf(" %d", line);
+        r->in_run = 0;
+    }
+    r->last = line;
+    r->count++;
 }
 
 // Free the first table for identifier
@@ -68,8 +66,9 @@ void table_table_free(const void* key, void** value, void* cl) {
 }
 
 void print(struct table_t* files) {
-    int i, j;
-    void **array, **lines;
+    int i;
+    void** array;
+    struct line_range range;
 
     array = Table_to_array(files, NULL);
     qsort(array, files->size, 2 * sizeof(*array), cmp_str);
@@ -77,20 +76,10 @@ void print(struct table_t* files) {
         if (*(char*)array[i] != '\0') {
             printf("\t%s:", (char*)array[i]);
         }
-        lines = Set_to_array(array[i + 1], NULL);
-        qsort(lines, ((struct set_t*)array[i + 1])->size,
-              sizeof(*lines), sort_int);
-        for (j = 0; lines[j] != NULL; j++) {
-            if (j > 0 && *(int*)lines[j] - 1 == *(int*)lines[j - 1]) {
-                if (lines[j + 1] == NULL || *(int*)lines[j] + 1 != *(int*)lines[j + 1]) {
-                    printf("-");
-                    printf("%d", *(int*)lines[j]);
-                }
-            } else {
-                printf(" %d", *(int*)lines[j]);
-            }
-        }
-        FREE(lines);
+        // intsets are visited in ascending order
+        range.count = range.last = range.in_run = 0;
+        Intset_map(array[i + 1], print_line, &range);
+        if (range.in_run) printf("-%d", range.last);
         printf("\n");
     }
 
@@ -99,10 +88,9 @@ void print(struct table_t* files) {
 
 void xref(const char* name, FILE* fp, struct table_t* identifiers) {
     char buf[128];
-    struct set_t* lines;
+    struct intset_t* lines;
     struct table_t* files;
     const char* id;
-    int* p;
 
     if (name == NULL) name = "";
     name = Atom_string(name);
@@ -116,15 +104,10 @@ void xref(const char* name, FILE* fp, struct table_t* identifiers) {
         }
         lines = Table_get(files, name);
         if (lines == NULL) {
-            lines = Set_create(0, cmp_int, hash_int);
+            lines = Intset_new();
             Table_put(files, name, lines);
         }
-        p = &line_num;
-        if (!Set_has(lines, p)) {
-            NEW(p);
-            *p = line_num;
-            Set_put(lines, p);
-        }
+        Intset_put(lines, line_num);
     }
 }
 
@@ -134,6 +117,10 @@ int main(int argc, char* argv[]) {
     void** array;
     FILE* fp;
 
+    // MEM_TRACE=file records the allocations for example/replay
+    if (getenv("MEM_TRACE") != NULL && Mem_trace(getenv("MEM_TRACE")) != 0)
+        fprintf(stderr, "%s: can't trace to '%s'\n", argv[0], getenv("MEM_TRACE"));
+
     identifiers = Table_create(0, NULL, NULL);
     for (i = 1; i < argc; i++) {
         fp = fopen(argv[i], "r");
@@ -10,4 +10,14 @@ extern void swap(void* lhs, void* rhs, long size);
 // macro of swap for more convenient use
 #define SWAP(lhs, rhs, type) swap(&(lhs), &(rhs), sizeof(type))
 
+/*
+    mix_hash:
+        1. Spread every bit of the hash number h over the 64-bit result,
+        with the finalizer of MurmurHash3.
+        2. Used by the probabilistic structures, whose bit and register
+        choices need well-mixed hash numbers while client hash functions
+        may be as weak as the identity.
+*/
+extern unsigned long long mix_hash(unsigned long h);
+
 #endif
\ No newline at end of file
@@ -16,12 +16,47 @@
     memory, and it can create dangling pointers.
 */
 
+#include "align.h"
 #include "except.h"
 
+struct arena_chunk;  // definition in arena.c
+struct arena_map;    // definition in arena.c
+
 struct arena_t {
-    struct arena_t *prev;  // previous chunk
-    char *avail;           // begin of chunk
-    char *limit;           // end of the chunk
+    char *avail;                // first free byte of the current chunk
+    char *limit;                // end of the current chunk
+    struct arena_chunk *chunk;  // current chunk, on top of the older ones
+    struct arena_chunk *large;  // dedicated chunks of oversized blocks
+    long chunk_size;            // size of the next chunk, grows geometrically
+    struct arena_map *map;      // reserved range, see Arena_new_mapped()
+    long used;                  // bytes allocated outside the current chunk
+    long peak;                  // high-water mark, see Arena_stats()
+    char *lo, *hi;              // bounds of the storage, see Arena_owns()
+};
+
+// savepoint of an arena, see Arena_mark()
+struct arena_mark_t {
+    struct arena_chunk *chunk;
+    char *avail;
+    struct arena_chunk *large;
+};
+
+// usage of an arena, see Arena_stats()
+struct arena_stats_t {
+    long allocated;  // bytes of the blocks in use, rounded up for alignment
+    long reserved;   // bytes of the chunks, and committed part of the range
+    int nchunks;     // chunks, dedicated ones included
+    long waste;      // bytes left unused at the end of retired chunks
+    long peak;       // high-water mark of allocated
+};
+
+// chunk cache, see Arena_cache_stats()
+struct arena_cache_stats_t {
+    int nchunks;  // chunks in the cache
+    long bytes;   // bytes of these chunks
+    int limit;    // bound on nchunks
+    long hits;    // new chunks taken from the cache
+    long misses;  // new chunks allocated with malloc()
 };
 
 extern const struct except_t arena_new_failed;
@@ -34,6 +69,22 @@ extern const struct except_t arena_failed;
 */
 extern struct arena_t *Arena_new(void);
 
+/*
+    Arena_new_mapped:
+        1. Create a new arena backed by a range of nbytes of address space
+        reserved with mmap(), for arenas too big to be built from chunks.
+        2. The range is committed lazily, 2 MB at a time, and transparent
+        huge pages are requested for it where the system has them.
+        Blocks of any size are carved from the range, and once it is full
+        the arena goes on with chunks as Arena_new would.
+        3. Arena_free gives the physical memory of the range back to the
+        system with madvise(MADV_DONTNEED), but keeps the range reserved
+        for reuse. Arena_dispose unmaps it.
+        4. Without mmap(), this is Arena_new. If it can't reserve the range,
+        it raises the exception arena_new_failed.
+*/
+extern struct arena_t *Arena_new_mapped(long nbytes);
+
 /*
     Arena_dispose:
         1. Free the memory associated with the arena *ap.
@@ -47,8 +98,37 @@ extern void Arena_dispose(struct arena_t **ap);
         return a pointer to the first byte.
         2. The block is aligned on an addressing boundary that is suitable 
         for the data with the strictest alignment requirement. 
+        3. When the block fits in the current chunk, this is a compare and
+        a pointer bump done inline. Otherwise Arena_alloc_slow starts a new
+        chunk, each one twice the size of the previous one up to 1 MB, or
+        gives a block larger than a quarter of that a chunk of its own.
 */
-extern void *Arena_alloc(struct arena_t *arena, long nbytes, const char *file, int line);
+extern void *Arena_alloc_slow(struct arena_t *arena, long nbytes, const char *file, int line);
+
+static inline void *Arena_alloc(struct arena_t *arena, long nbytes, const char *file, int line) {
+    nbytes = ROUND_UP_TO_ALIGN_BOUND(nbytes);
+    if (nbytes > 0 && nbytes <= arena->limit - arena->avail) {
+        arena->avail += nbytes;
+        return arena->avail - nbytes;
+    }
+    return Arena_alloc_slow(arena, nbytes, file, line);
+}
+
+/*
+    Arena_try_alloc:
+        1. Same as Arena_alloc, but return NULL instead of raising
+        arena_failed when there is no memory for a new chunk.
+*/
+extern void *Arena_try_alloc_slow(struct arena_t *arena, long nbytes);
+
+static inline void *Arena_try_alloc(struct arena_t *arena, long nbytes) {
+    nbytes = ROUND_UP_TO_ALIGN_BOUND(nbytes);
+    if (nbytes > 0 && nbytes <= arena->limit - arena->avail) {
+        arena->avail += nbytes;
+        return arena->avail - nbytes;
+    }
+    return Arena_try_alloc_slow(arena, nbytes);
+}
 
 /*
     Arena_calloc:
@@ -67,4 +147,76 @@ extern void *Arena_calloc(struct arena_t *arena, long count, long nbytes, const
 */
 extern void Arena_free(struct arena_t *arena);
 
-#endif
\ No newline at end of file
+/*
+    Arena_owns:
+        1. Return 1, if ptr points into storage allocated in arena since it
+        was created or last freed. Otherwise, return 0.
+        2. A ptr outside the bounds of all the chunks of arena is rejected
+        at once, otherwise it walks the chunks, so it is not meant for fast
+        paths.
+*/
+extern int Arena_owns(struct arena_t *arena, const void *ptr);
+
+/*
+    Arena_mark:
+        1. Return a savepoint of arena, which records how much of it is in
+        use. It allocates nothing.
+*/
+extern struct arena_mark_t Arena_mark(struct arena_t *arena);
+
+/*
+    Arena_release_to:
+        1. Deallocate the storage allocated in arena since mark was taken,
+        leaving the older blocks alone. Whole chunks go back to the chunk
+        cache.
+        2. Marks nest like a stack: releasing to a mark invalidates the
+        marks taken after it, and Arena_free invalidates them all. It is a
+        checked runtime error to pass an invalid mark, as far as it can be
+        detected.
+*/
+extern void Arena_release_to(struct arena_t *arena, struct arena_mark_t mark);
+
+/*
+    Arena_stats:
+        1. Fill stats with the usage of arena.
+        2. It walks the chunks of arena and costs nothing to allocations:
+        the counters are only kept up to date when a chunk is started or
+        released, and peak is refreshed from them at these points and by
+        Arena_stats itself.
+*/
+extern void Arena_stats(struct arena_t *arena, struct arena_stats_t *stats);
+
+/*
+    Arena_cache_limit:
+        1. Chunks released by Arena_free are kept in a cache of the calling
+        thread, and reused by later allocations of any arena on that thread.
+        Set the bound on the number of cached chunks to nchunks, free the
+        chunks beyond it, and return the previous bound (10 by default).
+        2. nchunks = 0 disables the cache.
+*/
+extern int Arena_cache_limit(int nchunks);
+
+/*
+    Arena_cache_flush:
+        1. Free all the chunks cached by the calling thread. A thread
+        should call it before it exits, otherwise its cached chunks leak.
+*/
+extern void Arena_cache_flush(void);
+
+/*
+    Arena_cache_stats:
+        1. Fill stats with the state of the chunk cache of the calling
+        thread.
+*/
+extern void Arena_cache_stats(struct arena_cache_stats_t *stats);
+
+/*
+    Arena_cache_stats_global:
+        1. Fill stats with the totals over the chunk caches of all threads.
+        limit is the one of the calling thread.
+        2. The totals are updated atomically but read without a lock, so
+        they may lag behind the other threads by a few operations.
+*/
+extern void Arena_cache_stats_global(struct arena_cache_stats_t *stats);
+
+#endif
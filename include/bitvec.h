@@ -0,0 +1,52 @@
+/*
+    lower level interface of bit vectors.
+
+    A bit vector is a plain array of unsigned long words. The functions
+    below are the word-wide kernels shared by the bit-backed containers,
+    they process the words a vector register at a time where the target
+    supports it.
+*/
+
+#ifndef BITVEC_INCLUDE
+#define BITVEC_INCLUDE
+
+#define BITVEC_WORD_BITS ((int)(8 * sizeof(unsigned long)))
+#define BITVEC_NWORDS(nbits) \
+    (((nbits) + BITVEC_WORD_BITS - 1) / BITVEC_WORD_BITS)
+
+#define BITVEC_GET(words, i) \
+    (((words)[(i) / BITVEC_WORD_BITS] >> ((i) % BITVEC_WORD_BITS)) & 1UL)
+#define BITVEC_SET(words, i) \
+    ((words)[(i) / BITVEC_WORD_BITS] |= 1UL << ((i) % BITVEC_WORD_BITS))
+#define BITVEC_CLEAR(words, i) \
+    ((words)[(i) / BITVEC_WORD_BITS] &= ~(1UL << ((i) % BITVEC_WORD_BITS)))
+
+/*
+    Bitvec_and & Bitvec_or & Bitvec_andnot & Bitvec_xor:
+        1. Store a & b, a | b, a & ~b and a ^ b into dst for nwords words.
+        2. dst may be the same array as a or b.
+        3. nwords >= 0
+*/
+extern void Bitvec_and(unsigned long *dst, const unsigned long *a,
+                       const unsigned long *b, long nwords);
+extern void Bitvec_or(unsigned long *dst, const unsigned long *a,
+                      const unsigned long *b, long nwords);
+extern void Bitvec_andnot(unsigned long *dst, const unsigned long *a,
+                          const unsigned long *b, long nwords);
+extern void Bitvec_xor(unsigned long *dst, const unsigned long *a,
+                       const unsigned long *b, long nwords);
+
+/*
+    Bitvec_count:
+        1. Return the number of set bits in the first nwords words.
+*/
+extern long Bitvec_count(const unsigned long *a, long nwords);
+
+/*
+    Bitvec_next:
+        1. Return the index of the first set bit at or after bit i,
+        or -1 if there is none in the first nwords words.
+*/
+extern long Bitvec_next(const unsigned long *a, long nwords, long i);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+    A Bloom filter answers "possibly a member" or "definitely not a
+    member" for the keys added to it, in a fixed number of bits per key.
+
+    This one is blocked: all the bits of a key lie in one 512-bit block,
+    which is one cache line, so a probe touches a single line whatever
+    the number of bits per key. Keys are given by their hash numbers,
+    which the filter mixes again, so weak hash functions such as the
+    identity on ints are acceptable.
+
+    Bloom filters can't forget a key. Clients that remove keys keep count
+    in nremoved and rebuild the filter when too many are stale.
+*/
+
+#ifndef BLOOM_INCLUDE
+#define BLOOM_INCLUDE
+
+struct bloom_t {
+    long nblocks;          // number of 512-bit blocks
+    long capacity;         // number of keys the filter is sized for
+    long nremoved;         // keys removed by clients since the last clear
+    int bits_per_key;      // as given to Bloom_new()
+    int k;                 // bits set per key
+    unsigned long *words;  // blocks, aligned on a cache line
+    void *block;           // allocated memory holding words
+};
+
+/*
+    Bloom_new:
+        1. Create an empty filter for nkeys keys with bits_per_key bits
+        per key. 10 bits per key give about 1% false positives.
+        2. nkeys >= 0, bits_per_key > 0
+*/
+extern struct bloom_t *Bloom_new(long nkeys, int bits_per_key);
+
+/*
+    Bloom_try_new:
+        1. Same as Bloom_new, but return NULL instead of raising mem_failed.
+*/
+extern struct bloom_t *Bloom_try_new(long nkeys, int bits_per_key);
+
+/*
+    Bloom_free:
+        1. Free the filter and set it to NULL.
+*/
+extern void Bloom_free(struct bloom_t **bloom);
+
+/*
+    Bloom_add:
+        1. Add the key whose hash number is h.
+*/
+extern void Bloom_add(struct bloom_t *bloom, unsigned long h);
+
+/*
+    Bloom_has:
+        1. Return 0 if the key whose hash number is h was never added,
+        otherwise return 1, which may be a false positive.
+*/
+extern int Bloom_has(struct bloom_t *bloom, unsigned long h);
+
+/*
+    Bloom_clear:
+        1. Forget all the keys and reset nremoved.
+*/
+extern void Bloom_clear(struct bloom_t *bloom);
+
+#endif
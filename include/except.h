@@ -18,6 +18,40 @@
 
 #include <setjmp.h>  // setjmp() & longjmp() & jmp_buf
 
+/*
+    Each thread has its own stack of frames. TRY saves its context with
+    the cheapest jump primitive at hand: with GCC, and Clang on x86, the
+    builtin setjmp saves no more than the frame and stack pointers and
+    never the signal mask, where setjmp saves every callee-saved register
+    and, on the BSDs and macOS, makes a system call for the mask.
+    Define EXCEPT_STD_JMP to use setjmp anyway.
+
+    The choice changes the frames and the jump of Except_raise, so the
+    library and all its clients must be built with the same setting. The
+    stack is named after it, except_stack_builtin_jmp or
+    except_stack_std_jmp, so that a client built otherwise fails to link
+    instead of crashing at the first RAISE.
+*/
+#if defined(__GNUC__)
+#define EXCEPT_THREAD_LOCAL __thread
+#else
+#define EXCEPT_THREAD_LOCAL
+#endif
+
+#if !defined(EXCEPT_STD_JMP) && defined(__GNUC__) && \
+    (!defined(__clang__) || defined(__x86_64__) || defined(__i386__))
+typedef void* except_jmp_buf[5];
+// the builtin longjmp can only pass 1, which is EXCEPT_RAISED
+#define EXCEPT_SETJMP(env) __builtin_setjmp(env)
+#define EXCEPT_LONGJMP(env) __builtin_longjmp((env), 1)
+#define except_stack except_stack_builtin_jmp
+#else
+typedef jmp_buf except_jmp_buf;
+#define EXCEPT_SETJMP(env) setjmp(env)
+#define EXCEPT_LONGJMP(env) longjmp((env), EXCEPT_RAISED)
+#define except_stack except_stack_std_jmp
+#endif
+
 struct except_t {
     char* reason;
     // be initialized to a string that describes the exception
@@ -28,7 +62,7 @@ struct except_t {
 
 struct except_frame {
     struct except_frame* prev;  // point to predecessor
-    jmp_buf env;
+    except_jmp_buf env;
     const char* file;
     int line;
     const struct except_t* exception;
@@ -42,8 +76,8 @@ enum {
     EXCEPT_FINALIZED,
 };
 
-// stack-top pointer
-extern struct except_frame* except_stack;
+// stack-top pointer of the calling thread
+extern EXCEPT_THREAD_LOCAL struct except_frame* except_stack;
 
 // definition in assert.c
 extern const struct except_t assert_failed;
@@ -137,13 +171,13 @@ void Except_raise(const struct except_t* e, const char* file, int line);
 
 #define EXCEPT_STACK_POP except_stack = except_stack->prev
 
-#define TRY                                       \
-    do {                                          \
-        volatile int _except_flag;                \
-        struct except_frame _except_frame;        \
-        _except_frame.prev = except_stack;        \
-        except_stack = &_except_frame;            \
-        _except_flag = setjmp(_except_frame.env); \
+#define TRY                                              \
+    do {                                                 \
+        volatile int _except_flag;                       \
+        struct except_frame _except_frame;               \
+        _except_frame.prev = except_stack;               \
+        except_stack = &_except_frame;                   \
+        _except_flag = EXCEPT_SETJMP(_except_frame.env); \
         if (_except_flag == EXCEPT_ENTERED) {
 #define EXCEPT(e)                                         \
     if (_except_flag == EXCEPT_ENTERED) EXCEPT_STACK_POP; \
@@ -0,0 +1,106 @@
+/*
+    An intset is a set of unsigned 32-bit integers stored in compressed
+    form. Members are grouped by their high 16 bits into containers, and
+    each container holds the low 16 bits in whichever of three forms is
+    the smallest for its contents:
+        1) a sorted array of shorts, for at most 4096 members,
+        2) a bitmap of 65536 bits, for more members,
+        3) a list of runs, for members forming long consecutive ranges
+        (only after Intset_optimize).
+    Unlike set_t, members are kept in ascending order, so iteration needs
+    no sorting, and operations between intsets work container by
+    container with word-wide loops over the bitmaps.
+*/
+
+#ifndef INTSET_INCLUDE
+#define INTSET_INCLUDE
+
+#include <stdio.h>  // FILE
+
+struct intset_container;  // definition in intset.c
+
+struct intset_t {
+    long size;     // number of members
+    int n;         // number of containers
+    int capacity;  // length of keys and containers
+    unsigned long time_stamp;
+    unsigned short *keys;  // high 16 bits of each container, ascending
+    struct intset_container **containers;
+};
+
+/*
+    Intset_new:
+        1. Create an empty intset.
+*/
+extern struct intset_t *Intset_new(void);
+
+/*
+    Intset_free:
+        1. Free the intset and set it to NULL.
+*/
+extern void Intset_free(struct intset_t **set);
+
+/*
+    Intset_has:
+        1. Return 1, if x is a member of set. Otherwise, return 0.
+*/
+extern int Intset_has(struct intset_t *set, unsigned x);
+
+/*
+    Intset_put:
+        1. Add x to set. Adding a member twice is harmless.
+*/
+extern void Intset_put(struct intset_t *set, unsigned x);
+
+/*
+    Intset_remove:
+        1. Remove x from set. Return 1 if it was a member, otherwise 0.
+*/
+extern int Intset_remove(struct intset_t *set, unsigned x);
+
+/*
+    Intset_map:
+        1. Call the function apply for each member in ascending order.
+        2. set can't be changed while Intset_map is visiting it.
+*/
+extern void Intset_map(struct intset_t *set,
+                       void (*apply)(unsigned x, void *cl),
+                       void *cl);
+
+/*
+    Intset_optimize:
+        1. Convert the containers whose members form few enough runs into
+        run containers.
+        2. Run containers are turned back into arrays or bitmaps by the
+        first Intset_put or Intset_remove on them, so it pays to call
+        this once the set is built.
+*/
+extern void Intset_optimize(struct intset_t *set);
+
+/*
+    Intset_union & Intset_inter & Intset_minus & Intset_diff:
+        1. Return a new intset holding s + t, s * t, s - t and s ^ t.
+        2. Either s or t may be NULL, which stands for the empty set,
+        but not both of them.
+*/
+extern struct intset_t *Intset_union(struct intset_t *s, struct intset_t *t);
+extern struct intset_t *Intset_inter(struct intset_t *s, struct intset_t *t);
+extern struct intset_t *Intset_minus(struct intset_t *s, struct intset_t *t);
+extern struct intset_t *Intset_diff(struct intset_t *s, struct intset_t *t);
+
+/*
+    Intset_write:
+        1. Write set to fp in a compact binary format, which does not
+        depend on the byte order or word size of the host.
+        2. Return the number of bytes written, or -1 if fp reported an error.
+*/
+extern long Intset_write(struct intset_t *set, FILE *fp);
+
+/*
+    Intset_read:
+        1. Read an intset written by Intset_write from fp.
+        2. Return NULL if the input is truncated or malformed.
+*/
+extern struct intset_t *Intset_read(FILE *fp);
+
+#endif
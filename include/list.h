@@ -5,6 +5,8 @@
 #ifndef LIST_INCLUDE
 #define LIST_INCLUDE
 
+struct arena_t;  // definition in arena.h
+
 struct node_t {
     struct node_t* prev;
     struct node_t* next;
@@ -15,6 +17,7 @@ struct list_t {
     struct node_t* tail;
     struct node_t* head;
     int len;
+    struct arena_t* arena;  // storage of the list and its nodes, NULL for the heap
 };
 
 /*
@@ -24,6 +27,15 @@ struct list_t {
 */
 extern struct list_t* List_create(void* x, ...);
 
+/*
+    List_create_in:
+        1. Create a list as List_create does, but allocate the list and all
+        its nodes in arena.
+        2. The storage is reclaimed by Arena_free or Arena_dispose of arena,
+        so List_free and the functions removing nodes free nothing.
+*/
+extern struct list_t* List_create_in(struct arena_t* arena, void* x, ...);
+
 /*
     Basic operations on a list
 */
@@ -35,6 +47,13 @@ extern void List_reverse(struct list_t* list);
 extern int List_remove(struct list_t* list, void* x);  // remove the first one
 extern void List_free(struct list_t** list);
 
+/*
+    List_try_push_back:
+        1. Same as List_push_back, but return 0, or -1 if there is no memory
+        for the node, the list being left unchanged.
+*/
+extern int List_try_push_back(struct list_t* list, void* x);
+
 /*
     List_map:
         1. Walk down the list while calling the closure function apply for all nodes.
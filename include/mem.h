@@ -6,6 +6,9 @@
 // definition in implementation file
 extern const struct except_t mem_failed;
 
+struct arena_t;  // definition in arena.h
+struct mem_budget_t;  // definition in memhook.c
+
 /*
     Mem_alloc:
         1. Accept the size of required memory space and where it is called.
@@ -18,6 +21,16 @@ extern const struct except_t mem_failed;
 */
 extern void *Mem_alloc(long nbytes, const char *file, int line);
 
+/*
+    Mem_try_alloc:
+        1. Same as Mem_alloc, but return NULL when the memory or the budget
+        (see Mem_budget_new) runs out, instead of raising mem_failed, or
+        arena_failed in a pushed arena.
+        2. A loop handling allocation failure tests the result instead of
+        paying for a TRY at each iteration, only the failure costs more.
+*/
+extern void *Mem_try_alloc(long nbytes, const char *file, int line);
+
 /*
     Mem_calloc:
         1. Accept the size of an array, size of an element and where it is
@@ -30,6 +43,29 @@ extern void *Mem_alloc(long nbytes, const char *file, int line);
 */
 extern void *Mem_calloc(long count, long nbytes, const char *file, int line);
 
+/*
+    Mem_alloc_aligned:
+        1. Allocate nbytes aligned on align bytes, such as a cache line for
+        per-thread counters that must not share one, or the width of the
+        vectors of a SIMD loop.
+        2. nbytes > 0, align is a power of two
+        3. The block is freed by Mem_free. Mem_resize keeps the alignment
+        of Mem_alloc only.
+*/
+extern void *Mem_alloc_aligned(long nbytes, long align, const char *file, int line);
+
+/*
+    Mem_alloc_batch:
+        1. Allocate n blocks of nbytes and store them in ptrs[0..n-1], as n
+        calls of Mem_alloc would, each one to be freed by Mem_free.
+        2. n >= 0, nbytes > 0
+        3. If mem_failed is raised, none of the blocks is left allocated.
+        4. The pool implementation takes the blocks from its free lists in
+        one pass, which is cheaper than one call per node for containers
+        built of many small nodes.
+*/
+extern void Mem_alloc_batch(long n, long nbytes, void **ptrs, const char *file, int line);
+
 /*
     Mem_resize:
         1. Changes the size of the block allocated by a previous call to
@@ -64,12 +100,139 @@ extern void Mem_free(void *ptr, const char *file, int line);
         will raise assert_failed.
         3. Only implemented in memchk.c.
         4. Use Mem_log(NULL) to close the logger.
-
+        5. The invalid calls are written to stm by a background thread, as
+        binary records in the format of memlog.h, so logging costs the
+        calling thread no more than a clock read. Render them with
+        Memlog_render, as bin/memlog does.
 */
 extern void Mem_log(FILE *stm);
 
+/*
+    Mem_push_arena:
+        1. Make Mem_alloc, Mem_calloc and Mem_resize of the calling thread
+        carve their blocks from arena, until the matching Mem_pop_arena.
+        Pushes nest up to 16 deep, the innermost arena is used.
+        2. Mem_free does nothing to a block of a pushed arena, and
+        Mem_resize keeps it in its arena. Such blocks are deallocated all
+        at once by Arena_free or Arena_dispose, so a whole set of tables
+        and lists can be dropped without freeing them one by one. Atoms
+        always stay on the heap, since they live as long as the program.
+        3. When the arena runs out of memory, arena_failed is raised
+        instead of mem_failed.
+        4. A block of an arena must not be passed to Mem_free or Mem_resize
+        once the arena is popped. This is an unchecked runtime error.
+*/
+extern void Mem_push_arena(struct arena_t *arena);
+
+/*
+    Mem_pop_arena:
+        1. Stop allocating from the arena pushed last, and return it.
+        2. It is a checked runtime error to pop from an empty stack.
+*/
+extern struct arena_t *Mem_pop_arena(void);
+
+/*
+    Mem_budget_new:
+        1. Create a budget of memory with a soft and a hard limit in bytes,
+        0 for none, and return it. soft <= hard when both are set.
+        2. Blocks allocated by a thread while the budget is on top of its
+        stack (see Mem_push_budget) are charged to it and to parent and the
+        budgets parent is part of, and given back when freed, by any
+        thread. So a budget per thread with one per scope under it bounds
+        both.
+        3. over(budget, used, cl) is called by the allocating thread when
+        used goes past soft, so that a table can spill or a cache evict,
+        and when an allocation would go past hard, before mem_failed is
+        raised. If over frees enough, the allocation goes on. over may
+        allocate and free, but over is not called again until it returns,
+        and it must not raise an exception. over may be NULL.
+        4. The limits are checked before each allocation, so threads
+        allocating at once from a budget may go past hard by the blocks
+        they have in flight. Blocks of a pushed arena are not charged.
+*/
+extern struct mem_budget_t *Mem_budget_new(struct mem_budget_t *parent, long soft, long hard,
+                                           void (*over)(struct mem_budget_t *budget, long used,
+                                                        void *cl),
+                                           void *cl);
+
+/*
+    Mem_budget_free:
+        1. Deallocate *budget and set it to NULL.
+        2. It is a checked runtime error to free a budget with blocks still
+        charged to it or to a budget under it.
+*/
+extern void Mem_budget_free(struct mem_budget_t **budget);
+
+/*
+    Mem_budget_used & Mem_budget_peak:
+        1. Return the bytes charged to budget, and their maximum so far.
+*/
+extern long Mem_budget_used(struct mem_budget_t *budget);
+extern long Mem_budget_peak(struct mem_budget_t *budget);
+
+/*
+    Mem_push_budget & Mem_pop_budget:
+        1. Charge the blocks allocated by the calling thread to budget,
+        until the matching Mem_pop_budget, which returns it. Pushes nest up
+        to 16 deep, the innermost budget is charged. A budget may be pushed
+        by several threads.
+        2. A block resized under another budget is charged to that one.
+        3. It is a checked runtime error to pop from an empty stack.
+*/
+extern void Mem_push_budget(struct mem_budget_t *budget);
+extern struct mem_budget_t *Mem_pop_budget(void);
+
+/*
+    Mem_profile:
+        1. Sample the allocations of all threads, one per rate bytes on
+        average (the samples form a Poisson process over the allocated
+        bytes), and gather the live and total bytes and blocks per call
+        site. Mem_profile(0) stops sampling, the gathered data is kept.
+        2. Each sample is weighted by the bytes it stands for, so the
+        figures are unbiased estimates. With rate = 512 KB, the overhead
+        is a compare per allocation and a lookup per free of a sampled
+        block.
+        3. Blocks allocated in a pushed arena are not sampled.
+*/
+extern void Mem_profile(long rate);
+
+/*
+    Mem_profile_dump:
+        1. Write the call sites gathered by Mem_profile to fp, one per line,
+        by decreasing live bytes.
+*/
+extern void Mem_profile_dump(FILE *fp);
+
+/*
+    Mem_leak:
+        1. Call apply for each block still allocated, with its address,
+        size and the location that allocated it.
+        2. The checking implementation reports every block. The others
+        report the blocks sampled by Mem_profile, which is enough to find
+        the sites that leak.
+*/
+extern void Mem_leak(void (*apply)(const void *ptr, long size, const char *file, int line, void *cl),
+                     void *cl);
+
+/*
+    Mem_trace:
+        1. Record every Mem_alloc, Mem_calloc, Mem_resize and Mem_free of
+        all threads to the file path, in the format of memtrace.h, until
+        Mem_trace(NULL) writes out the rest and closes it. A trace still
+        open at exit is closed then.
+        2. Return 0, or -1 if path can't be opened or writing failed.
+        3. Events go through a lock-free buffer and are written by blocks,
+        so the cost is a clock read and an atomic add per call. Blocks of
+        a pushed arena are not traced.
+        4. It is a checked runtime error to start a second trace. No other
+        thread may be calling Mem_* while a trace starts or stops.
+*/
+extern int Mem_trace(const char *path);
+
 #define ALLOC(nbytes) Mem_alloc((nbytes), __FILE__, __LINE__)
 #define CALLOC(count, nbytes) Mem_calloc((count), (nbytes), __FILE__, __LINE__)
+#define ALLOC_ALIGNED(nbytes, align) Mem_alloc_aligned((nbytes), (align), __FILE__, __LINE__)
+#define ALLOC_BATCH(n, nbytes, ptrs) Mem_alloc_batch((n), (nbytes), (ptrs), __FILE__, __LINE__)
 
 /*
     When using malloc(), we always write codes like below:
@@ -0,0 +1,190 @@
+/*
+    lower level interface of the Mem hooks.
+
+    The Mem interface has three implementations, mem.c, memchk.c and
+    mempool.c, and a program links one of them. What they share, such as
+    the arenas pushed by Mem_push_arena, lives in memhook.c so that it is
+    defined once whichever implementation is linked. Each Mem_* function tests the hooks
+    before doing its own work, which costs one thread-local load when no
+    hook is active.
+*/
+
+#ifndef MEMHOOK_INCLUDE
+#define MEMHOOK_INCLUDE
+
+#if defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+#if defined(__GNUC__)
+#define MEMHOOK_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#else
+#define MEMHOOK_LOAD(x) (x)
+#endif
+
+// bound on the nesting of Mem_push_arena
+#define MEMHOOK_MAX_ARENAS 16
+
+// bound on the nesting of Mem_push_budget
+#define MEMHOOK_MAX_BUDGETS 16
+
+// number of arenas pushed by the calling thread
+extern THREAD_LOCAL int memhook_narenas;
+
+/*
+    Memhook_arena_alloc:
+        1. Allocate nbytes from the arena on top of the stack of the calling
+        thread. The block is preceded by a header holding its size, and
+        aligned as for Mem_alloc.
+        2. memhook_narenas > 0
+*/
+extern void *Memhook_arena_alloc(long nbytes, const char *file, int line);
+
+/*
+    Memhook_arena_try_alloc:
+        1. Same as Memhook_arena_alloc, but return NULL instead of raising
+        arena_failed.
+*/
+extern void *Memhook_arena_try_alloc(long nbytes);
+
+/*
+    Memhook_arena_alloc_aligned:
+        1. Same as Memhook_arena_alloc, for a block aligned on align bytes.
+        The header is right in front of the block, so it resizes and frees
+        as the others.
+*/
+extern void *Memhook_arena_alloc_aligned(long nbytes, long align, const char *file, int line);
+
+/*
+    Memhook_arena_owns:
+        1. Return 1, if ptr was allocated by Memhook_arena_alloc in an
+        arena on the stack of the calling thread. Otherwise, return 0.
+        2. It checks the bounds of each pushed arena and the tag in the
+        header of the block, not the chunks, so it is cheap enough for
+        every Mem_free while an arena is pushed.
+*/
+extern int Memhook_arena_owns(const void *ptr);
+
+/*
+    Memhook_arena_resize:
+        1. Resize a block for which Memhook_arena_owns returned 1, in its
+        own arena. The last block of the current chunk grows or shrinks in
+        place, others are copied.
+*/
+extern void *Memhook_arena_resize(void *ptr, long nbytes, const char *file, int line);
+
+// mean number of bytes between two samples, 0 when not profiling
+extern long memhook_sample_rate;
+
+// bytes left to allocate by the calling thread before the next sample
+extern THREAD_LOCAL long memhook_sample_left;
+
+// number of sampled blocks still allocated
+extern long memhook_nsampled;
+
+// number of budgets pushed by the calling thread
+extern THREAD_LOCAL int memhook_nbudgets;
+
+// number of blocks charged to a budget still allocated
+extern long memhook_ncharged;
+
+/*
+    MEMHOOK_ALLOC & MEMHOOK_FREE:
+        1. Tell the profiler that ptr of nbytes was allocated at file and
+        line, or is about to be freed, and charge it to the innermost budget
+        of the calling thread, or give its bytes back to the one it was
+        charged to.
+        2. Unless profiling or budgeting, they cost two loads and compares,
+        and they take no lock unless ptr is sampled or charged.
+*/
+#define MEMHOOK_ALLOC(ptr, nbytes, file, line)                          \
+    do {                                                                \
+        if (MEMHOOK_LOAD(memhook_sample_rate) > 0 &&                    \
+            (memhook_sample_left -= (nbytes)) < 0)                      \
+            Memhook_sample((ptr), (nbytes), (file), (line));            \
+        if (memhook_nbudgets > 0) Memhook_charge((ptr), (nbytes));      \
+    } while (0)
+#define MEMHOOK_FREE(ptr)                                               \
+    do {                                                                \
+        if (MEMHOOK_LOAD(memhook_nsampled) > 0) Memhook_unsample(ptr);  \
+        if (MEMHOOK_LOAD(memhook_ncharged) > 0) Memhook_uncharge(ptr);  \
+    } while (0)
+
+/*
+    MEMHOOK_ADMIT:
+        1. Raise mem_failed at file and line, if nbytes more would take a
+        budget of the calling thread past its hard limit. old is the block
+        being resized, whose bytes are given back, or NULL.
+        2. It goes before the allocation, MEMHOOK_ALLOC charges the block
+        once it is made.
+*/
+#define MEMHOOK_ADMIT(nbytes, old, file, line)                          \
+    do {                                                                \
+        if (memhook_nbudgets > 0 && !Memhook_admit((nbytes), (old))) {  \
+            if ((file) == NULL)                                         \
+                RAISE(mem_failed);                                      \
+            else                                                        \
+                Except_raise(&mem_failed, (file), (line));              \
+        }                                                               \
+    } while (0)
+
+/*
+    Memhook_sample & Memhook_unsample:
+        1. Record the sample of ptr and draw the distance to the next
+        sample, or forget ptr if it was sampled. Of two samples of ptr,
+        the older one is forgotten.
+*/
+extern void Memhook_sample(const void *ptr, long nbytes, const char *file, int line);
+extern void Memhook_unsample(const void *ptr);
+
+/*
+    Memhook_admit & Memhook_charge & Memhook_uncharge:
+        1. Check nbytes against the hard limits of the innermost budget and
+        the budgets it is part of, calling the over callback of the first
+        one exceeded before giving up. Return 1 if the block fits, or 0.
+        2. Record ptr of nbytes as charged to those budgets, calling the
+        over callbacks of those whose soft limit it crosses, or forget ptr
+        and give its bytes back if it was charged, the older charge of two.
+        3. A resize gives the old block back only once it has succeeded,
+        a block that couldn't be resized stays charged.
+*/
+extern int Memhook_admit(long nbytes, const void *old);
+extern void Memhook_charge(const void *ptr, long nbytes);
+extern void Memhook_uncharge(const void *ptr);
+
+/*
+    Memhook_leak:
+        1. Call apply for each sampled block still allocated, as Mem_leak
+        does for implementations that don't track every block.
+*/
+extern void Memhook_leak(void (*apply)(const void *ptr, long size, const char *file, int line, void *cl),
+                         void *cl);
+
+// nonzero while Mem_trace is recording
+extern int memhook_tracing;
+
+/*
+    MEMHOOK_TRACE:
+        1. Record a call of op (one of the MEMTRACE_* opcodes) that left
+        ptr of nbytes, old being the block before a resize.
+        2. Unless tracing, it costs a load and a compare.
+        3. Each Mem_* function records itself once; those built on others
+        call untraced helpers rather than the traced functions.
+*/
+#define MEMHOOK_TRACE(op, ptr, old, nbytes, file, line)                 \
+    do {                                                                \
+        if (MEMHOOK_LOAD(memhook_tracing))                              \
+            Memhook_trace((op), (ptr), (old), (nbytes), (file), (line)); \
+    } while (0)
+
+/*
+    Memhook_trace:
+        1. Append the event to the trace buffer shared by all threads,
+        writing the buffer out when a block of it fills up.
+*/
+extern void Memhook_trace(int op, const void *ptr, const void *old, long nbytes,
+                          const char *file, int line);
+
+#endif
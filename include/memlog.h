@@ -0,0 +1,109 @@
+/*
+    A memory log holds the invalid Mem_free and Mem_resize calls caught by
+    the checking implementation after Mem_log(stm). The calling thread only
+    appends a fixed-size record to a ring of its own; a background thread
+    writes the rings out to stm, so a program logging errors under load
+    runs at the same speed. The log is binary, Memlog_render turns it into
+    text afterwards.
+
+    The stream starts with the 8 bytes "CIILOG01" and is followed by
+    records, each an opcode byte and little-endian fields:
+        MEMLOG_FILE     id:2 length:2 name:length
+        other records   thread:4 time:8 ptr:8 file:2 line:4
+                        size:8 alloc_file:2 alloc_line:4
+    time is in nanoseconds since logging started, thread numbers the
+    logging threads from 1, file and line are where the call was made,
+    and for MEMLOG_FREE_FREED size, alloc_file and alloc_line describe the
+    block. A file refers to an earlier MEMLOG_FILE record, 0 for no file.
+*/
+
+#ifndef MEMLOG_INCLUDE
+#define MEMLOG_INCLUDE
+
+#include <stdio.h>  // FILE
+
+#define MEMLOG_MAGIC "CIILOG01"
+
+// record opcodes
+enum {
+    MEMLOG_FILE = 1,
+    MEMLOG_FREE_INVALID,    // Mem_free of a pointer never allocated
+    MEMLOG_FREE_FREED,      // Mem_free of a block already freed
+    MEMLOG_RESIZE_INVALID,  // Mem_resize of a misaligned pointer
+    MEMLOG_RESIZE_UNALLOC,  // Mem_resize of a block not allocated
+    MEMLOG_LOST,            // size events dropped, the ring was full
+};
+
+struct memlog_event_t {
+    int kind;  // one of the opcodes but MEMLOG_FILE
+    unsigned thread;
+    unsigned long long time;
+    unsigned long long ptr;
+    const char *file;
+    int line;
+    long size;
+    const char *alloc_file;
+    int alloc_line;
+};
+
+// Writer, used by the checking implementation
+
+/*
+    Memlog_start:
+        1. Write the header to stm and start the thread draining the
+        records to it. Logging stops at exit at the latest.
+        2. Return 0, or -1 if writing failed or the thread can't start.
+        3. It is a checked runtime error to start logging twice.
+*/
+extern int Memlog_start(FILE *stm);
+
+/*
+    Memlog_stop:
+        1. Write out the records logged so far, flush the stream and stop
+        the draining thread. The stream is not closed.
+*/
+extern void Memlog_stop(void);
+
+/*
+    Memlog_put:
+        1. Append an event to the ring of the calling thread, without a
+        lock or a system call but reading the clock. When the ring is full
+        the event is dropped and counted in a MEMLOG_LOST record.
+*/
+extern void Memlog_put(int kind, const void *ptr, const char *file, int line,
+                       long size, const char *alloc_file, int alloc_line);
+
+// Reader
+
+struct memlog_t;  // definition in memlog.c
+
+/*
+    Memlog_open:
+        1. Start reading the log in fp.
+        2. Return NULL if fp does not start with a log header.
+*/
+extern struct memlog_t *Memlog_open(FILE *fp);
+
+/*
+    Memlog_read:
+        1. Read the next event of log into ev. The file names in events
+        stay valid until Memlog_close.
+        2. Return 1 if an event was read, 0 at the end of the log, or -1
+        if the log is truncated or malformed.
+*/
+extern int Memlog_read(struct memlog_t *log, struct memlog_event_t *ev);
+
+/*
+    Memlog_render:
+        1. Write ev to fp as text, in the words of the checking
+        implementation.
+*/
+extern void Memlog_render(const struct memlog_event_t *ev, FILE *fp);
+
+/*
+    Memlog_close:
+        1. Free log and set it to NULL. The file is not closed.
+*/
+extern void Memlog_close(struct memlog_t **log);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+    A memory trace records the Mem_alloc, Mem_calloc, Mem_resize and
+    Mem_free calls of a program, as written by Mem_trace, so that the
+    same pattern can be replayed later against any Mem implementation.
+
+    The file starts with the 8 bytes "CIITRC01" and is followed by
+    records, each an opcode byte and little-endian fields:
+        MEMTRACE_FILE   id:2 length:2 name:length
+        MEMTRACE_ALLOC  file:2 line:4 time:8 id:8 size:8
+        MEMTRACE_CALLOC file:2 line:4 time:8 id:8 size:8
+        MEMTRACE_RESIZE file:2 line:4 time:8 id:8 size:8 old:8
+        MEMTRACE_FREE   file:2 line:4 time:8 id:8
+    time is in nanoseconds since tracing started, id is the address of the
+    block in the traced run (old is the address before a resize), and
+    file refers to an earlier MEMTRACE_FILE record, 0 for no file.
+*/
+
+#ifndef MEMTRACE_INCLUDE
+#define MEMTRACE_INCLUDE
+
+#include <stdio.h>  // FILE
+
+#define MEMTRACE_MAGIC "CIITRC01"
+
+// record opcodes
+enum {
+    MEMTRACE_FILE = 1,
+    MEMTRACE_ALLOC,
+    MEMTRACE_CALLOC,
+    MEMTRACE_RESIZE,
+    MEMTRACE_FREE,
+};
+
+struct memtrace_event_t {
+    int op;  // one of MEMTRACE_ALLOC, _CALLOC, _RESIZE and _FREE
+    const char *file;
+    int line;
+    unsigned long long time;
+    unsigned long long id;
+    unsigned long long old;  // id before a MEMTRACE_RESIZE
+    long size;
+};
+
+struct memtrace_t;  // definition in memtrace.c
+
+/*
+    Memtrace_open:
+        1. Start reading the trace in fp.
+        2. Return NULL if fp does not start with a trace header.
+*/
+extern struct memtrace_t *Memtrace_open(FILE *fp);
+
+/*
+    Memtrace_read:
+        1. Read the next event of trace into ev. The file names in events
+        stay valid until Memtrace_close.
+        2. Return 1 if an event was read, 0 at the end of the trace, or
+        -1 if the trace is truncated or malformed.
+*/
+extern int Memtrace_read(struct memtrace_t *trace, struct memtrace_event_t *ev);
+
+/*
+    Memtrace_close:
+        1. Free trace and set it to NULL. The file is not closed.
+*/
+extern void Memtrace_close(struct memtrace_t **trace);
+
+#endif
@@ -11,6 +11,9 @@
 typedef int (*cmp_t)(const void *, const void *);
 typedef unsigned long (*hash_t)(const void *);
 
+struct arena_t;  // definition in arena.h
+struct bloom_t;  // definition in bloom.h
+
 struct member {
     struct member *link;
     const void *value;  // Attention!
@@ -25,8 +28,16 @@ struct set_t {
     // function pointers
     cmp_t cmp;
     hash_t hash;
-    // flexible array members
+    // bucket array, reallocated when the set grows
     struct member **buckets;
+    // Bloom filter in front of buckets, see Set_filter()
+    struct bloom_t *filter;
+    // dense mode, see Set_create_dense(); words is NULL for chained sets
+    unsigned long *words;
+    int lo;      // member represented by bit 0
+    int nwords;  // length of words
+    // storage of the set and its members, NULL for the heap
+    struct arena_t *arena;
 };
 
 /*
@@ -43,15 +54,61 @@ struct set_t {
             2) hash() must return a hash number for key.
             3) Each set can have its own cmp() and hash().
             4) In default, it will use Atom_hash() and Atom_cmp().
+        4. The set rehashes itself into more buckets when the average chain
+        length exceeds a fixed load factor, so hint only saves the early
+        rehashes.
 */
 extern struct set_t *Set_create(int hint, cmp_t cmp, hash_t hash);
 
+/*
+    Set_create_in:
+        1. Create a set as Set_create does, but allocate the set, its
+        buckets and its members in arena.
+        2. The storage is reclaimed by Arena_free or Arena_dispose of arena,
+        so Set_free and Set_remove free nothing but the filter.
+        3. The results of Set_union and the like are heap sets.
+*/
+extern struct set_t *Set_create_in(struct arena_t *arena, int hint, cmp_t cmp, hash_t hash);
+
+/*
+    Set_create_dense:
+        1. Create a set of int members backed by a bit vector, one bit per
+        value in [lo, hi]. It costs (hi - lo + 1) / 8 bytes in all, and no
+        allocation per member.
+        2. Members are passed and returned as pointers to int, like the
+        members of a set created with an int cmp() and hash(). The set keeps
+        the values, not the pointers, so clients needn't allocate them.
+        3. hi is an estimate: putting a member greater than hi grows the
+        vector. It is a checked runtime error to put a member less than lo.
+        4. Set_map and Set_to_array visit the members in ascending order.
+        The pointer passed to apply is only valid during the call; the
+        array returned by Set_to_array holds its own copy of the values
+        and is released with a single FREE.
+        5. Operations between sets require both of them to be dense with
+        the same lo, and then run as word-wide AND/OR/ANDN/XOR loops.
+*/
+extern struct set_t *Set_create_dense(int lo, int hi);
+
 /*
     Set_free:
         1. Free the set and set it to NULL.
 */
 extern void Set_free(struct set_t **set);
 
+/*
+    Set_filter:
+        1. Attach a Bloom filter with bits_per_key bits per member to a
+        chained set, or detach it if bits_per_key is 0.
+        2. Set_has, Set_put and Set_remove consult the filter before walking
+        a bucket, so most probes for non-members touch one cache line and
+        call no cmp(). 10 bits per key let about 1% of them through.
+        3. Set_put keeps the filter up to date. It is rebuilt when the set
+        outgrows it, and when removed members outnumber the live ones.
+        4. Sets made by Set_union, Set_inter, Set_minus and Set_diff don't
+        inherit the filter.
+*/
+extern void Set_filter(struct set_t *set, int bits_per_key);
+
 // Basic Operation
 /*
     Set_has:
@@ -66,6 +123,13 @@ extern int Set_has(struct set_t *set, const void *member);
 */
 extern void Set_put(struct set_t *set, const void *member);
 
+/*
+    Set_try_put:
+        1. Same as Set_put, but return 0, or -1 if there is no memory for
+        the member, the set being left unchanged.
+*/
+extern int Set_try_put(struct set_t *set, const void *member);
+
 /*
     Set_remove:
         1. Remove the member from the set and return it. If not in, return NULL.
@@ -83,7 +147,8 @@ extern void Set_map(struct set_t *set,
 /*
     Set_to_array:
         1. Return a pointer to an N+1-element array that holds the
-        N elements of set in an arbitrary order.
+        N elements of set in an arbitrary order, or in ascending order for
+        a dense set (see Set_create_dense 4).
         2. Other features are like List_to_array() 2&3&4.
 */
 extern void **Set_to_array(struct set_t *set, void *end);
@@ -0,0 +1,83 @@
+/*
+    A set expression records a tree of set operations over existing sets
+    without computing them. Evaluating it streams the members of the few
+    operands that can contribute to the result, the drivers, and keeps
+    those passing a membership probe of the whole tree, so no
+    intermediate set is ever built. For example,
+
+        Setexpr_inter(Setexpr_union(Setexpr_set(a), Setexpr_set(b)),
+                      Setexpr_minus(Setexpr_set(c), Setexpr_set(d)))
+
+    is driven by c alone if c is smaller than a and b together, and each
+    member of c is then tested against d, a and b.
+*/
+
+#ifndef SETEXPR_INCLUDE
+#define SETEXPR_INCLUDE
+
+struct set_t;  // definition in set.h
+
+// operators of set expressions
+enum {
+    SETEXPR_SET,
+    SETEXPR_UNION,
+    SETEXPR_INTER,
+    SETEXPR_MINUS,
+    SETEXPR_DIFF,
+};
+
+struct setexpr_t {
+    int op;
+    struct set_t *set;  // operand of SETEXPR_SET
+    struct setexpr_t *lhs, *rhs;
+};
+
+/*
+    Setexpr_set:
+        1. Return the expression standing for set.
+        2. set must outlive the expression, and must not be changed while
+        the expression is evaluated.
+*/
+extern struct setexpr_t *Setexpr_set(struct set_t *set);
+
+/*
+    Setexpr_union & Setexpr_inter & Setexpr_minus & Setexpr_diff:
+        1. Return the expression lhs + rhs, lhs * rhs, lhs - rhs and
+        lhs ^ rhs. The new expression owns lhs and rhs.
+        2. As for Set_union and the like, all the sets of an expression
+        must share their cmp() and hash().
+*/
+extern struct setexpr_t *Setexpr_union(struct setexpr_t *lhs, struct setexpr_t *rhs);
+extern struct setexpr_t *Setexpr_inter(struct setexpr_t *lhs, struct setexpr_t *rhs);
+extern struct setexpr_t *Setexpr_minus(struct setexpr_t *lhs, struct setexpr_t *rhs);
+extern struct setexpr_t *Setexpr_diff(struct setexpr_t *lhs, struct setexpr_t *rhs);
+
+/*
+    Setexpr_free:
+        1. Free the expression tree and set it to NULL. The sets are not
+        freed.
+*/
+extern void Setexpr_free(struct setexpr_t **expr);
+
+/*
+    Setexpr_has:
+        1. Return 1, if member belongs to the value of expr. Otherwise,
+        return 0. It costs at most one Set_has per operand.
+*/
+extern int Setexpr_has(struct setexpr_t *expr, const void *member);
+
+/*
+    Setexpr_eval:
+        1. Return a new set holding the value of expr, of the same kind
+        (chained or dense) as its operands.
+*/
+extern struct set_t *Setexpr_eval(struct setexpr_t *expr);
+
+/*
+    Setexpr_count:
+        1. Return the number of members of the value of expr, without
+        building it.
+*/
+extern int Setexpr_count(struct setexpr_t *expr);
+
+#endif
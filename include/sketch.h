@@ -0,0 +1,108 @@
+/*
+    Sketches summarize a stream of keys in a fixed amount of memory,
+    trading exact answers for estimates with known error bounds.
+
+    A HyperLogLog estimates the number of distinct keys in the stream.
+    With 2^p registers of one byte, the relative standard error is
+    about 1.04 / sqrt(2^p), 0.8% for p = 14.
+
+    A Count-Min sketch estimates how many times each key occurred. The
+    estimate never undercounts, and with width w it overcounts by at most
+    e * n / w (n is the total count) with probability 1 - exp(-depth).
+
+    Both take the same hash() functions as Set_create and Table_create,
+    and two sketches with the same shape and hash() can be merged into
+    the sketch of the concatenated streams.
+*/
+
+#ifndef SKETCH_INCLUDE
+#define SKETCH_INCLUDE
+
+typedef unsigned long (*hash_t)(const void *);
+
+struct hll_t {
+    int precision;  // p, the sketch has 2^p registers
+    long m;         // number of registers
+    hash_t hash;
+    unsigned char *registers;
+};
+
+struct cms_t {
+    int width;  // counters per row
+    int depth;  // number of rows
+    hash_t hash;
+    unsigned long long total;  // sum of all counts added
+    unsigned long long *counters;
+};
+
+/*
+    Hll_new:
+        1. Create an empty HyperLogLog with 2^precision registers.
+        2. 4 <= precision <= 18
+        3. If hash is NULL, Atom_hash() is used as for tables.
+*/
+extern struct hll_t *Hll_new(int precision, hash_t hash);
+
+/*
+    Hll_free:
+        1. Free the sketch and set it to NULL.
+*/
+extern void Hll_free(struct hll_t **hll);
+
+/*
+    Hll_add:
+        1. Add key to the stream summarized by hll.
+*/
+extern void Hll_add(struct hll_t *hll, const void *key);
+
+/*
+    Hll_count:
+        1. Return the estimated number of distinct keys added to hll.
+*/
+extern double Hll_count(struct hll_t *hll);
+
+/*
+    Hll_merge:
+        1. Merge src into dst, so that dst summarizes both streams.
+        2. It is a checked runtime error for them to differ in precision
+        or hash().
+*/
+extern void Hll_merge(struct hll_t *dst, struct hll_t *src);
+
+/*
+    Cms_new:
+        1. Create an empty Count-Min sketch of depth rows of width counters.
+        2. width > 0, 0 < depth <= 16
+        3. If hash is NULL, Atom_hash() is used as for tables.
+*/
+extern struct cms_t *Cms_new(int width, int depth, hash_t hash);
+
+/*
+    Cms_free:
+        1. Free the sketch and set it to NULL.
+*/
+extern void Cms_free(struct cms_t **cms);
+
+/*
+    Cms_add:
+        1. Add count occurrences of key to cms.
+        2. count >= 0
+*/
+extern void Cms_add(struct cms_t *cms, const void *key, long count);
+
+/*
+    Cms_estimate:
+        1. Return the estimated number of occurrences of key, which is
+        never less than the true number.
+*/
+extern unsigned long long Cms_estimate(struct cms_t *cms, const void *key);
+
+/*
+    Cms_merge:
+        1. Merge src into dst, so that dst summarizes both streams.
+        2. It is a checked runtime error for them to differ in width,
+        depth or hash().
+*/
+extern void Cms_merge(struct cms_t *dst, struct cms_t *src);
+
+#endif
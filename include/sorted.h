@@ -0,0 +1,59 @@
+/*
+    A sorted set is a read-only set of ints kept in one ascending array.
+    It is smaller than a chained set_t, tests membership by binary search,
+    and its operations are merges over contiguous memory, which suits
+    sets that are built once and then intersected many times.
+*/
+
+#ifndef SORTED_INCLUDE
+#define SORTED_INCLUDE
+
+struct set_t;  // definition in set.h
+
+struct sorted_t {
+    int size;
+    int *values;  // ascending, without duplicates
+};
+
+/*
+    Sorted_new:
+        1. Create a sorted set holding the n ints of values, which needn't
+        be sorted nor distinct.
+        2. n >= 0, values may be NULL if n == 0.
+*/
+extern struct sorted_t *Sorted_new(const int *values, int n);
+
+/*
+    Sorted_freeze:
+        1. Create a sorted set holding the members of set.
+        2. The members of set must be pointers to int, as in a dense set
+        or a set created with an int cmp() and hash().
+        3. set is left unchanged.
+*/
+extern struct sorted_t *Sorted_freeze(struct set_t *set);
+
+/*
+    Sorted_free:
+        1. Free the sorted set and set it to NULL.
+*/
+extern void Sorted_free(struct sorted_t **s);
+
+/*
+    Sorted_has:
+        1. Return 1, if x is a member of s. Otherwise, return 0.
+*/
+extern int Sorted_has(struct sorted_t *s, int x);
+
+/*
+    Sorted_union & Sorted_inter & Sorted_minus & Sorted_diff:
+        1. Return a new sorted set holding s + t, s * t, s - t and s ^ t.
+        2. Sorted_inter gallops through the larger operand when the sizes
+        are far apart, and otherwise compares blocks of four members at
+        once with SSE2 when available.
+*/
+extern struct sorted_t *Sorted_union(struct sorted_t *s, struct sorted_t *t);
+extern struct sorted_t *Sorted_inter(struct sorted_t *s, struct sorted_t *t);
+extern struct sorted_t *Sorted_minus(struct sorted_t *s, struct sorted_t *t);
+extern struct sorted_t *Sorted_diff(struct sorted_t *s, struct sorted_t *t);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef STACK_INCLUDED
 #define STACK_INCLUDED
 
+struct arena_t;  // definition in arena.h
+
 struct elem {
     void *x;
     struct elem *link;
@@ -9,9 +11,21 @@ struct elem {
 struct stack_t {
     int count;
     struct elem *head;
+    struct arena_t *arena;  // storage of the stack and its elements, NULL for the heap
+    struct elem *spare;     // popped elements of a stack in an arena
 };
 
 extern struct stack_t *Stack_new(void);
+
+/*
+    Stack_new_in:
+        1. Create a stack as Stack_new does, but allocate the stack and all
+        its elements in arena.
+        2. The storage is reclaimed by Arena_free or Arena_dispose of arena,
+        so Stack_pop and Stack_free free nothing. Popped elements are
+        reused by later pushes.
+*/
+extern struct stack_t *Stack_new_in(struct arena_t *arena);
 extern int Stack_empty(const struct stack_t *stk);
 extern void Stack_push(struct stack_t *stk, void *x);
 extern void *Stack_pop(struct stack_t *stk);
@@ -9,6 +9,9 @@
 typedef int (*cmp_t)(const void *, const void *);
 typedef unsigned long (*hash_t)(const void *);
 
+struct arena_t;  // definition in arena.h
+struct bloom_t;  // definition in bloom.h
+
 struct binding {
     struct binding *link;
     const void *key;
@@ -26,6 +29,10 @@ struct table_t {
     hash_t hash;
     // flexible array members
     struct binding **buckets;
+    // Bloom filter in front of buckets, see Table_filter()
+    struct bloom_t *filter;
+    // storage of the table and its bindings, NULL for the heap
+    struct arena_t *arena;
 };
 
 /*
@@ -45,6 +52,15 @@ struct table_t {
 */
 extern struct table_t *Table_create(int hint,cmp_t cmp,hash_t hash);
 
+/*
+    Table_create_in:
+        1. Create a table as Table_create does, but allocate the table and
+        all its bindings in arena.
+        2. The storage is reclaimed by Arena_free or Arena_dispose of arena,
+        so Table_free and Table_remove free nothing but the filter.
+*/
+extern struct table_t *Table_create_in(struct arena_t *arena, int hint, cmp_t cmp, hash_t hash);
+
 /*
     Table_free:
         1. Free the table itself and set it to NULL.
@@ -52,6 +68,18 @@ extern struct table_t *Table_create(int hint,cmp_t cmp,hash_t hash);
 */
 extern void Table_free(struct table_t **table);
 
+/*
+    Table_filter:
+        1. Attach a Bloom filter with bits_per_key bits per key to table,
+        or detach it if bits_per_key is 0.
+        2. Table_get, Table_put and Table_remove consult the filter before
+        walking a bucket, so most lookups of missing keys touch one cache
+        line and call no cmp(). 10 bits per key let about 1% of them through.
+        3. Table_put keeps the filter up to date. It is rebuilt when the
+        table outgrows it, and when removed keys outnumber the live ones.
+*/
+extern void Table_filter(struct table_t *table, int bits_per_key);
+
 /*
     Basic operations for table.
 */
@@ -63,6 +91,14 @@ extern void Table_free(struct table_t **table);
 */
 extern void *Table_put(struct table_t *table, const void *key, void *value);
 
+/*
+    Table_try_put:
+        1. Same as Table_put, but store the previous value in *prev unless
+        prev is NULL, and return 0, or -1 if there is no memory for a new
+        binding, the table being left unchanged.
+*/
+extern int Table_try_put(struct table_t *table, const void *key, void *value, void **prev);
+
 /*
     Table_get:
         1. If key exists, return the value. If not, return NULL. But if the value
@@ -77,6 +113,14 @@ extern void *Table_get(struct table_t *table, const void *key);
 */
 extern void *Table_remove(struct table_t *table, const void *key);
 
+/*
+    Table_clear:
+        1. Remove all the key-value pairs of table, keeping its buckets.
+        2. A table in an arena frees no binding, it only clears its
+        buckets, whatever the number of bindings.
+*/
+extern void Table_clear(struct table_t *table);
+
 /*
     Table_map:
         1. Call the function apply for every key-value pair in an unspecified order.
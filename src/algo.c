@@ -15,4 +15,15 @@ void swap(void *lhs, void *rhs, long size) {
     char *l, *r;
     for (l = (char *)lhs, r = (char *)rhs; size > 0; size--)
         swap_char(l++, r++);
+}
+
+unsigned long long mix_hash(unsigned long h) {
+    unsigned long long x = h;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
 }
\ No newline at end of file
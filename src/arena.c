@@ -1,30 +1,260 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define _DEFAULT_SOURCE  // MAP_ANONYMOUS & madvise() with -std=c99
+#define ARENA_MMAP 1
+#else
+#define ARENA_MMAP 0
+#endif
+
 #include "arena.h"
 
 #include <stdlib.h>  // malloc() & free()
 #include <string.h>  // memset()
 
+#if ARENA_MMAP
+#include <sys/mman.h>  // mmap() & mprotect() & madvise() & munmap()
+#include <unistd.h>    // sysconf()
+#endif
+
 #include "align.h"
 #include "assert.h"
 #include "except.h"
 #include "mem.h"
 
-// extra size for new chunk
-#define NEW_CHUNK_EXTRA_SIZE 10240
+// size of the first chunk of an arena, each new chunk doubles it
+// up to ARENA_MAX_CHUNK
+#define ARENA_MIN_CHUNK 8192
+#define ARENA_MAX_CHUNK (1L << 20)
+
+// blocks larger than a fraction of the chunk size get a chunk of their own
+#define ARENA_LARGE(arena) ((arena)->chunk_size / 4)
+
+// mapped arenas commit their range by steps of ARENA_COMMIT_STEP,
+// the size of a huge page on x86-64, and align it on that boundary
+#define ARENA_COMMIT_STEP (2L << 20)
+
+// default bound on the number of chunks in the free chunk list
+#define ARENA_CACHE_LIMIT 10
+
+#if defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+// counters shared by all threads are only read for statistics, so they
+// need no ordering
+#if defined(__GNUC__)
+#define ATOMIC_ADD(x, n) __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#else
+#define ATOMIC_ADD(x, n) ((x) += (n))
+#define ATOMIC_LOAD(x) (x)
+#endif
 
-// threshold for free chunk list
-#define THRESHOLD 10
+// chunk header, followed by the memory handed out by the arena
+struct arena_chunk {
+    struct arena_chunk* prev;  // previous chunk of the same list
+    char* limit;               // end of the chunk
+    char* avail;               // first free byte, once the chunk is retired
+};
 
-// Make sure that arena->avail is set to a properly
-// aligned address for the first allocation in this
-// new chunk.
+// Make sure that the first block of a chunk is set to a properly
+// aligned address.
 union header {
-    struct arena* b;
+    struct arena_chunk c;
     union align a;
 };
 
-// free chunk list
-static struct arena_t* free_chunk_list = NULL;
-static int nfree = 0;
+#define CHUNK_BEGIN(chunk) ((char*)((union header*)(chunk) + 1))
+
+// header of the range of a mapped arena, in the first page of the range
+struct arena_map {
+    char* begin;   // first byte handed out by the arena
+    char* commit;  // end of the committed part
+    char* end;     // end of the range
+    long length;   // length of the mapping, from the header on
+    char* avail;   // first free byte, once the arena moved on to chunks
+};
+
+// free chunk list, one per thread so that arenas on different threads
+// never contend for it
+static THREAD_LOCAL struct arena_chunk* free_chunk_list = NULL;
+static THREAD_LOCAL int nfree = 0;
+static THREAD_LOCAL int cache_limit = ARENA_CACHE_LIMIT;
+static THREAD_LOCAL long cache_hits = 0;
+static THREAD_LOCAL long cache_misses = 0;
+static THREAD_LOCAL long cache_bytes = 0;
+
+// the chunk caches of all threads
+static long global_nchunks = 0;
+static long global_bytes = 0;
+static long global_hits = 0;
+static long global_misses = 0;
+
+#define CHUNK_SIZE(chunk) ((chunk)->limit - (char*)(chunk))
+
+/*
+    cache_take:
+        1. Unlink and return the first chunk of the free chunk list with
+        room for nbytes, or NULL if there is none.
+*/
+static struct arena_chunk* cache_take(long nbytes) {
+    struct arena_chunk **pp, *chunk;
+
+    for (pp = &free_chunk_list; *pp != NULL; pp = &(*pp)->prev) {
+        chunk = *pp;
+        if (nbytes <= chunk->limit - CHUNK_BEGIN(chunk)) {
+            *pp = chunk->prev;
+            nfree--;
+            cache_hits++;
+            cache_bytes -= CHUNK_SIZE(chunk);
+            ATOMIC_ADD(global_nchunks, -1);
+            ATOMIC_ADD(global_bytes, -CHUNK_SIZE(chunk));
+            ATOMIC_ADD(global_hits, 1);
+            return chunk;
+        }
+    }
+    cache_misses++;
+    ATOMIC_ADD(global_misses, 1);
+    return NULL;
+}
+
+/*
+    cache_put:
+        1. Push chunk on the free chunk list, or free it if the list is full.
+*/
+static void cache_put(struct arena_chunk* chunk) {
+    if (nfree < cache_limit) {
+        chunk->prev = free_chunk_list;
+        free_chunk_list = chunk;
+        nfree++;
+        cache_bytes += CHUNK_SIZE(chunk);
+        ATOMIC_ADD(global_nchunks, 1);
+        ATOMIC_ADD(global_bytes, CHUNK_SIZE(chunk));
+    } else
+        free(chunk);
+}
+
+/*
+    cache_trim:
+        1. Free the chunks of the free chunk list beyond limit.
+*/
+static void cache_trim(int limit) {
+    struct arena_chunk* chunk;
+
+    while (nfree > limit) {
+        chunk = free_chunk_list;
+        free_chunk_list = chunk->prev;
+        nfree--;
+        cache_bytes -= CHUNK_SIZE(chunk);
+        ATOMIC_ADD(global_nchunks, -1);
+        ATOMIC_ADD(global_bytes, -CHUNK_SIZE(chunk));
+        free(chunk);
+    }
+}
+
+/*
+    chunk_new:
+        1. Return a chunk with room for at least nbytes, or NULL if there
+        is no memory.
+*/
+static struct arena_chunk* chunk_new(long nbytes) {
+    struct arena_chunk* chunk;
+    long m;
+
+    m = sizeof(union header) + nbytes;
+    if ((chunk = malloc(m)) == NULL) return NULL;
+    chunk->limit = (char*)chunk + m;
+    return chunk;
+}
+
+#if ARENA_MMAP
+/*
+    map_new:
+        1. Reserve a range of nbytes, aligned on ARENA_COMMIT_STEP, with
+        nothing committed but the page of its header. Return NULL if there
+        is no address space left.
+*/
+static struct arena_map* map_new(long nbytes) {
+    struct arena_map* map;
+    long page, length;
+    char *p, *base;
+
+    page = sysconf(_SC_PAGESIZE);
+    length = ROUND_UP(page + nbytes, ARENA_COMMIT_STEP);
+
+    // over-reserve to cut an aligned range out of the mapping
+    p = mmap(NULL, length + ARENA_COMMIT_STEP, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    base = (char*)(ROUND_UP((unsigned long)p, ARENA_COMMIT_STEP));
+    if (base > p) munmap(p, base - p);
+    munmap(base + length, p + ARENA_COMMIT_STEP - base);
+
+    if (mprotect(base, page, PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, length);
+        return NULL;
+    }
+#if defined(MADV_HUGEPAGE)
+    madvise(base, length, MADV_HUGEPAGE);  // only a hint
+#endif
+    map = (struct arena_map*)base;
+    map->begin = map->commit = base + page;
+    map->end = base + length;
+    map->length = length;
+    return map;
+}
+
+/*
+    map_commit:
+        1. Commit the range of map up to at least end, and return 1. Return
+        0 if end is beyond the range or the system refuses.
+*/
+static int map_commit(struct arena_map* map, char* end) {
+    char* commit;
+
+    if (end > map->end) return 0;
+    // steps are aligned on the range, so that they can be huge pages
+    commit = (char*)map + ROUND_UP(end - (char*)map, ARENA_COMMIT_STEP);
+    if (commit > map->end) commit = map->end;
+    if (mprotect(map->commit, commit - map->commit, PROT_READ | PROT_WRITE) != 0)
+        return 0;
+    map->commit = commit;
+    return 1;
+}
+#endif
+
+/*
+    current_used:
+        1. Return the number of bytes allocated in the current chunk of
+        arena, or in its range for a mapped arena that has no chunk yet.
+*/
+static long current_used(struct arena_t* arena) {
+    if (arena->chunk != NULL) return arena->avail - CHUNK_BEGIN(arena->chunk);
+    if (arena->map != NULL) return arena->avail - arena->map->begin;
+    return 0;
+}
+
+/*
+    update_peak:
+        1. Fold the bytes allocated in arena into its high-water mark. The
+        fast path doesn't count, so this is done before the arena gives
+        back any memory, and when statistics are read.
+*/
+static void update_peak(struct arena_t* arena) {
+    long allocated = arena->used + current_used(arena);
+
+    if (allocated > arena->peak) arena->peak = allocated;
+}
+
+/*
+    extend:
+        1. Widen the bounds of arena to cover [lo, hi).
+*/
+static void extend(struct arena_t* arena, char* lo, char* hi) {
+    if (arena->lo == NULL || lo < arena->lo) arena->lo = lo;
+    if (hi > arena->hi) arena->hi = hi;
+}
 
 const struct except_t arena_new_failed = {
     "Arena Creation Failed"};
@@ -39,66 +269,115 @@ struct arena_t* Arena_new(void) {
 
     if (arena == NULL) RAISE(arena_new_failed);
 
-    arena->prev = NULL;
     arena->avail = arena->limit = NULL;
+    arena->chunk = arena->large = NULL;
+    arena->chunk_size = ARENA_MIN_CHUNK;
+    arena->map = NULL;
+    arena->used = arena->peak = 0;
+    arena->lo = arena->hi = NULL;
+
+    return arena;
+}
+
+struct arena_t* Arena_new_mapped(long nbytes) {
+    struct arena_t* arena;
 
+    assert(nbytes > 0);
+
+#if ARENA_MMAP
+    struct arena_map* map = map_new(nbytes);
+
+    if (map == NULL) RAISE(arena_new_failed);
+    arena = Arena_new();
+    arena->map = map;
+    arena->avail = map->begin;
+    arena->limit = map->commit;
+    extend(arena, map->begin, map->commit);
+#else
+    arena = Arena_new();
+#endif
     return arena;
 }
 
 void Arena_dispose(struct arena_t** ap) {
     assert(ap && *ap);
     Arena_free(*ap);
+#if ARENA_MMAP
+    if ((*ap)->map != NULL) munmap((*ap)->map, (*ap)->map->length);
+#endif
     free(*ap);
     *ap = NULL;
 }
 
-void* Arena_alloc(struct arena_t* arena, long nbytes,
-                  const char* file, int line) {
+void* Arena_alloc_slow(struct arena_t* arena, long nbytes,
+                       const char* file, int line) {
+    void* ptr;
+
+    if ((ptr = Arena_try_alloc_slow(arena, nbytes)) == NULL) {
+        if (file == NULL)
+            RAISE(arena_failed);
+        else
+            Except_raise(&arena_failed, file, line);
+    }
+    return ptr;
+}
+
+void* Arena_try_alloc_slow(struct arena_t* arena, long nbytes) {
+    struct arena_chunk* chunk;
+
     assert(arena != NULL);
     assert(nbytes > 0);
 
     nbytes = ROUND_UP_TO_ALIGN_BOUND(nbytes);
 
-    // If there is enough space in some other chunk further down the list.
-    while (arena->prev != NULL) {
-        if (nbytes > (arena->limit - arena->avail))
-            arena = arena->prev;
-        else
-            break;
+    if (nbytes <= arena->limit - arena->avail) {
+        arena->avail += nbytes;
+        return arena->avail - nbytes;
     }
 
-    // original version
-
-    while (nbytes > (arena->limit - arena->avail)) {
-        // get a new chunk
-        struct arena_t* new_arena;
-        char* limit;
-
-        new_arena = free_chunk_list;
-        if (new_arena != NULL) {
-            free_chunk_list = free_chunk_list->prev;
-            nfree--;
-            limit = new_arena->limit;
-        } else {
-            long m = sizeof(union header) + nbytes + NEW_CHUNK_EXTRA_SIZE;
-            new_arena = malloc(m);
-            if (new_arena == NULL) {
-                if (file == NULL)
-                    RAISE(arena_failed);
-                else
-                    Except_raise(&arena_failed, file, line);
-            }
-            limit = (char*)new_arena + m;
-        }
+#if ARENA_MMAP
+    // a mapped arena carves any block from its range while it lasts
+    if (arena->map != NULL && arena->chunk == NULL &&
+        map_commit(arena->map, arena->avail + nbytes)) {
+        arena->limit = arena->map->commit;
+        extend(arena, arena->map->begin, arena->map->commit);
+        arena->avail += nbytes;
+        update_peak(arena);
+        return arena->avail - nbytes;
+    }
+#endif
 
-        *new_arena = *arena;
-        arena->avail = (char*)((union header*)new_arena + 1);
-        arena->limit = limit;
-        arena->prev = new_arena;
+    // an oversized block gets a dedicated chunk, leaving the space left
+    // in the current chunk for the blocks to come
+    if (nbytes > ARENA_LARGE(arena)) {
+        if ((chunk = chunk_new(nbytes)) == NULL) return NULL;
+        chunk->prev = arena->large;
+        arena->large = chunk;
+        extend(arena, CHUNK_BEGIN(chunk), chunk->limit);
+        arena->used += nbytes;
+        update_peak(arena);
+        return CHUNK_BEGIN(chunk);
     }
 
-    arena->avail += nbytes;
-    return (arena->avail - nbytes);
+    // start a new chunk, and retire the current one once it is there
+    chunk = cache_take(nbytes);
+    if (chunk == NULL) {
+        if ((chunk = chunk_new(arena->chunk_size - sizeof(union header))) == NULL)
+            return NULL;
+        if (arena->chunk_size < ARENA_MAX_CHUNK) arena->chunk_size *= 2;
+    }
+    arena->used += current_used(arena);
+    if (arena->chunk != NULL)
+        arena->chunk->avail = arena->avail;
+    else if (arena->map != NULL)
+        arena->map->avail = arena->avail;
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+    arena->avail = CHUNK_BEGIN(chunk) + nbytes;
+    arena->limit = chunk->limit;
+    extend(arena, CHUNK_BEGIN(chunk), chunk->limit);
+    update_peak(arena);
+    return arena->avail - nbytes;
 }
 
 void* Arena_calloc(struct arena_t* arena, long count, long nbytes, const char* file, int line) {
@@ -113,18 +392,160 @@ void* Arena_calloc(struct arena_t* arena, long count, long nbytes, const char* f
 }
 
 void Arena_free(struct arena_t* arena) {
+    struct arena_chunk* chunk;
+
+    assert(arena != NULL);
+
+    update_peak(arena);
+    arena->used = 0;
+    while ((chunk = arena->chunk) != NULL) {
+        arena->chunk = chunk->prev;
+        cache_put(chunk);
+    }
+    // dedicated chunks are sized for one block, keeping them would
+    // only pin memory in the cache
+    while ((chunk = arena->large) != NULL) {
+        arena->large = chunk->prev;
+        free(chunk);
+    }
+    arena->avail = arena->limit = NULL;
+    arena->lo = arena->hi = NULL;
+#if ARENA_MMAP
+    if (arena->map != NULL) {
+        struct arena_map* map = arena->map;
+        madvise(map->begin, map->commit - map->begin, MADV_DONTNEED);
+        arena->avail = map->begin;
+        arena->limit = map->commit;
+        extend(arena, map->begin, map->commit);
+    }
+#endif
+}
+
+int Arena_owns(struct arena_t* arena, const void* ptr) {
+    struct arena_chunk* chunk;
+    const char* p = ptr;
+
+    assert(arena != NULL);
+
+    if (p < arena->lo || p >= arena->hi) return 0;
+    if (arena->map != NULL && p >= arena->map->begin && p < arena->map->commit)
+        return 1;
+    for (chunk = arena->chunk; chunk != NULL; chunk = chunk->prev)
+        if (p >= CHUNK_BEGIN(chunk) && p < chunk->limit) return 1;
+    for (chunk = arena->large; chunk != NULL; chunk = chunk->prev)
+        if (p >= CHUNK_BEGIN(chunk) && p < chunk->limit) return 1;
+    return 0;
+}
+
+struct arena_mark_t Arena_mark(struct arena_t* arena) {
+    struct arena_mark_t mark;
+
+    assert(arena != NULL);
+
+    mark.chunk = arena->chunk;
+    mark.avail = arena->avail;
+    mark.large = arena->large;
+    return mark;
+}
+
+void Arena_release_to(struct arena_t* arena, struct arena_mark_t mark) {
+    struct arena_chunk* chunk;
+
+    assert(arena != NULL);
+
+    update_peak(arena);
+    if (arena->chunk != mark.chunk) {
+        // the current chunk is not counted in used, the retired ones are
+        chunk = arena->chunk;
+        assert(chunk != NULL);  // mark is not in the arena
+        arena->chunk = chunk->prev;
+        cache_put(chunk);
+        while ((chunk = arena->chunk) != mark.chunk) {
+            assert(chunk != NULL);
+            arena->used -= chunk->avail - CHUNK_BEGIN(chunk);
+            arena->chunk = chunk->prev;
+            cache_put(chunk);
+        }
+        // the chunk of the mark, or the range, is current again
+        if (mark.chunk != NULL)
+            arena->used -= mark.chunk->avail - CHUNK_BEGIN(mark.chunk);
+        else if (arena->map != NULL)
+            arena->used -= arena->map->avail - arena->map->begin;
+    }
+    while ((chunk = arena->large) != mark.large) {
+        assert(chunk != NULL);
+        arena->used -= chunk->limit - CHUNK_BEGIN(chunk);
+        arena->large = chunk->prev;
+        free(chunk);
+    }
+    if (mark.chunk != NULL) {
+        assert(mark.avail >= CHUNK_BEGIN(mark.chunk) && mark.avail <= mark.chunk->limit);
+        arena->limit = mark.chunk->limit;
+    } else if (arena->map != NULL) {
+        assert(mark.avail >= arena->map->begin && mark.avail <= arena->map->commit);
+        arena->limit = arena->map->commit;
+    } else
+        arena->limit = NULL;
+    arena->avail = mark.avail;
+}
+
+void Arena_stats(struct arena_t* arena, struct arena_stats_t* stats) {
+    struct arena_chunk* chunk;
+
     assert(arena != NULL);
-    while (arena->prev != NULL) {
-        struct arena_t tmp;
-
-        tmp = *(arena->prev);
-        if (nfree > THRESHOLD) {
-            arena->prev->prev = free_chunk_list;
-            free_chunk_list = arena->prev;
-            nfree++;
-            free_chunk_list->limit = arena->limit;
-        } else
-            free(arena->prev);
-        *arena = tmp;
-    }
-}
\ No newline at end of file
+    assert(stats != NULL);
+
+    update_peak(arena);
+    stats->allocated = arena->used + current_used(arena);
+    stats->peak = arena->peak;
+    stats->reserved = stats->waste = 0;
+    stats->nchunks = 0;
+    for (chunk = arena->chunk; chunk != NULL; chunk = chunk->prev) {
+        stats->reserved += CHUNK_SIZE(chunk);
+        stats->nchunks++;
+        if (chunk != arena->chunk) stats->waste += chunk->limit - chunk->avail;
+    }
+    for (chunk = arena->large; chunk != NULL; chunk = chunk->prev) {
+        stats->reserved += CHUNK_SIZE(chunk);
+        stats->nchunks++;
+    }
+    if (arena->map != NULL) {
+        stats->reserved += arena->map->commit - (char*)arena->map;
+        if (arena->chunk != NULL)
+            stats->waste += arena->map->commit - arena->map->avail;
+    }
+}
+
+int Arena_cache_limit(int nchunks) {
+    int prev = cache_limit;
+
+    assert(nchunks >= 0);
+
+    cache_limit = nchunks;
+    cache_trim(nchunks);
+    return prev;
+}
+
+void Arena_cache_flush(void) {
+    cache_trim(0);
+}
+
+void Arena_cache_stats(struct arena_cache_stats_t* stats) {
+    assert(stats != NULL);
+
+    stats->nchunks = nfree;
+    stats->bytes = cache_bytes;
+    stats->limit = cache_limit;
+    stats->hits = cache_hits;
+    stats->misses = cache_misses;
+}
+
+void Arena_cache_stats_global(struct arena_cache_stats_t* stats) {
+    assert(stats != NULL);
+
+    stats->nchunks = ATOMIC_LOAD(global_nchunks);
+    stats->bytes = ATOMIC_LOAD(global_bytes);
+    stats->limit = cache_limit;
+    stats->hits = ATOMIC_LOAD(global_hits);
+    stats->misses = ATOMIC_LOAD(global_misses);
+}
@@ -5,7 +5,9 @@
 #include <string.h>  // strcmp() & strlen() & memset()
 
 #include "assert.h"
+#include "except.h"
 #include "mem.h"
+#include "memhook.h"
 
 // 2^128 = 340 282 366 920 938 463 463 374 607 431 768 211 456
 // for 128-bits
@@ -86,7 +88,7 @@ int Atom_length(const char *str) {
 
 const char *Atom_new(const char *str, int len) {
     unsigned long h;
-    int i;
+    int i, narenas;
     struct atom *p;
 
     assert(str != NULL);
@@ -112,8 +114,14 @@ const char *Atom_new(const char *str, int len) {
     size++;
     assert(size < capacity);
 
-    // not exist, allocate a new entry
-    p = ALLOC(sizeof(*p) + len + 1);
+    // not exist, allocate a new entry; atoms live as long as the program,
+    // so they never go to an arena pushed by Mem_push_arena. Nothing may
+    // raise while the stack is hidden, or it would stay hidden.
+    narenas = memhook_narenas;
+    memhook_narenas = 0;
+    p = Mem_try_alloc(sizeof(*p) + len + 1, __FILE__, __LINE__);
+    memhook_narenas = narenas;
+    if (p == NULL) RAISE(mem_failed);
     p->len = len;
     // p->str = (char *)(p + 1);  // for non-flexible array member
     if (len > 0) memcpy(p->str, str, len);
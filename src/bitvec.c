@@ -0,0 +1,108 @@
+#include "bitvec.h"
+
+#include "assert.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // __m128i & _mm_*_si128()
+
+// number of words in a 128-bit vector register
+#define VEC_WORDS ((long)(sizeof(__m128i) / sizeof(unsigned long)))
+
+#define VEC_LOOP(dst, a, b, nwords, vop)                                \
+    for (; i + VEC_WORDS <= (nwords); i += VEC_WORDS) {                 \
+        __m128i x = _mm_loadu_si128((const __m128i *)((a) + i));        \
+        __m128i y = _mm_loadu_si128((const __m128i *)((b) + i));        \
+        _mm_storeu_si128((__m128i *)((dst) + i), vop);                  \
+    }
+#else
+#define VEC_LOOP(dst, a, b, nwords, vop)
+#endif
+
+void Bitvec_and(unsigned long *dst, const unsigned long *a,
+                const unsigned long *b, long nwords) {
+    long i = 0;
+
+    assert(nwords >= 0);
+    VEC_LOOP(dst, a, b, nwords, _mm_and_si128(x, y));
+    for (; i < nwords; i++) dst[i] = a[i] & b[i];
+}
+
+void Bitvec_or(unsigned long *dst, const unsigned long *a,
+               const unsigned long *b, long nwords) {
+    long i = 0;
+
+    assert(nwords >= 0);
+    VEC_LOOP(dst, a, b, nwords, _mm_or_si128(x, y));
+    for (; i < nwords; i++) dst[i] = a[i] | b[i];
+}
+
+void Bitvec_andnot(unsigned long *dst, const unsigned long *a,
+                   const unsigned long *b, long nwords) {
+    long i = 0;
+
+    assert(nwords >= 0);
+    // _mm_andnot_si128(y, x) computes ~y & x
+    VEC_LOOP(dst, a, b, nwords, _mm_andnot_si128(y, x));
+    for (; i < nwords; i++) dst[i] = a[i] & ~b[i];
+}
+
+void Bitvec_xor(unsigned long *dst, const unsigned long *a,
+                const unsigned long *b, long nwords) {
+    long i = 0;
+
+    assert(nwords >= 0);
+    VEC_LOOP(dst, a, b, nwords, _mm_xor_si128(x, y));
+    for (; i < nwords; i++) dst[i] = a[i] ^ b[i];
+}
+
+/*
+    popcount:
+        1. Number of set bits in a word.
+        2. Falls back to the SWAR reduction when the compiler has no builtin.
+*/
+static inline int popcount(unsigned long w) {
+#if defined(__GNUC__)
+    return __builtin_popcountl(w);
+#else
+    // pairs, then nibbles, then the bytes summed by one multiply
+    const unsigned long m1 = ~0UL / 3, m2 = ~0UL / 5, m4 = ~0UL / 17;
+
+    w -= (w >> 1) & m1;
+    w = (w & m2) + ((w >> 2) & m2);
+    w = (w + (w >> 4)) & m4;
+    return (int)((w * (~0UL / 255)) >> (sizeof(w) - 1) * 8);
+#endif
+}
+
+static inline int lowest_bit(unsigned long w) {
+#if defined(__GNUC__)
+    return __builtin_ctzl(w);
+#else
+    int n;
+    for (n = 0; (w & 1UL) == 0; n++) w >>= 1;
+    return n;
+#endif
+}
+
+long Bitvec_count(const unsigned long *a, long nwords) {
+    long i, n;
+
+    assert(nwords >= 0);
+    for (i = 0, n = 0; i < nwords; i++) n += popcount(a[i]);
+    return n;
+}
+
+long Bitvec_next(const unsigned long *a, long nwords, long i) {
+    long k;
+    unsigned long w;
+
+    assert(i >= 0);
+    k = i / BITVEC_WORD_BITS;
+    if (k >= nwords) return -1;
+    w = a[k] & (~0UL << (i % BITVEC_WORD_BITS));
+    while (w == 0) {
+        if (++k >= nwords) return -1;
+        w = a[k];
+    }
+    return k * BITVEC_WORD_BITS + lowest_bit(w);
+}
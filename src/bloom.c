@@ -0,0 +1,120 @@
+#include "bloom.h"
+
+#include <string.h>  // memset()
+
+#include "algo.h"
+#include "assert.h"
+#include "bitvec.h"
+#include "mem.h"
+
+// bits and words of a block, a cache line
+#define BLOCK_BITS 512
+#define BLOCK_WORDS (BLOCK_BITS / BITVEC_WORD_BITS)
+#define CACHE_LINE 64
+
+// bounds on the bits set per key
+#define MIN_K 1
+#define MAX_K 16
+
+/*
+    bloom_init:
+        1. Size bloom for nkeys keys of bits_per_key bits, and return the
+        bytes of its block.
+*/
+static long bloom_init(struct bloom_t *bloom, long nkeys, int bits_per_key) {
+    long nbits;
+
+    nbits = (nkeys > 0 ? nkeys : 1) * (long)bits_per_key;
+    bloom->nblocks = (nbits + BLOCK_BITS - 1) / BLOCK_BITS;
+    bloom->capacity = nkeys;
+    bloom->nremoved = 0;
+    bloom->bits_per_key = bits_per_key;
+    // k = bits_per_key * ln(2) minimizes the false positive rate
+    bloom->k = bits_per_key * 69 / 100;
+    if (bloom->k < MIN_K) bloom->k = MIN_K;
+    if (bloom->k > MAX_K) bloom->k = MAX_K;
+    return bloom->nblocks * BLOCK_WORDS * (long)sizeof(unsigned long) + CACHE_LINE;
+}
+
+// point words at the first cache line of block, and clear them
+static struct bloom_t *bloom_finish(struct bloom_t *bloom) {
+    bloom->words = (unsigned long *)(((unsigned long)bloom->block +
+                                      CACHE_LINE - 1) &
+                                     ~(unsigned long)(CACHE_LINE - 1));
+    Bloom_clear(bloom);
+
+    return bloom;
+}
+
+struct bloom_t *Bloom_new(long nkeys, int bits_per_key) {
+    struct bloom_t *bloom;
+
+    assert(nkeys >= 0);
+    assert(bits_per_key > 0);
+
+    NEW(bloom);
+    bloom->block = ALLOC(bloom_init(bloom, nkeys, bits_per_key));
+    return bloom_finish(bloom);
+}
+
+struct bloom_t *Bloom_try_new(long nkeys, int bits_per_key) {
+    struct bloom_t *bloom;
+
+    assert(nkeys >= 0);
+    assert(bits_per_key > 0);
+
+    if ((bloom = Mem_try_alloc(sizeof(*bloom), __FILE__, __LINE__)) == NULL) return NULL;
+    if ((bloom->block = Mem_try_alloc(bloom_init(bloom, nkeys, bits_per_key),
+                                      __FILE__, __LINE__)) == NULL) {
+        FREE(bloom);
+        return NULL;
+    }
+    return bloom_finish(bloom);
+}
+
+void Bloom_free(struct bloom_t **bloom) {
+    assert(bloom != NULL);
+    assert(*bloom != NULL);
+
+    FREE((*bloom)->block);
+    FREE(*bloom);
+}
+
+/*
+    The high half of the mixed hash picks the block, the low half seeds
+    the double hashing a + i * b which picks the bits inside the block.
+*/
+#define BLOOM_PROBE(bloom, h, stmt)                                        \
+    do {                                                                   \
+        unsigned long long x = mix_hash(h);                                \
+        unsigned long *block;                                              \
+        unsigned a, b, bit;                                                \
+        int i;                                                             \
+        block = (bloom)->words +                                           \
+                (long)((x >> 32) % (unsigned long long)(bloom)->nblocks) * \
+                    BLOCK_WORDS;                                           \
+        a = (unsigned)x;                                                   \
+        b = (a >> 16) | 1;                                                 \
+        for (i = 0; i < (bloom)->k; i++, a += b) {                         \
+            bit = a % BLOCK_BITS;                                          \
+            stmt;                                                          \
+        }                                                                  \
+    } while (0)
+
+void Bloom_add(struct bloom_t *bloom, unsigned long h) {
+    assert(bloom != NULL);
+    BLOOM_PROBE(bloom, h, BITVEC_SET(block, bit));
+}
+
+int Bloom_has(struct bloom_t *bloom, unsigned long h) {
+    assert(bloom != NULL);
+    BLOOM_PROBE(bloom, h, if (!BITVEC_GET(block, bit)) return 0);
+    return 1;
+}
+
+void Bloom_clear(struct bloom_t *bloom) {
+    assert(bloom != NULL);
+    memset(bloom->words, 0,
+           bloom->nblocks * BLOCK_WORDS * sizeof(unsigned long));
+    bloom->nremoved = 0;
+}
@@ -5,7 +5,7 @@
 
 #include "assert.h"
 
-struct except_frame *except_stack = NULL;
+EXCEPT_THREAD_LOCAL struct except_frame *except_stack = NULL;
 
 void Except_raise(const struct except_t *e, const char *file, int line) {
     struct except_frame *p = except_stack;
@@ -35,5 +35,5 @@ void Except_raise(const struct except_t *e, const char *file, int line) {
     p->file = file;
     p->line = line;
     except_stack = except_stack->prev;
-    longjmp(p->env, EXCEPT_RAISED);
+    EXCEPT_LONGJMP(p->env);
 }
\ No newline at end of file
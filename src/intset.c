@@ -0,0 +1,832 @@
+#include "intset.h"
+
+#include <string.h>  // memcpy() & memmove() & memset()
+
+#include "assert.h"
+#include "bitvec.h"
+#include "mem.h"
+
+// number of low values covered by a container
+#define CONTAINER_RANGE 65536
+
+// an array container holds at most ARRAY_MAX values,
+// beyond that a bitmap is smaller
+#define ARRAY_MAX 4096
+
+// words of a bitmap container
+#define BITMAP_WORDS (CONTAINER_RANGE / BITVEC_WORD_BITS)
+
+// serialized size of a bitmap container
+#define BITMAP_BYTES (CONTAINER_RANGE / 8)
+
+#define HIGH(x) ((unsigned short)((x) >> 16))
+#define LOW(x) ((unsigned short)((x)&0xFFFF))
+
+// magic number of the serialized format
+static const char magic[4] = {'C', 'I', 'S', '1'};
+
+// types of container
+enum {
+    ARRAY,
+    BITMAP,
+    RUN,
+};
+
+// operations between containers
+enum {
+    OP_UNION,
+    OP_INTER,
+    OP_MINUS,
+    OP_DIFF,
+};
+
+// a run holds the values in [start, start + length]
+struct run {
+    unsigned short start;
+    unsigned short length;
+};
+
+struct intset_container {
+    int type;
+    int card;      // number of members
+    int n;         // used length of values (ARRAY) or runs (RUN)
+    int capacity;  // allocated length of values or runs
+    unsigned short *values;
+    unsigned long *words;
+    struct run *runs;
+};
+
+// stands for a NULL operand of the set operations
+static struct intset_t empty_set;
+
+// Containers
+
+static struct intset_container *container_new(int type, int capacity) {
+    struct intset_container *c;
+
+    NEW(c);
+    c->type = type;
+    c->card = c->n = 0;
+    c->capacity = (capacity > 0) ? capacity : 1;
+    c->values = NULL;
+    c->words = NULL;
+    c->runs = NULL;
+    if (type == ARRAY)
+        c->values = ALLOC(c->capacity * (long)sizeof(c->values[0]));
+    else if (type == BITMAP)
+        c->words = CALLOC(BITMAP_WORDS, sizeof(c->words[0]));
+    else
+        c->runs = ALLOC(c->capacity * (long)sizeof(c->runs[0]));
+
+    return c;
+}
+
+static void container_free(struct intset_container **c) {
+    FREE((*c)->values);
+    FREE((*c)->words);
+    FREE((*c)->runs);
+    FREE(*c);
+}
+
+/*
+    lower_bound:
+        1. Return the index of the first value in values[0, n) that is
+        not less than x.
+*/
+static int lower_bound(const unsigned short *values, int n, unsigned short x) {
+    int lo = 0, hi = n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (values[mid] < x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+    run_find:
+        1. Return the index of the last run starting at or before x,
+        or -1 if there is none.
+*/
+static int run_find(const struct run *runs, int n, unsigned short x) {
+    int lo = 0, hi = n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (runs[mid].start <= x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+static int container_has(struct intset_container *c, unsigned short x) {
+    int i;
+
+    switch (c->type) {
+        case ARRAY:
+            i = lower_bound(c->values, c->n, x);
+            return i < c->n && c->values[i] == x;
+        case BITMAP:
+            return BITVEC_GET(c->words, x) != 0;
+        default:
+            i = run_find(c->runs, c->n, x);
+            return i >= 0 && x - c->runs[i].start <= c->runs[i].length;
+    }
+}
+
+/*
+    container_fill:
+        1. Set the bits of the members of c in words, which is cleared
+        by the caller.
+*/
+static void container_fill(struct intset_container *c, unsigned long *words) {
+    long i, v;
+
+    if (c->type == ARRAY) {
+        for (i = 0; i < c->n; i++) BITVEC_SET(words, c->values[i]);
+    } else if (c->type == RUN) {
+        for (i = 0; i < c->n; i++)
+            for (v = c->runs[i].start;
+                 v <= (long)c->runs[i].start + c->runs[i].length; v++)
+                BITVEC_SET(words, v);
+    } else {
+        memcpy(words, c->words, BITMAP_WORDS * sizeof(words[0]));
+    }
+}
+
+static void container_to_bitmap(struct intset_container *c) {
+    unsigned long *words;
+
+    if (c->type == BITMAP) return;
+    words = CALLOC(BITMAP_WORDS, sizeof(words[0]));
+    container_fill(c, words);
+    FREE(c->values);
+    FREE(c->runs);
+    c->words = words;
+    c->type = BITMAP;
+    c->n = c->capacity = 0;
+}
+
+static void container_to_array(struct intset_container *c) {
+    unsigned short *values;
+    long i, v;
+    int n;
+
+    assert(c->card <= ARRAY_MAX);
+    if (c->type == ARRAY) return;
+
+    values = ALLOC(((c->card > 0) ? c->card : 1) * (long)sizeof(values[0]));
+    n = 0;
+    if (c->type == BITMAP) {
+        for (v = Bitvec_next(c->words, BITMAP_WORDS, 0); v >= 0;
+             v = Bitvec_next(c->words, BITMAP_WORDS, v + 1))
+            values[n++] = (unsigned short)v;
+    } else {
+        for (i = 0; i < c->n; i++)
+            for (v = c->runs[i].start;
+                 v <= (long)c->runs[i].start + c->runs[i].length; v++)
+                values[n++] = (unsigned short)v;
+    }
+    FREE(c->words);
+    FREE(c->runs);
+    c->values = values;
+    c->type = ARRAY;
+    c->n = n;
+    c->capacity = (n > 0) ? n : 1;
+}
+
+/*
+    container_normalize:
+        1. Turn c into an array or a bitmap, whichever suits its card.
+*/
+static void container_normalize(struct intset_container *c) {
+    if (c->card <= ARRAY_MAX)
+        container_to_array(c);
+    else
+        container_to_bitmap(c);
+}
+
+static int container_put(struct intset_container *c, unsigned short x) {
+    int i;
+
+    if (c->type == RUN) container_normalize(c);
+
+    if (c->type == ARRAY) {
+        i = lower_bound(c->values, c->n, x);
+        if (i < c->n && c->values[i] == x) return 0;
+        if (c->n == ARRAY_MAX) {
+            container_to_bitmap(c);
+        } else {
+            if (c->n == c->capacity) {
+                c->capacity = (2 * c->capacity < ARRAY_MAX) ? 2 * c->capacity
+                                                            : ARRAY_MAX;
+                RESIZE(c->values, c->capacity * (long)sizeof(c->values[0]));
+            }
+            memmove(c->values + i + 1, c->values + i,
+                    (c->n - i) * sizeof(c->values[0]));
+            c->values[i] = x;
+            c->n++;
+            c->card++;
+            return 1;
+        }
+    }
+
+    if (BITVEC_GET(c->words, x)) return 0;
+    BITVEC_SET(c->words, x);
+    c->card++;
+    return 1;
+}
+
+static int container_remove(struct intset_container *c, unsigned short x) {
+    int i;
+
+    if (!container_has(c, x)) return 0;
+    if (c->type == RUN) container_normalize(c);
+
+    if (c->type == ARRAY) {
+        i = lower_bound(c->values, c->n, x);
+        memmove(c->values + i, c->values + i + 1,
+                (c->n - i - 1) * sizeof(c->values[0]));
+        c->n--;
+        c->card--;
+    } else {
+        BITVEC_CLEAR(c->words, x);
+        c->card--;
+        if (c->card <= ARRAY_MAX) container_to_array(c);
+    }
+    return 1;
+}
+
+static struct intset_container *container_copy(struct intset_container *c) {
+    struct intset_container *dup;
+
+    dup = container_new(c->type, c->n);
+    dup->card = c->card;
+    dup->n = c->n;
+    if (c->type == ARRAY)
+        memcpy(dup->values, c->values, c->n * sizeof(c->values[0]));
+    else if (c->type == BITMAP)
+        memcpy(dup->words, c->words, BITMAP_WORDS * sizeof(c->words[0]));
+    else
+        memcpy(dup->runs, c->runs, c->n * sizeof(c->runs[0]));
+
+    return dup;
+}
+
+static void container_map(struct intset_container *c, unsigned high,
+                          void (*apply)(unsigned x, void *cl), void *cl) {
+    unsigned base = high << 16;
+    long i, v;
+
+    if (c->type == ARRAY) {
+        for (i = 0; i < c->n; i++) apply(base | c->values[i], cl);
+    } else if (c->type == BITMAP) {
+        for (v = Bitvec_next(c->words, BITMAP_WORDS, 0); v >= 0;
+             v = Bitvec_next(c->words, BITMAP_WORDS, v + 1))
+            apply(base | (unsigned)v, cl);
+    } else {
+        for (i = 0; i < c->n; i++)
+            for (v = c->runs[i].start;
+                 v <= (long)c->runs[i].start + c->runs[i].length; v++)
+                apply(base | (unsigned)v, cl);
+    }
+}
+
+/*
+    container_nruns:
+        1. Count the runs of consecutive members in an array or a bitmap.
+*/
+static int container_nruns(struct intset_container *c) {
+    unsigned long w, starts, carry;
+    int i, n;
+
+    if (c->type == RUN) return c->n;
+
+    n = 0;
+    if (c->type == ARRAY) {
+        for (i = 0; i < c->n; i++)
+            if (i == 0 || c->values[i] != c->values[i - 1] + 1) n++;
+    } else {
+        // a run starts at each set bit whose lower neighbour is clear
+        for (i = 0, carry = 0; i < BITMAP_WORDS; i++) {
+            w = c->words[i];
+            starts = w & ~((w << 1) | carry);
+            n += Bitvec_count(&starts, 1);
+            carry = w >> (BITVEC_WORD_BITS - 1);
+        }
+    }
+    return n;
+}
+
+static void container_to_run(struct intset_container *c, int nruns) {
+    struct run *runs;
+    long v, end = 0;
+    int i, n;
+
+    if (c->type == RUN) return;
+
+    runs = ALLOC(((nruns > 0) ? nruns : 1) * (long)sizeof(runs[0]));
+    n = 0;
+    if (c->type == ARRAY) {
+        for (i = 0; i < c->n; i++) {
+            if (i > 0 && c->values[i] == c->values[i - 1] + 1) {
+                runs[n - 1].length++;
+            } else {
+                runs[n].start = c->values[i];
+                runs[n].length = 0;
+                n++;
+            }
+        }
+    } else {
+        for (v = Bitvec_next(c->words, BITMAP_WORDS, 0); v >= 0;
+             v = Bitvec_next(c->words, BITMAP_WORDS, end + 1)) {
+            for (end = v; end + 1 < CONTAINER_RANGE && BITVEC_GET(c->words, end + 1);)
+                end++;
+            runs[n].start = (unsigned short)v;
+            runs[n].length = (unsigned short)(end - v);
+            n++;
+        }
+    }
+    assert(n == nruns);
+    FREE(c->values);
+    FREE(c->words);
+    c->runs = runs;
+    c->type = RUN;
+    c->capacity = (n > 0) ? n : 1;
+    c->n = n;
+}
+
+/*
+    container_merge:
+        1. Combine two array containers by merging their sorted values.
+*/
+static struct intset_container *container_merge(struct intset_container *a,
+                                                struct intset_container *b,
+                                                int op) {
+    struct intset_container *res;
+    int i, j, n;
+
+    res = container_new(ARRAY, a->n + b->n);
+    for (i = 0, j = 0, n = 0; i < a->n || j < b->n;) {
+        if (j == b->n || (i < a->n && a->values[i] < b->values[j])) {
+            if (op != OP_INTER) res->values[n++] = a->values[i];
+            i++;
+        } else if (i == a->n || b->values[j] < a->values[i]) {
+            if (op == OP_UNION || op == OP_DIFF) res->values[n++] = b->values[j];
+            j++;
+        } else {
+            if (op == OP_UNION || op == OP_INTER) res->values[n++] = a->values[i];
+            i++, j++;
+        }
+    }
+    res->n = res->card = n;
+    if (n > ARRAY_MAX) container_to_bitmap(res);
+
+    return res;
+}
+
+/*
+    container_filter:
+        1. Keep the values of array container a which are (keep != 0)
+        or are not (keep == 0) members of b.
+*/
+static struct intset_container *container_filter(struct intset_container *a,
+                                                 struct intset_container *b,
+                                                 int keep) {
+    struct intset_container *res;
+    int i, n;
+
+    res = container_new(ARRAY, a->n);
+    for (i = 0, n = 0; i < a->n; i++)
+        if (container_has(b, a->values[i]) == keep)
+            res->values[n++] = a->values[i];
+    res->n = res->card = n;
+
+    return res;
+}
+
+/*
+    container_op:
+        1. Return a new container holding the result of op on a and b.
+        2. The result may be empty, which is for the caller to drop.
+*/
+static struct intset_container *container_op(struct intset_container *a,
+                                             struct intset_container *b,
+                                             int op) {
+    struct intset_container *res;
+    unsigned long *wa, *wb;
+
+    if (a->type == ARRAY && b->type == ARRAY) return container_merge(a, b, op);
+    if (op == OP_INTER && a->type == ARRAY) return container_filter(a, b, 1);
+    if (op == OP_INTER && b->type == ARRAY) return container_filter(b, a, 1);
+    if (op == OP_MINUS && a->type == ARRAY) return container_filter(a, b, 0);
+
+    // word-wide path over bitmap views of both operands
+    wa = a->words;
+    if (a->type != BITMAP) {
+        wa = CALLOC(BITMAP_WORDS, sizeof(wa[0]));
+        container_fill(a, wa);
+    }
+    wb = b->words;
+    if (b->type != BITMAP) {
+        wb = CALLOC(BITMAP_WORDS, sizeof(wb[0]));
+        container_fill(b, wb);
+    }
+
+    res = container_new(BITMAP, 0);
+    switch (op) {
+        case OP_UNION:
+            Bitvec_or(res->words, wa, wb, BITMAP_WORDS);
+            break;
+        case OP_INTER:
+            Bitvec_and(res->words, wa, wb, BITMAP_WORDS);
+            break;
+        case OP_MINUS:
+            Bitvec_andnot(res->words, wa, wb, BITMAP_WORDS);
+            break;
+        default:
+            Bitvec_xor(res->words, wa, wb, BITMAP_WORDS);
+            break;
+    }
+    res->card = Bitvec_count(res->words, BITMAP_WORDS);
+    container_normalize(res);
+
+    if (wa != a->words) FREE(wa);
+    if (wb != b->words) FREE(wb);
+    return res;
+}
+
+// Sets
+
+/*
+    intset_find:
+        1. Return the index of the first container whose key is not less
+        than high.
+*/
+static int intset_find(struct intset_t *set, unsigned short high) {
+    return lower_bound(set->keys, set->n, high);
+}
+
+/*
+    intset_insert:
+        1. Insert container c with key high at index i of set.
+*/
+static void intset_insert(struct intset_t *set, int i, unsigned short high,
+                          struct intset_container *c) {
+    if (set->n == set->capacity) {
+        set->capacity *= 2;
+        RESIZE(set->keys, set->capacity * (long)sizeof(set->keys[0]));
+        RESIZE(set->containers,
+               set->capacity * (long)sizeof(set->containers[0]));
+    }
+    memmove(set->keys + i + 1, set->keys + i,
+            (set->n - i) * sizeof(set->keys[0]));
+    memmove(set->containers + i + 1, set->containers + i,
+            (set->n - i) * sizeof(set->containers[0]));
+    set->keys[i] = high;
+    set->containers[i] = c;
+    set->n++;
+    set->size += c->card;
+}
+
+static void intset_delete(struct intset_t *set, int i) {
+    container_free(&set->containers[i]);
+    memmove(set->keys + i, set->keys + i + 1,
+            (set->n - i - 1) * sizeof(set->keys[0]));
+    memmove(set->containers + i, set->containers + i + 1,
+            (set->n - i - 1) * sizeof(set->containers[0]));
+    set->n--;
+}
+
+struct intset_t *Intset_new(void) {
+    struct intset_t *set;
+
+    NEW(set);
+    set->size = 0;
+    set->n = 0;
+    set->capacity = 4;
+    set->time_stamp = 0;
+    set->keys = ALLOC(set->capacity * (long)sizeof(set->keys[0]));
+    set->containers = ALLOC(set->capacity * (long)sizeof(set->containers[0]));
+
+    return set;
+}
+
+void Intset_free(struct intset_t **set) {
+    int i;
+
+    assert(set != NULL);
+    assert(*set != NULL);
+
+    for (i = 0; i < (*set)->n; i++) container_free(&(*set)->containers[i]);
+    FREE((*set)->keys);
+    FREE((*set)->containers);
+    FREE(*set);
+}
+
+int Intset_has(struct intset_t *set, unsigned x) {
+    int i;
+
+    assert(set != NULL);
+
+    i = intset_find(set, HIGH(x));
+    return i < set->n && set->keys[i] == HIGH(x) &&
+           container_has(set->containers[i], LOW(x));
+}
+
+void Intset_put(struct intset_t *set, unsigned x) {
+    int i;
+
+    assert(set != NULL);
+
+    i = intset_find(set, HIGH(x));
+    if (i == set->n || set->keys[i] != HIGH(x))
+        intset_insert(set, i, HIGH(x), container_new(ARRAY, 4));
+    if (container_put(set->containers[i], LOW(x))) set->size++;
+    set->time_stamp++;
+}
+
+int Intset_remove(struct intset_t *set, unsigned x) {
+    int i;
+
+    assert(set != NULL);
+
+    set->time_stamp++;
+    i = intset_find(set, HIGH(x));
+    if (i == set->n || set->keys[i] != HIGH(x) ||
+        !container_remove(set->containers[i], LOW(x)))
+        return 0;
+    set->size--;
+    if (set->containers[i]->card == 0) intset_delete(set, i);
+    return 1;
+}
+
+void Intset_map(struct intset_t *set,
+                void (*apply)(unsigned x, void *cl),
+                void *cl) {
+    unsigned long stamp;
+    int i;
+
+    assert(set != NULL);
+    assert(apply != NULL);
+
+    stamp = set->time_stamp;
+    for (i = 0; i < set->n; i++) {
+        container_map(set->containers[i], set->keys[i], apply, cl);
+        assert(stamp == set->time_stamp);  // set cannot be modified during Intset_map
+    }
+}
+
+void Intset_optimize(struct intset_t *set) {
+    struct intset_container *c;
+    long bytes;
+    int i, nruns;
+
+    assert(set != NULL);
+
+    for (i = 0; i < set->n; i++) {
+        c = set->containers[i];
+        if (c->type == RUN) continue;
+        nruns = container_nruns(c);
+        bytes = (c->type == ARRAY) ? c->card * (long)sizeof(c->values[0])
+                                   : BITMAP_BYTES;
+        if (nruns * (long)sizeof(struct run) < bytes) container_to_run(c, nruns);
+    }
+    set->time_stamp++;
+}
+
+/*
+    intset_op:
+        1. Walk the keys of s and t in step, copying the containers found
+        in one operand only, and combining the ones found in both.
+*/
+static struct intset_t *intset_op(struct intset_t *s, struct intset_t *t, int op) {
+    struct intset_t *res;
+    struct intset_container *c;
+    int i, j;
+
+    if (s == NULL) {
+        assert(t != NULL);
+        s = &empty_set;
+    } else if (t == NULL) {
+        t = &empty_set;
+    }
+
+    res = Intset_new();
+    for (i = 0, j = 0; i < s->n || j < t->n;) {
+        if (j == t->n || (i < s->n && s->keys[i] < t->keys[j])) {
+            if (op != OP_INTER)
+                intset_insert(res, res->n, s->keys[i],
+                              container_copy(s->containers[i]));
+            i++;
+        } else if (i == s->n || t->keys[j] < s->keys[i]) {
+            if (op == OP_UNION || op == OP_DIFF)
+                intset_insert(res, res->n, t->keys[j],
+                              container_copy(t->containers[j]));
+            j++;
+        } else {
+            c = container_op(s->containers[i], t->containers[j], op);
+            if (c->card > 0)
+                intset_insert(res, res->n, s->keys[i], c);
+            else
+                container_free(&c);
+            i++, j++;
+        }
+    }
+    return res;
+}
+
+struct intset_t *Intset_union(struct intset_t *s, struct intset_t *t) {
+    return intset_op(s, t, OP_UNION);
+}
+
+struct intset_t *Intset_inter(struct intset_t *s, struct intset_t *t) {
+    return intset_op(s, t, OP_INTER);
+}
+
+struct intset_t *Intset_minus(struct intset_t *s, struct intset_t *t) {
+    return intset_op(s, t, OP_MINUS);
+}
+
+struct intset_t *Intset_diff(struct intset_t *s, struct intset_t *t) {
+    return intset_op(s, t, OP_DIFF);
+}
+
+// Serialization
+/*
+    All integers are little-endian. The format is
+
+        magic               4 bytes
+        containers          u32
+        for each container:
+            key             u16
+            type            u8
+            n               u32     card of a bitmap, length otherwise
+            payload         n u16 values, 8192 bitmap bytes,
+                            or n (u16 start, u16 length) runs
+*/
+
+static int write_u8(FILE *fp, unsigned x) {
+    return putc((int)(x & 0xFF), fp) != EOF;
+}
+
+static int write_u16(FILE *fp, unsigned x) {
+    return write_u8(fp, x) && write_u8(fp, x >> 8);
+}
+
+static int write_u32(FILE *fp, unsigned long x) {
+    return write_u16(fp, (unsigned)(x & 0xFFFF)) &&
+           write_u16(fp, (unsigned)(x >> 16));
+}
+
+static int read_u8(FILE *fp, unsigned *x) {
+    int c;
+
+    if ((c = getc(fp)) == EOF) return 0;
+    *x = (unsigned)c;
+    return 1;
+}
+
+static int read_u16(FILE *fp, unsigned *x) {
+    unsigned lo, hi;
+
+    if (!read_u8(fp, &lo) || !read_u8(fp, &hi)) return 0;
+    *x = lo | (hi << 8);
+    return 1;
+}
+
+static int read_u32(FILE *fp, unsigned long *x) {
+    unsigned lo, hi;
+
+    if (!read_u16(fp, &lo) || !read_u16(fp, &hi)) return 0;
+    *x = lo | ((unsigned long)hi << 16);
+    return 1;
+}
+
+static int container_write(FILE *fp, struct intset_container *c) {
+    long i;
+    int ok;
+
+    ok = write_u8(fp, c->type) &&
+         write_u32(fp, (c->type == BITMAP) ? c->card : c->n);
+    if (c->type == ARRAY) {
+        for (i = 0; ok && i < c->n; i++) ok = write_u16(fp, c->values[i]);
+    } else if (c->type == BITMAP) {
+        for (i = 0; ok && i < BITMAP_BYTES; i++)
+            ok = write_u8(fp, (unsigned)(c->words[i / sizeof(c->words[0])] >>
+                                         (8 * (i % sizeof(c->words[0])))));
+    } else {
+        for (i = 0; ok && i < c->n; i++)
+            ok = write_u16(fp, c->runs[i].start) &&
+                 write_u16(fp, c->runs[i].length);
+    }
+    return ok;
+}
+
+long Intset_write(struct intset_t *set, FILE *fp) {
+    long bytes;
+    int i, ok;
+
+    assert(set != NULL);
+    assert(fp != NULL);
+
+    ok = fwrite(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+         write_u32(fp, set->n);
+    bytes = sizeof(magic) + 4;
+    for (i = 0; ok && i < set->n; i++) {
+        struct intset_container *c = set->containers[i];
+
+        ok = write_u16(fp, set->keys[i]) && container_write(fp, c);
+        bytes += 2 + 1 + 4;
+        if (c->type == ARRAY)
+            bytes += 2L * c->n;
+        else if (c->type == BITMAP)
+            bytes += BITMAP_BYTES;
+        else
+            bytes += 4L * c->n;
+    }
+    return ok ? bytes : -1;
+}
+
+/*
+    container_read:
+        1. Read the type, length and payload of a container.
+        2. Return NULL if they are malformed.
+*/
+static struct intset_container *container_read(FILE *fp) {
+    struct intset_container *c;
+    unsigned type, x, y;
+    unsigned long n;
+    long i;
+    int ok;
+
+    if (!read_u8(fp, &type) || type > RUN || !read_u32(fp, &n)) return NULL;
+    if (n == 0 || (type == ARRAY && n > ARRAY_MAX) ||
+        (type == BITMAP && (n <= ARRAY_MAX || n > CONTAINER_RANGE)) ||
+        (type == RUN && n > CONTAINER_RANGE / 2))
+        return NULL;
+
+    c = container_new(type, (type == BITMAP) ? 0 : (int)n);
+    ok = 1;
+    if (type == ARRAY) {
+        for (i = 0; ok && i < (long)n; i++) {
+            ok = read_u16(fp, &x) && (i == 0 || x > c->values[i - 1]);
+            c->values[i] = (unsigned short)x;
+        }
+        c->n = c->card = (int)n;
+    } else if (type == BITMAP) {
+        for (i = 0; ok && i < BITMAP_BYTES; i++) {
+            ok = read_u8(fp, &x);
+            c->words[i / sizeof(c->words[0])] |=
+                (unsigned long)x << (8 * (i % sizeof(c->words[0])));
+        }
+        c->card = Bitvec_count(c->words, BITMAP_WORDS);
+        ok = ok && c->card == (long)n;
+    } else {
+        for (i = 0; ok && i < (long)n; i++) {
+            // runs must be ascending and separated by at least one value
+            ok = read_u16(fp, &x) && read_u16(fp, &y) &&
+                 x + y < CONTAINER_RANGE &&
+                 (i == 0 ||
+                  x > c->runs[i - 1].start + c->runs[i - 1].length + 1);
+            c->runs[i].start = (unsigned short)x;
+            c->runs[i].length = (unsigned short)y;
+            c->card += (int)y + 1;
+        }
+        c->n = (int)n;
+    }
+    if (!ok) container_free(&c);
+    return c;
+}
+
+struct intset_t *Intset_read(FILE *fp) {
+    struct intset_t *set;
+    struct intset_container *c;
+    char buf[sizeof(magic)];
+    unsigned long n, i;
+    unsigned key;
+
+    assert(fp != NULL);
+
+    if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf) ||
+        memcmp(buf, magic, sizeof(magic)) != 0 || !read_u32(fp, &n) ||
+        n > CONTAINER_RANGE)
+        return NULL;
+
+    set = Intset_new();
+    for (i = 0; i < n; i++) {
+        if (!read_u16(fp, &key) ||
+            (set->n > 0 && key <= set->keys[set->n - 1]) ||
+            (c = container_read(fp)) == NULL) {
+            Intset_free(&set);
+            return NULL;
+        }
+        intset_insert(set, set->n, (unsigned short)key, c);
+    }
+    return set;
+}
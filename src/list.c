@@ -3,17 +3,85 @@
 #include <stdarg.h>  // va_list & va_start() & va_end() & va_arg()
 
 #include "algo.h"
+#include "arena.h"
 #include "assert.h"
 #include "mem.h"
 
-static struct node_t* new_node(void* x) {
+// deallocation in the storage of list, see List_create_in()
+#define LIST_FREE(list, ptr) \
+    ((void)((list)->arena == NULL ? FREE(ptr) : ((ptr) = 0)))
+
+static struct node_t* new_node(struct list_t* list, void* x) {
     struct node_t* p;
-    NEW(p);
+    if (list->arena != NULL)
+        p = Arena_alloc(list->arena, sizeof(*p), __FILE__, __LINE__);
+    else
+        NEW(p);
+    p->data = x;
+    p->prev = p->next = NULL;
+    return p;
+}
+
+// new_node, returning NULL if there is no memory
+static struct node_t* try_new_node(struct list_t* list, void* x) {
+    struct node_t* p;
+    if (list->arena != NULL)
+        p = Arena_try_alloc(list->arena, sizeof(*p));
+    else
+        p = Mem_try_alloc(sizeof(*p), __FILE__, __LINE__);
+    if (p == NULL) return NULL;
     p->data = x;
     p->prev = p->next = NULL;
     return p;
 }
 
+// append node p to list
+static void link_back(struct list_t* list, struct node_t* p) {
+    if (list->len == 0) {
+        list->head = list->tail = p;
+    } else {
+        list->tail->next = p;
+        p->prev = list->tail;
+        list->tail = p;
+    }
+    list->len++;
+}
+
+/*
+    list_create:
+        1. Create a list in arena, or on the heap if arena is NULL, holding
+        x and the arguments of ap up to a NULL.
+*/
+static struct list_t* list_create(struct arena_t* arena, void* x, va_list ap) {
+    struct list_t* lst;
+    struct node_t *last = NULL, *p;
+
+    if (arena != NULL)
+        lst = Arena_alloc(arena, sizeof(*lst), __FILE__, __LINE__);
+    else
+        NEW(lst);
+    lst->arena = arena;
+    lst->tail = lst->head = NULL;
+    lst->len = 0;
+
+    while (x != NULL) {
+        p = new_node(lst, x);
+        if (lst->head == NULL)
+            lst->head = p;
+        else {
+            last->next = p;
+            p->prev = last;
+        }
+
+        last = p;
+        lst->len++;
+        x = va_arg(ap, void*);
+    }
+    lst->tail = last;
+
+    return lst;
+}
+
 // Codes in comment are the implementation for
 // the one-way circular list without a head pointer.
 
@@ -50,27 +118,23 @@ struct list_t* List_create(void* x, ...) {
     return lst;
     */
     struct list_t* lst;
-    struct node_t *last, *p;
     va_list ap;
 
-    NEW(lst);
-    lst->tail = lst->head = NULL;
-    lst->len = 0;
-
     va_start(ap, x);
-    while (x != NULL) {
-        p = new_node(x);
-        if (lst->head == NULL)
-            lst->head = p;
-        else {
-            last->next = p;
-            p->prev = last;
-        }
+    lst = list_create(NULL, x, ap);
+    va_end(ap);
 
-        last = p;
-        lst->len++;
-        x = va_arg(ap, void*);
-    }
+    return lst;
+}
+
+struct list_t* List_create_in(struct arena_t* arena, void* x, ...) {
+    struct list_t* lst;
+    va_list ap;
+
+    assert(arena != NULL);
+
+    va_start(ap, x);
+    lst = list_create(arena, x, ap);
     va_end(ap);
 
     return lst;
@@ -91,13 +155,15 @@ void List_push_back(struct list_t* list, void* x) {
 
     list->len++;
     */
-    if (list->len == 0) {
-        list->head = list->tail = new_node(x);
-    } else {
-        list->tail->next = new_node(x);
-        list->tail->next->prev = list->tail;
-    }
-    list->len++;
+    link_back(list, new_node(list, x));
+}
+
+int List_try_push_back(struct list_t* list, void* x) {
+    struct node_t* p;
+
+    if ((p = try_new_node(list, x)) == NULL) return -1;
+    link_back(list, p);
+    return 0;
 }
 
 void* List_pop_back(struct list_t* list) {
@@ -110,9 +176,12 @@ void* List_pop_back(struct list_t* list) {
         p = list->tail;
         list->tail = p->prev;
         x = p->data;
-        FREE(p);
+        LIST_FREE(list, p);
         list->len--;
-        if (list->len == 0) list->head = NULL;
+        if (list->len == 0)
+            list->head = NULL;
+        else
+            list->tail->next = NULL;
         return x;
     }
 }
@@ -133,10 +202,11 @@ void List_push_front(struct list_t* list, void* x) {
     list->len++;
     */
     if (list->len == 0) {
-        list->head = list->tail = new_node(x);
+        list->head = list->tail = new_node(list, x);
     } else {
-        list->head->prev = new_node(x);
+        list->head->prev = new_node(list, x);
         list->head->prev->next = list->head;
+        list->head = list->head->prev;
     }
     list->len++;
 }
@@ -166,9 +236,12 @@ void* List_pop_front(struct list_t* list) {
         p = list->head;
         list->head = p->next;
         x = p->data;
-        FREE(p);
+        LIST_FREE(list, p);
         list->len--;
-        if (list->len == 0) list->tail = NULL;
+        if (list->len == 0)
+            list->tail = NULL;
+        else
+            list->head->prev = NULL;
         return x;
     }
 }
@@ -189,10 +262,16 @@ extern int List_remove(struct list_t* list, void* x) {
     struct node_t* p;
     for (p = list->head; p != NULL; p = p->next) {
         if (p->data == x) {
-            p->prev->next = p->next;
-            p->next->prev = p->prev;
+            if (p->prev != NULL)
+                p->prev->next = p->next;
+            else
+                list->head = p->next;
+            if (p->next != NULL)
+                p->next->prev = p->prev;
+            else
+                list->tail = p->prev;
             list->len--;
-            FREE(p);
+            LIST_FREE(list, p);
             return 1;
         }
     }
@@ -203,6 +282,12 @@ void List_free(struct list_t** list) {
     assert(list != NULL);
     assert(*list != NULL);
 
+    // the storage of the list goes with its arena
+    if ((*list)->arena != NULL) {
+        *list = NULL;
+        return;
+    }
+
     struct node_t *p, *del;
     p = (*list)->head;
     while (p != NULL) {
@@ -5,12 +5,17 @@
     specified by the Mem interface
 */
 
+#define _DEFAULT_SOURCE  // posix_memalign() with -std=c99
+
 #include "mem.h"
 
-#include <stdlib.h>  // malloc() & free()
+#include <stdlib.h>  // malloc() & free() & posix_memalign()
+#include <string.h>  // memset()
 
 #include "assert.h"
 #include "except.h"
+#include "memhook.h"
+#include "memtrace.h"
 
 const struct except_t mem_failed = {"Allocation Failed"};
 
@@ -23,6 +28,9 @@ void *Mem_alloc(long nbytes, const char *file, int line) {
 
     assert(nbytes > 0);
 
+    if (memhook_narenas > 0) return Memhook_arena_alloc(nbytes, file, line);
+
+    MEMHOOK_ADMIT(nbytes, NULL, file, line);
     ptr = malloc(nbytes);
     if (ptr == NULL) {
         if (file == NULL)
@@ -30,6 +38,23 @@ void *Mem_alloc(long nbytes, const char *file, int line) {
         else
             Except_raise(&mem_failed, file, line);
     }
+    MEMHOOK_ALLOC(ptr, nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_ALLOC, ptr, NULL, nbytes, file, line);
+
+    return ptr;
+}
+
+void *Mem_try_alloc(long nbytes, const char *file, int line) {
+    void *ptr;
+
+    assert(nbytes > 0);
+
+    if (memhook_narenas > 0) return Memhook_arena_try_alloc(nbytes);
+
+    if (memhook_nbudgets > 0 && !Memhook_admit(nbytes, NULL)) return NULL;
+    if ((ptr = malloc(nbytes)) == NULL) return NULL;
+    MEMHOOK_ALLOC(ptr, nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_ALLOC, ptr, NULL, nbytes, file, line);
 
     return ptr;
 }
@@ -40,6 +65,12 @@ void *Mem_calloc(long count, long nbytes, const char *file, int line) {
     assert(count > 0);
     assert(nbytes > 0);
 
+    if (memhook_narenas > 0) {
+        ptr = Memhook_arena_alloc(count * nbytes, file, line);
+        return memset(ptr, 0, count * nbytes);
+    }
+
+    MEMHOOK_ADMIT(count * nbytes, NULL, file, line);
     ptr = calloc(count, nbytes);
 
     if (ptr == NULL) {
@@ -48,25 +79,97 @@ void *Mem_calloc(long count, long nbytes, const char *file, int line) {
         else
             Except_raise(&mem_failed, file, line);
     }
+    MEMHOOK_ALLOC(ptr, count * nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_CALLOC, ptr, NULL, count * nbytes, file, line);
 
     return ptr;
 }
 
+void *Mem_alloc_aligned(long nbytes, long align, const char *file, int line) {
+    void *ptr;
+
+    assert(nbytes > 0);
+    assert(align > 0 && (align & (align - 1)) == 0);
+
+    if (memhook_narenas > 0) return Memhook_arena_alloc_aligned(nbytes, align, file, line);
+
+    MEMHOOK_ADMIT(nbytes, NULL, file, line);
+    if (align < (long)sizeof(void *)) align = sizeof(void *);
+    if (posix_memalign(&ptr, align, nbytes) != 0) {
+        if (file == NULL)
+            RAISE(mem_failed);
+        else
+            Except_raise(&mem_failed, file, line);
+    }
+    MEMHOOK_ALLOC(ptr, nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_ALLOC, ptr, NULL, nbytes, file, line);
+
+    return ptr;
+}
+
+void Mem_alloc_batch(long n, long nbytes, void **ptrs, const char *file, int line) {
+    long i;
+
+    assert(n >= 0);
+    assert(nbytes > 0);
+    assert(ptrs != NULL || n == 0);
+
+    if (memhook_narenas > 0) {
+        for (i = 0; i < n; i++) ptrs[i] = Memhook_arena_alloc(nbytes, file, line);
+        return;
+    }
+
+    MEMHOOK_ADMIT(n * nbytes, NULL, file, line);
+    for (i = 0; i < n; i++) {
+        if ((ptrs[i] = malloc(nbytes)) == NULL) {
+            while (i-- > 0) Mem_free(ptrs[i], file, line);
+            if (file == NULL)
+                RAISE(mem_failed);
+            else
+                Except_raise(&mem_failed, file, line);
+        }
+        MEMHOOK_ALLOC(ptrs[i], nbytes, file, line);
+        MEMHOOK_TRACE(MEMTRACE_ALLOC, ptrs[i], NULL, nbytes, file, line);
+    }
+}
+
 void Mem_free(void *ptr, const char *file, int line) {
-    if (ptr != NULL) free(ptr);
+    if (ptr != NULL) {
+        if (memhook_narenas > 0 && Memhook_arena_owns(ptr)) return;
+        MEMHOOK_FREE(ptr);
+        MEMHOOK_TRACE(MEMTRACE_FREE, ptr, NULL, 0, file, line);
+        free(ptr);
+    }
 }
 
 void *Mem_resize(void *ptr, long nbytes, const char *file, int line) {
+    unsigned long old = (unsigned long)ptr;  // id of the block in a trace
+    void *new_ptr;
+
     assert(ptr != NULL);
     assert(nbytes > 0);
 
-    ptr = realloc(ptr, nbytes);
-    if (ptr == NULL) {
+    if (memhook_narenas > 0 && Memhook_arena_owns(ptr))
+        return Memhook_arena_resize(ptr, nbytes, file, line);
+
+    MEMHOOK_ADMIT(nbytes, ptr, file, line);
+    new_ptr = realloc(ptr, nbytes);
+    if (new_ptr == NULL) {
         if (file == NULL)
             RAISE(mem_failed);
         else
             Except_raise(&mem_failed, file, line);
     }
+    // the caller keeps ptr if realloc fails, so it is forgotten only
+    // now, by its address
+    MEMHOOK_FREE((void *)old);
+    MEMHOOK_ALLOC(new_ptr, nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_RESIZE, new_ptr, (void *)old, nbytes, file, line);
 
-    return ptr;
-}
\ No newline at end of file
+    return new_ptr;
+}
+
+void Mem_leak(void (*apply)(const void *ptr, long size, const char *file, int line, void *cl),
+              void *cl) {
+    Memhook_leak(apply, cl);
+}
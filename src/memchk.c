@@ -6,64 +6,121 @@
 
     TODO:
         1. How to detect and remove such blocks whose size is less than sizeof(align).
-        2. Mem_leak().
-    
-    For the first one, I think it is impossible, because this lib is not the implementation 
+
+    For the first one, I think it is impossible, because this lib is not the implementation
     of malloc() and free(), but the capsulation of them, I can't free the certain blocks.
 */
 
-#include <stdio.h>   // fprintf() & FILE
+#define _DEFAULT_SOURCE  // sched_yield() with -std=c99
+
+#include <sched.h>   // sched_yield()
+#include <stdio.h>   // FILE
 #include <stdlib.h>  // malloc() & free()
 #include <string.h>  // memset()
 
+#include "algo.h"
 #include "align.h"
 #include "assert.h"
 #include "except.h"
 #include "mem.h"
+#include "memhook.h"
+#include "memlog.h"
+#include "memtrace.h"
 
-// size of memory block hash table
-#define HASH_TABLE_SIZE 2039
+// number of independently locked parts of the descriptor hash table
+#define NSTRIPES 64
 
-// default number of descriptors
+// initial number of buckets of a part of the hash table, which doubles
+// whenever it holds more descriptors than buckets
+#define HASH_TABLE_SIZE 64
+
+// number of descriptors allocated at once
 #define DEFAULT_NUM_DESCRIPTOR 512
 
-// space allocation increment
-#define SPACE_ALLOC_INCREMENT 4096
+// least size of the regions taken from malloc()
+#define SPACE_ALLOC_INCREMENT 65536
+
+// Free blocks are kept in bins by size: bin k holds the sizes in
+// [2^k, 2^(k+1)). Only the first BIN_SCAN blocks of the bin of a request
+// are tried, the bins above it hold blocks large enough anyway.
+#define NBINS 64
+#define BIN_SCAN 8
+
+// locks are held across a malloc() or a memset() of a region, so a
+// thread waiting for one gives up its processor
+#if defined(__GNUC__)
+#define LOCK(l) \
+    while (__atomic_test_and_set(&(l), __ATOMIC_ACQUIRE)) sched_yield()
+#define UNLOCK(l) __atomic_clear(&(l), __ATOMIC_RELEASE)
+#else
+#define LOCK(l)
+#define UNLOCK(l)
+#endif
+
+/*
+    Each thread cuts its blocks from the regions of its own heap, so
+    threads allocate without contending. A block may be freed or resized
+    by any thread, which then locks the heap of the block, found from its
+    descriptor. The descriptors are found by address in a hash table of
+    NSTRIPES parts, each with its own lock. A heap lock is taken before a
+    part lock, never after, and at most one heap lock is held at a time.
+    A heap outlives its thread, as other threads may still free its blocks.
+*/
+struct heap {
+    char lock;
+    struct descriptor *bins[NBINS];  // free blocks
+    unsigned long long nonempty;     // a bit per nonempty bin
+};
 
+/*
+    A region taken from malloc() is cut into blocks, each one with a
+    descriptor. Descriptors of the same region are linked in address
+    order, so that a freed block finds its neighbours at once, and
+    descriptors of free blocks are linked in the bin of their size.
+    Free blocks stay in the hash table, to tell a double free from an
+    invalid pointer, until they are merged into their left neighbour.
+    Blocks are cut from the front of free blocks, so a block usually has
+    free space after it and Mem_resize can grow it in place, taking the
+    front of the free block.
+*/
 struct descriptor {
-    struct descriptor *free;  // linked in free-block list
-    struct descriptor *link;  // linked in hash table
-    const void *ptr;          // allocated block
-    long size;                // size of block
-    const char *file;         // location
+    struct descriptor *link;          // linked in hash table
+    struct descriptor *prev, *next;   // linked in a bin, if free
+    struct descriptor *left, *right;  // neighbours in the region
+    struct heap *heap;                // heap of the region
+    const void *ptr;                  // block
+    long size;                        // size of block
+    const char *file;                 // location
     int line;
+    int free;  // 1 if the block is free
 };
 
-// invalid operations in Mem_resize and Mem_free
-static enum {
-    VALID_ARG,
-    INVALID_PTR,
-    FREE_FREED_MEM,
-    RESIZE_UNALLOC_MEM,
-} invalid_operaion = VALID_ARG;
+// part of the descriptor hash table, keyed by block address
+struct stripe {
+    char lock;
+    struct descriptor **table;
+    unsigned long capacity;
+    unsigned long count;
+};
 
 // memory-allocation-failed exception
 const struct except_t mem_failed = {"Allocation Failed"};
 
-// allocated memory block descriptor pointer hash table
-static struct descriptor *mem_block_hash_table[HASH_TABLE_SIZE];
+static struct stripe stripes[NSTRIPES];
 
-// free_block_list is a circular linked list in which
-// there are all unused allocated memory blocks.
-static struct descriptor free_block_list = {&free_block_list};
+// heap of the calling thread, created by its first allocation
+static THREAD_LOCAL struct heap *my_heap = NULL;
 
-// available descriptors
-static struct descriptor *avail = NULL;
+// available descriptors of the calling thread
+static THREAD_LOCAL struct descriptor *avail = NULL;
 
 // number of left descriptors
-static int nleft = 0;
+static THREAD_LOCAL int nleft = 0;
 
-// memory allocation log stream
+// descriptors released by merges, linked through link
+static THREAD_LOCAL struct descriptor *spare = NULL;
+
+// memory allocation log stream, written by the thread of memlog.c
 static FILE *mem_log_stm = NULL;
 
 /*
@@ -78,104 +135,565 @@ static inline int is_aligned(const void *ptr) {
 /*
     hash:
         1. hash function of descriptor.ptr.
-        2. Judge a pointer as an unsigned long int.
+        2. Block addresses share their low bits, they are mixed before
+        being reduced to a part and a bucket of the table.
 */
-static inline unsigned long hash(const void *ptr) {
-    return (unsigned long)ptr % HASH_TABLE_SIZE;
+static inline unsigned long long hash(const void *ptr) {
+    return mix_hash((unsigned long)ptr);
 }
 
+#define STRIPE(h) (&stripes[(h) & (NSTRIPES - 1)])
+#define BUCKET(s, h) (((h) >> 6) & ((s)->capacity - 1))
+
 /*
     hash_table_find:
-        1. Find the descriptor in mem_block_hash_table for ptr.
+        1. Find the descriptor in the hash table for ptr.
         2. If not found, return NULL.
 */
 static struct descriptor *hash_table_find(const void *ptr) {
-    struct descriptor *bp;
-
-    bp = mem_block_hash_table[hash(ptr)];
-    while (bp != NULL && bp->ptr != ptr) bp = bp->link;
+    unsigned long long h = hash(ptr);
+    struct stripe *s = STRIPE(h);
+    struct descriptor *bp = NULL;
+
+    LOCK(s->lock);
+    if (s->capacity > 0) {
+        bp = s->table[BUCKET(s, h)];
+        while (bp != NULL && bp->ptr != ptr) bp = bp->link;
+    }
+    UNLOCK(s->lock);
     return bp;
 }
 
+/*
+    hash_table_grow:
+        1. Double the buckets of the part s of the hash table, and return
+        0 if there is no memory for them.
+*/
+static int hash_table_grow(struct stripe *s) {
+    struct descriptor **old, *bp, *next;
+    unsigned long i, n;
+
+    n = (s->capacity == 0) ? HASH_TABLE_SIZE : 2 * s->capacity;
+    old = s->table;
+    s->table = calloc(n, sizeof(*s->table));
+    if (s->table == NULL) {
+        s->table = old;
+        return 0;
+    }
+    i = s->capacity;
+    s->capacity = n;
+    while (i-- > 0) {
+        for (bp = old[i]; bp != NULL; bp = next) {
+            next = bp->link;
+            bp->link = s->table[BUCKET(s, hash(bp->ptr))];
+            s->table[BUCKET(s, hash(bp->ptr))] = bp;
+        }
+    }
+    free(old);
+    return 1;
+}
+
+/*
+    hash_table_insert:
+        1. Insert bp in the hash table, and return 0 if there is no memory
+        to grow it.
+*/
+static int hash_table_insert(struct descriptor *bp) {
+    unsigned long long h = hash(bp->ptr);
+    struct stripe *s = STRIPE(h);
+
+    LOCK(s->lock);
+    if (s->count >= s->capacity && !hash_table_grow(s) && s->capacity == 0) {
+        UNLOCK(s->lock);
+        return 0;
+    }
+    bp->link = s->table[BUCKET(s, h)];
+    s->table[BUCKET(s, h)] = bp;
+    s->count++;
+    UNLOCK(s->lock);
+    return 1;
+}
+
+/*
+    hash_table_delete:
+        1. Find the descriptor in the hash table for ptr and remove it.
+*/
+static void hash_table_delete(const void *ptr) {
+    unsigned long long h = hash(ptr);
+    struct stripe *s = STRIPE(h);
+    struct descriptor **pp;
+
+    LOCK(s->lock);
+    for (pp = &s->table[BUCKET(s, h)]; *pp != NULL; pp = &(*pp)->link) {
+        if ((*pp)->ptr == ptr) {
+            *pp = (*pp)->link;
+            s->count--;
+            break;
+        }
+    }
+    UNLOCK(s->lock);
+}
+
 /*
     dalloc:
         1. Allocator of descriptors
         2. In memory level, descriptors will be arranged in an array whose
-        default size is 512.
+        default size is 512. Descriptors released by merges are reused first.
+        Each thread has its own, so they are taken without a lock.
         3. If allocation failed, return NULL.
 */
-static struct descriptor *dalloc(void *ptr, long size, const char *file, int line) {
-    if (nleft <= 0) {
-        avail = malloc(DEFAULT_NUM_DESCRIPTOR * sizeof(*avail));
-        if (avail == NULL) return NULL;
+static struct descriptor *dalloc(struct heap *heap, void *ptr, long size,
+                                 const char *file, int line) {
+    struct descriptor *bp;
+
+    if (spare != NULL) {
+        bp = spare;
+        spare = spare->link;
+    } else {
+        if (nleft <= 0) {
+            avail = malloc(DEFAULT_NUM_DESCRIPTOR * sizeof(*avail));
+            if (avail == NULL) return NULL;
+            nleft = DEFAULT_NUM_DESCRIPTOR;
+        }
+        nleft--;
+        bp = avail++;
     }
 
-    avail->ptr = ptr;
-    avail->size = size;
-    avail->file = file;
-    avail->line = line;
-    avail->free = avail->link = NULL;
+    bp->heap = heap;
+    bp->ptr = ptr;
+    bp->size = size;
+    bp->file = file;
+    bp->line = line;
+    bp->link = bp->prev = bp->next = NULL;
+    bp->left = bp->right = NULL;
+    bp->free = 0;
+    return bp;
+}
 
-    nleft--;
-    return avail++;
+/*
+    dfree:
+        1. Release a descriptor for reuse by dalloc.
+*/
+static void dfree(struct descriptor *bp) {
+    bp->link = spare;
+    spare = bp;
 }
 
-// This kind of implementation use the First-Fit algorithm.
-void *Mem_alloc(long nbytes, const char *file, int line) {
+/*
+    heap_get:
+        1. Return the heap of the calling thread, or NULL if there is no
+        memory for it.
+*/
+static struct heap *heap_get(void) {
+    if (my_heap == NULL) my_heap = calloc(1, sizeof(*my_heap));
+    return my_heap;
+}
+
+/*
+    lock_block:
+        1. Find the descriptor of ptr and lock its heap. Return NULL, with
+        no lock held, if ptr is not a block.
+        2. The descriptor is looked up again once the heap is locked, as
+        another thread may have merged it away in the meantime.
+*/
+static struct descriptor *lock_block(const void *ptr) {
+    struct descriptor *bp;
+    struct heap *heap;
+
+    for (;;) {
+        if ((bp = hash_table_find(ptr)) == NULL) return NULL;
+        heap = bp->heap;
+        LOCK(heap->lock);
+        if (hash_table_find(ptr) == bp && bp->heap == heap) return bp;
+        UNLOCK(heap->lock);
+    }
+}
+
+/*
+    bin_of:
+        1. Return the bin of blocks of size bytes, floor(log2(size)).
+*/
+static inline int bin_of(long size) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll((unsigned long long)size);
+#else
+    int k;
+    for (k = 0; size > 1; k++) size >>= 1;
+    return k;
+#endif
+}
+
+static void bin_insert(struct descriptor *bp) {
+    struct heap *heap = bp->heap;
+    int k = bin_of(bp->size);
+
+    bp->prev = NULL;
+    bp->next = heap->bins[k];
+    if (heap->bins[k] != NULL) heap->bins[k]->prev = bp;
+    heap->bins[k] = bp;
+    heap->nonempty |= 1ULL << k;
+    bp->free = 1;
+}
+
+static void bin_remove(struct descriptor *bp) {
+    struct heap *heap = bp->heap;
+    int k = bin_of(bp->size);
+
+    if (bp->prev != NULL)
+        bp->prev->next = bp->next;
+    else
+        heap->bins[k] = bp->next;
+    if (bp->next != NULL) bp->next->prev = bp->prev;
+    if (heap->bins[k] == NULL) heap->nonempty &= ~(1ULL << k);
+    bp->prev = bp->next = NULL;
+    bp->free = 0;
+}
+
+/*
+    bin_find:
+        1. Return a free block of heap of at least nbytes, or NULL.
+*/
+static struct descriptor *bin_find(struct heap *heap, long nbytes) {
+    struct descriptor *bp;
+    unsigned long long mask;
+    int k, i;
+
+    k = bin_of(nbytes);
+    for (bp = heap->bins[k], i = 0; bp != NULL && i < BIN_SCAN; bp = bp->next, i++)
+        if (bp->size >= nbytes) return bp;
+
+    mask = (k + 1 < NBINS) ? heap->nonempty & (~0ULL << (k + 1)) : 0;
+    if (mask == 0) return NULL;
+#if defined(__GNUC__)
+    k = __builtin_ctzll(mask);
+#else
+    for (k = 0; (mask & 1) == 0; k++) mask >>= 1;
+#endif
+    return heap->bins[k];
+}
+
+/*
+    region_new:
+        1. Take a region of at least nbytes from malloc() for heap and
+        return the descriptor of its single free block, or NULL if there
+        is no memory.
+*/
+static struct descriptor *region_new(struct heap *heap, long nbytes) {
     struct descriptor *bp;
     void *ptr;
 
-    assert(nbytes > 0);
+    if (nbytes < SPACE_ALLOC_INCREMENT) nbytes = SPACE_ALLOC_INCREMENT;
+    if ((ptr = malloc(nbytes)) == NULL) return NULL;
+    if ((bp = dalloc(heap, ptr, nbytes, __FILE__, __LINE__)) == NULL) {
+        free(ptr);
+        return NULL;
+    }
+    if (!hash_table_insert(bp)) {
+        dfree(bp);
+        free(ptr);
+        return NULL;
+    }
+
+    // initializing uninitialized memory to some distinctive bit pattern to help
+    // diagnose bugs that are caused by accessing uninitialized memory.
+    memset(ptr, 0xCC, nbytes);
+    bin_insert(bp);
+    return bp;
+}
+
+/*
+    free_block_merge:
+        1. Merge the freed block p with its free neighbours in the region,
+        and return the descriptor of the merged block.
+        2. A block merged into its left neighbour leaves the hash table,
+        so a later Mem_free of it is reported as an invalid pointer.
+*/
+static struct descriptor *free_block_merge(struct descriptor *p) {
+    struct descriptor *q;
+
+    if ((q = p->right) != NULL && q->free) {
+        bin_remove(q);
+        p->size += q->size;
+        p->right = q->right;
+        if (q->right != NULL) q->right->left = p;
+        hash_table_delete(q->ptr);
+        dfree(q);
+    }
+    if ((q = p->left) != NULL && q->free) {
+        bin_remove(q);
+        q->size += p->size;
+        q->right = p->right;
+        if (p->right != NULL) p->right->left = q;
+        hash_table_delete(p->ptr);
+        dfree(p);
+        p = q;
+    }
+    return p;
+}
+
+/*
+    split:
+        1. Cut the block bp down to nbytes and make the rest of it a free
+        block right after it, merged with a free right neighbour.
+        2. Return 0, leaving bp as it was, if there is no memory for the
+        descriptor of the rest.
+*/
+static int split(struct descriptor *bp, long nbytes) {
+    struct descriptor *np;
+
+    np = dalloc(bp->heap, (char *)bp->ptr + nbytes, bp->size - nbytes, __FILE__, __LINE__);
+    if (np == NULL) return 0;
+    if (!hash_table_insert(np)) {
+        dfree(np);
+        return 0;
+    }
+    bp->size = nbytes;
+    np->left = bp;
+    np->right = bp->right;
+    if (bp->right != NULL) bp->right->left = np;
+    bp->right = np;
+    bin_insert(free_block_merge(np));
+    return 1;
+}
+
+/*
+    grow:
+        1. Extend the allocated block bp to nbytes into its right neighbour,
+        and return 0 if that one is not a free block large enough.
+*/
+static int grow(struct descriptor *bp, long nbytes) {
+    struct descriptor *q = bp->right;
+    long need = nbytes - bp->size;
+
+    if (q == NULL || !q->free || q->size < need) return 0;
+    bin_remove(q);
+    hash_table_delete(q->ptr);
+    if (q->size == need) {
+        bp->right = q->right;
+        if (q->right != NULL) q->right->left = bp;
+        dfree(q);
+    } else {
+        q->ptr = (char *)q->ptr + need;
+        q->size -= need;
+        if (!hash_table_insert(q)) {
+            // no memory in the part of its new address, put it back
+            q->ptr = (char *)q->ptr - need;
+            q->size += need;
+            hash_table_insert(q);  // can't fail, its part just lost an entry
+            bin_insert(q);
+            return 0;
+        }
+        bin_insert(q);
+    }
+    bp->size = nbytes;
+    return 1;
+}
+
+/*
+    block_alloc:
+        1. Allocate nbytes, a multiple of the alignment, at the front of a
+        free block of heap, and return its descriptor or NULL if there is
+        no memory.
+        2. A block of room bytes or more is preferred, the rest of it stays
+        free right after the new block, which can then grow in place.
+        3. heap is locked.
+*/
+static struct descriptor *block_alloc(struct heap *heap, long nbytes, long room) {
+    struct descriptor *bp;
+
+    if ((room <= nbytes || (bp = bin_find(heap, room)) == NULL) &&
+        (bp = bin_find(heap, nbytes)) == NULL && (bp = region_new(heap, room)) == NULL)
+        return NULL;
+
+    bin_remove(bp);
+    if (bp->size > nbytes && !split(bp, nbytes)) {
+        bin_insert(bp);
+        return NULL;
+    }
+    return bp;
+}
+
+/*
+    chk_alloc:
+        1. Allocate a block as Mem_alloc does outside an arena, hooks
+        included, but leave the call out of the trace, for Mem_calloc,
+        which traces itself.
+*/
+static void *chk_alloc(long nbytes, const char *file, int line) {
+    struct descriptor *bp = NULL;
+    struct heap *heap;
+
+    MEMHOOK_ADMIT(nbytes, NULL, file, line);
 
     // round nbytes up to an alignment boundary
     nbytes = ROUND_UP_TO_ALIGN_BOUND(nbytes);
 
-    for (bp = free_block_list.free; bp != NULL; bp = bp->free) {
-        if (bp->size > nbytes) {
-            // use the end of the block at bp->ptr
-            bp->size -= nbytes;
-            ptr = (char *)bp->ptr + bp->size;
+    if ((heap = heap_get()) != NULL) {
+        LOCK(heap->lock);
+        if ((bp = block_alloc(heap, nbytes, nbytes)) != NULL) {
+            bp->file = file;
+            bp->line = line;
+        }
+        UNLOCK(heap->lock);
+    }
+    if (bp == NULL) {
+        // memory allocation failed
+        if (file == NULL)
+            RAISE(mem_failed);
+        else
+            Except_raise(&mem_failed, file, line);
+    }
+    MEMHOOK_ALLOC(bp->ptr, nbytes, file, line);
 
-            if ((bp = dalloc(ptr, nbytes, file, line)) != NULL) {
-                unsigned long h;
+    return (void *)bp->ptr;
+}
 
-                h = hash(ptr);
-                bp->link = mem_block_hash_table[h];
-                mem_block_hash_table[h] = bp;
-                return ptr;
-            } else {
-                // memory allocation failed
-                if (file == NULL)
-                    RAISE(mem_failed);
-                else
-                    Except_raise(&mem_failed, file, line);
-            }
+void *Mem_alloc(long nbytes, const char *file, int line) {
+    void *ptr;
+
+    assert(nbytes > 0);
+
+    if (memhook_narenas > 0) return Memhook_arena_alloc(nbytes, file, line);
+
+    ptr = chk_alloc(nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_ALLOC, ptr, NULL, ROUND_UP_TO_ALIGN_BOUND(nbytes), file, line);
+
+    return ptr;
+}
+
+void *Mem_try_alloc(long nbytes, const char *file, int line) {
+    struct descriptor *bp = NULL;
+    struct heap *heap;
+
+    assert(nbytes > 0);
+
+    if (memhook_narenas > 0) return Memhook_arena_try_alloc(nbytes);
+
+    if (memhook_nbudgets > 0 && !Memhook_admit(nbytes, NULL)) return NULL;
+    nbytes = ROUND_UP_TO_ALIGN_BOUND(nbytes);
+    if ((heap = heap_get()) != NULL) {
+        LOCK(heap->lock);
+        if ((bp = block_alloc(heap, nbytes, nbytes)) != NULL) {
+            bp->file = file;
+            bp->line = line;
         }
-        if (bp == &free_block_list) {
-            struct descriptor *new_ptr;
-
-            // allocate a new block whose size is equal to nbytes+SPACE_ALLOC_INCREMENT
-            if ((ptr = malloc(nbytes + SPACE_ALLOC_INCREMENT)) == NULL ||
-                (new_ptr = dalloc(ptr, nbytes + SPACE_ALLOC_INCREMENT,
-                                  __FILE__, __LINE__)) == NULL) {
-                // memory allocation failed
-                if (file == NULL)
-                    RAISE(mem_failed);
-                else
-                    Except_raise(&mem_failed, file, line);
-            }
+        UNLOCK(heap->lock);
+    }
+    if (bp == NULL) return NULL;
+    MEMHOOK_ALLOC(bp->ptr, nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_ALLOC, bp->ptr, NULL, nbytes, file, line);
+
+    return (void *)bp->ptr;
+}
+
+/*
+    block_alloc_aligned:
+        1. Same as block_alloc, for a block aligned on align bytes. The
+        padding in front of it stays a free block.
+*/
+static struct descriptor *block_alloc_aligned(struct heap *heap, long nbytes, long align) {
+    struct descriptor *bp, *np;
+    long pad;
+
+    // a free block with room for the padding in front of the worst case
+    pad = align - (long)ALIGN_BOUND;
+    if ((bp = bin_find(heap, nbytes + pad)) == NULL &&
+        (bp = region_new(heap, nbytes + pad)) == NULL)
+        return NULL;
+
+    bin_remove(bp);
+    np = bp;
+    pad = (long)(-(unsigned long)bp->ptr & (align - 1));
+    if (pad > 0) {
+        if (split(bp, pad)) {
+            np = bp->right;
+            bin_remove(np);
+        } else
+            np = NULL;
+        bin_insert(bp);
+    }
+    if (np != NULL && np->size > nbytes && !split(np, nbytes)) {
+        bin_insert(free_block_merge(np));
+        np = NULL;
+    }
+    return np;
+}
+
+void *Mem_alloc_aligned(long nbytes, long align, const char *file, int line) {
+    struct descriptor *np = NULL;
+    struct heap *heap;
 
-            // initializing uninitialized memory to some distinctive bit pattern to help
-            // diagnose bugs that are caused by accessing uninitialized memory.
-            memset(ptr, 0xCC, nbytes + SPACE_ALLOC_INCREMENT);
-            //
-            new_ptr->free = free_block_list.free;
-            free_block_list.free = new_ptr;
+    assert(nbytes > 0);
+    assert(align > 0 && (align & (align - 1)) == 0);
+
+    if (memhook_narenas > 0) return Memhook_arena_alloc_aligned(nbytes, align, file, line);
+    if (align <= (long)ALIGN_BOUND) return Mem_alloc(nbytes, file, line);
+
+    MEMHOOK_ADMIT(nbytes, NULL, file, line);
+
+    nbytes = ROUND_UP_TO_ALIGN_BOUND(nbytes);
+
+    if ((heap = heap_get()) != NULL) {
+        LOCK(heap->lock);
+        if ((np = block_alloc_aligned(heap, nbytes, align)) != NULL) {
+            np->file = file;
+            np->line = line;
         }
+        UNLOCK(heap->lock);
     }
+    if (np == NULL) {
+        // memory allocation failed
+        if (file == NULL)
+            RAISE(mem_failed);
+        else
+            Except_raise(&mem_failed, file, line);
+    }
+    MEMHOOK_ALLOC(np->ptr, nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_ALLOC, np->ptr, NULL, nbytes, file, line);
 
-    assert(0);
-    return NULL;
+    return (void *)np->ptr;
+}
+
+void Mem_alloc_batch(long n, long nbytes, void **ptrs, const char *file, int line) {
+    struct descriptor *bp = NULL;
+    struct heap *heap;
+    long i = 0;
+
+    assert(n >= 0);
+    assert(nbytes > 0);
+    assert(ptrs != NULL || n == 0);
+
+    if (memhook_narenas > 0) {
+        for (i = 0; i < n; i++) ptrs[i] = Memhook_arena_alloc(nbytes, file, line);
+        return;
+    }
+
+    MEMHOOK_ADMIT(n * nbytes, NULL, file, line);
+    nbytes = ROUND_UP_TO_ALIGN_BOUND(nbytes);
+    if ((heap = heap_get()) != NULL) {
+        // one lock for the whole batch
+        LOCK(heap->lock);
+        for (i = 0; i < n; i++) {
+            // room for the rest of the batch keeps the blocks next to each other
+            if ((bp = block_alloc(heap, nbytes, (n - i) * nbytes)) == NULL) break;
+            bp->file = file;
+            bp->line = line;
+            ptrs[i] = (void *)bp->ptr;
+        }
+        if (i < n)
+            while (i > 0) bin_insert(free_block_merge(hash_table_find(ptrs[--i])));
+        UNLOCK(heap->lock);
+    }
+    if (i < n || heap == NULL) {
+        if (file == NULL)
+            RAISE(mem_failed);
+        else
+            Except_raise(&mem_failed, file, line);
+    }
+    for (i = 0; i < n; i++) {
+        MEMHOOK_ALLOC(ptrs[i], nbytes, file, line);
+        MEMHOOK_TRACE(MEMTRACE_ALLOC, ptrs[i], NULL, nbytes, file, line);
+    }
 }
 
 void *Mem_calloc(long count, long nbytes, const char *file, int line) {
@@ -184,152 +702,177 @@ void *Mem_calloc(long count, long nbytes, const char *file, int line) {
     assert(count > 0);
     assert(nbytes > 0);
 
-    ptr = Mem_alloc(count * nbytes, file, line);
+    if (memhook_narenas > 0) {
+        ptr = Memhook_arena_alloc(count * nbytes, file, line);
+        return memset(ptr, '\0', count * nbytes);
+    }
+
+    ptr = chk_alloc(count * nbytes, file, line);
     memset(ptr, '\0', count * nbytes);
+    MEMHOOK_TRACE(MEMTRACE_CALLOC, ptr, NULL, count * nbytes, file, line);
 
     return ptr;
 }
 
 void Mem_log(FILE *stm) {
-    mem_log_stm = stm;
+    mem_log_stm = NULL;
+    Memlog_stop();
+    if (stm != NULL && Memlog_start(stm) == 0) mem_log_stm = stm;
 }
 
-static void logger(const void *ptr, const char *caller, const char *file, int line) {
-    struct descriptor *bp;
-
-    switch (invalid_operaion) {
-        case INVALID_PTR:
-            fprintf(mem_log_stm, "** invalid pointer argument\n");
-            fprintf(mem_log_stm, "%s(%lx) called from %s:%d\n",
-                    caller, (unsigned long)ptr, file, line);
-            break;
-        case FREE_FREED_MEM:
-            bp = hash_table_find(ptr);
-            fprintf(mem_log_stm, "** freeing free memory\n");
-            fprintf(mem_log_stm, "%s(%lx) called from %s:%d\n",
-                    caller, (unsigned long)ptr, file, line);
-            fprintf(mem_log_stm, "This block is %ld bytes and was allocated from %s:%d",
-                    bp->size, bp->file, bp->line);
-            break;
-        case RESIZE_UNALLOC_MEM:
-            bp = hash_table_find(ptr);
-            fprintf(mem_log_stm, "** resizing unallocated memory\n");
-            fprintf(mem_log_stm, "%s(%lx) called from %s:%d\n",
-                    caller, (unsigned long)ptr, file, line);
-            break;
-        default:
-            break;
-    }
+/*
+    block_free:
+        1. Return the allocated block bp to the free blocks of its heap,
+        which is locked, and unlock it.
+*/
+static void block_free(struct descriptor *bp) {
+    struct heap *heap = bp->heap;
 
-    invalid_operaion = VALID_ARG;
+    bin_insert(free_block_merge(bp));
+    UNLOCK(heap->lock);
 }
 
 void *Mem_resize(void *ptr, long nbytes, const char *file, int line) {
-    struct descriptor *bp;
-    void *new_ptr;
+    struct descriptor *bp = NULL, *np = NULL;
+    struct heap *heap;
+    int error = 0;  // MEMLOG_* kind of an invalid call
+    long size;
 
     assert(ptr != NULL);
     assert(nbytes > 0);
 
+    if (memhook_narenas > 0 && Memhook_arena_owns(ptr))
+        return Memhook_arena_resize(ptr, nbytes, file, line);
+
+    MEMHOOK_ADMIT(nbytes, ptr, file, line);
+
     // if (!is_aligned(ptr) || (bp = hash_table_find(ptr)) == NULL || bp->free != NULL)
     //     Except_raise(&assert_failed, file, line);
 
     if (!is_aligned(ptr)) {
-        invalid_operaion = INVALID_PTR;
-    } else if ((bp = hash_table_find(ptr)) == NULL || bp->free != NULL) {
-        invalid_operaion = RESIZE_UNALLOC_MEM;
+        error = MEMLOG_RESIZE_INVALID;
+    } else if ((bp = lock_block(ptr)) == NULL) {
+        error = MEMLOG_RESIZE_UNALLOC;
+    } else if (bp->free) {
+        error = MEMLOG_RESIZE_UNALLOC;
+        UNLOCK(bp->heap->lock);
     }
 
-    if (invalid_operaion != VALID_ARG) {
+    if (error != 0) {
         if (mem_log_stm == NULL)
             Except_raise(&assert_failed, file, line);  // abort
         else {
-            logger(ptr, __func__, file, line);
+            Memlog_put(error, ptr, file, line, 0, NULL, 0);
             return ptr;  // do nothing
         }
     }
 
-    new_ptr = Mem_alloc(nbytes, file, line);
-    memcpy(new_ptr, ptr, (nbytes < bp->size) ? nbytes : bp->size);
-    Mem_free(ptr, file, line);
-
-    return new_ptr;
-}
-
-/*
-    delete: 
-        1. Find the descriptor in mem_block_hash_table ptr and remove it.
-        2. The removed one will be joined into unused list.
-*/
-static void hash_table_delete(const void *ptr) {
-    struct descriptor *bp, *last;
-    last = bp = mem_block_hash_table[hash(ptr)];
-
-    if (bp->ptr == ptr) {
-        mem_block_hash_table[hash(ptr)] = bp->link;
-    } else {
-        bp = bp->link;
-        while (bp != NULL) {
-            if (bp->ptr == ptr) break;
-            last = bp;
-            bp = bp->link;
-        }
-        last->link = bp->link;
+    // in place, in the heap of the block
+    heap = bp->heap;
+    size = bp->size;
+    nbytes = ROUND_UP_TO_ALIGN_BOUND(nbytes);
+    if (nbytes <= bp->size) {
+        // shrink in place, the rest is kept if no descriptor is left for it
+        if (nbytes < bp->size) split(bp, nbytes);
+        np = bp;
+    } else if (grow(bp, nbytes)) {
+        np = bp;
     }
-}
-
-/*
-    free_block_merge:
-        1. Merge freed block neighbouring with p in free_block_list.
-        2. Used in Mem_free().
-        3. Return whether it is merged.
-*/
-static int free_block_merge(struct descriptor *p) {
-    struct descriptor *bp, *last;
-
-    bp = NULL;
-
-    for (last = p->free; last->free == p; last = last->free)
-        if ((last->size + (char *)last->ptr) == p->ptr)
-            bp = last;
-
-    if (bp != NULL) {
-        bp->size += p->size;
-        last->free = p->free;
-        hash_table_delete(p->ptr);
-        return 1;
+    if (np != NULL) {
+        np->file = file;
+        np->line = line;
     }
+    UNLOCK(heap->lock);
+
+    if (np == NULL) {
+        // move to a block of the calling thread with room to double in
+        // place next time
+        if ((heap = heap_get()) != NULL) {
+            LOCK(heap->lock);
+            if ((np = block_alloc(heap, nbytes, 2 * nbytes)) != NULL) {
+                np->file = file;
+                np->line = line;
+            }
+            UNLOCK(heap->lock);
+        }
+        if (np == NULL) {
+            if (file == NULL)
+                RAISE(mem_failed);
+            else
+                Except_raise(&mem_failed, file, line);
+        }
+        memcpy((void *)np->ptr, ptr, size);
+        if ((bp = lock_block(ptr)) != NULL) {
+            MEMHOOK_FREE(ptr);
+            block_free(bp);
+        }
+    } else
+        MEMHOOK_FREE(ptr);
+    MEMHOOK_ALLOC(np->ptr, nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_RESIZE, np->ptr, ptr, nbytes, file, line);
 
-    return 0;
+    return (void *)np->ptr;
 }
 
 void Mem_free(void *ptr, const char *file, int line) {
     if (ptr != NULL) {
-        struct descriptor *bp;
+        struct descriptor *bp = NULL, copy;
+        int error = 0;
+
+        if (memhook_narenas > 0 && Memhook_arena_owns(ptr)) return;
 
         // if (!is_aligned(ptr) || (bp = hash_table_find(ptr)) == NULL || bp->free != NULL)
         //     Except_raise(&assert_failed, file, line);
 
         // It's too strict to raise assert_failed here.
 
-        if (!is_aligned(ptr) || (bp = hash_table_find(ptr)) == NULL) {
-            invalid_operaion = INVALID_PTR;
-        } else if (bp->free != NULL) {
-            invalid_operaion = FREE_FREED_MEM;
+        if (!is_aligned(ptr) || (bp = lock_block(ptr)) == NULL) {
+            error = MEMLOG_FREE_INVALID;
+        } else if (bp->free) {
+            error = MEMLOG_FREE_FREED;
+            copy = *bp;
+            UNLOCK(bp->heap->lock);
         }
 
-        if (invalid_operaion != VALID_ARG) {
+        if (error != 0) {
             if (mem_log_stm == NULL)
                 Except_raise(&assert_failed, file, line);
-            else {
-                logger(ptr, __func__, file, line);
+            else if (error == MEMLOG_FREE_FREED) {
+                Memlog_put(error, ptr, file, line, copy.size, copy.file, copy.line);
                 return;  // remember
+            } else {
+                Memlog_put(error, ptr, file, line, 0, NULL, 0);
+                return;
             }
         }
 
-        if (free_block_merge(bp) == 0) {      // If cannot be merged, insert in free_block_list.
-            bp->free = free_block_list.free;  // head insertion
-            free_block_list.free = bp;
-        }
+        // the hooks go first, the block may be reused once the heap is unlocked
+        MEMHOOK_FREE(ptr);
+        MEMHOOK_TRACE(MEMTRACE_FREE, ptr, NULL, 0, file, line);
+        block_free(bp);
     }
-}
\ No newline at end of file
+}
+
+void Mem_leak(void (*apply)(const void *ptr, long size, const char *file, int line, void *cl),
+              void *cl) {
+    struct descriptor *bp, *arr;
+    unsigned long i, count;
+    long n;
+    int k;
+
+    assert(apply != NULL);
+
+    // apply may allocate and free, so it runs on a copy of the descriptors
+    for (k = 0; k < NSTRIPES; k++) LOCK(stripes[k].lock);
+    for (count = 0, k = 0; k < NSTRIPES; k++) count += stripes[k].count;
+    arr = malloc((count + 1) * sizeof(*arr));
+    for (n = 0, k = 0; arr != NULL && k < NSTRIPES; k++)
+        for (i = 0; i < stripes[k].capacity; i++)
+            for (bp = stripes[k].table[i]; bp != NULL; bp = bp->link)
+                if (!bp->free) arr[n++] = *bp;
+    for (k = 0; k < NSTRIPES; k++) UNLOCK(stripes[k].lock);
+    if (arr == NULL) return;
+
+    while (n-- > 0) apply(arr[n].ptr, arr[n].size, arr[n].file, arr[n].line, cl);
+    free(arr);
+}
@@ -0,0 +1,714 @@
+#include "memhook.h"
+
+#include <stdio.h>   // fprintf() & FILE
+#include <stdlib.h>  // malloc() & free() & qsort()
+#include <string.h>  // memcpy() & strcmp()
+
+#include "algo.h"
+#include "align.h"
+#include "arena.h"
+#include "assert.h"
+#include "except.h"
+#include "mem.h"
+
+// stack of the arenas pushed by the calling thread
+static THREAD_LOCAL struct arena_t *arenas[MEMHOOK_MAX_ARENAS];
+THREAD_LOCAL int memhook_narenas = 0;
+
+// header of a block allocated in an arena
+union arena_block {
+    struct {
+        long size;
+        unsigned long tag;  // BLOCK_TAG of the block
+    } h;
+    union align a;
+};
+
+#define BLOCK_HEADER(ptr) ((union arena_block *)(ptr)-1)
+
+// tells the blocks of an arena from the heap blocks within its bounds;
+// it depends on the address of the block, so stray data hardly matches
+#define BLOCK_TAG(ptr, arena) \
+    ((unsigned long)(ptr) ^ (unsigned long)(arena) ^ (unsigned long)0x9e3779b97f4a7c15ULL)
+
+// reading the word in front of a heap block is fine, but not to ASan
+#if defined(__GNUC__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+/*
+    owner:
+        1. Return the innermost arena on the stack holding ptr, or NULL.
+        2. The bounds of an arena reject the blocks out of it, and the tag
+        the others, so it costs a few compares per pushed arena, whatever
+        the number of chunks.
+*/
+static NO_SANITIZE_ADDRESS struct arena_t *owner(const void *ptr) {
+    const char *p = ptr;
+    struct arena_t *arena;
+    int i;
+
+    for (i = memhook_narenas - 1; i >= 0; i--) {
+        arena = arenas[i];
+        if (p >= arena->lo && p < arena->hi &&
+            BLOCK_HEADER(ptr)->h.tag == BLOCK_TAG(ptr, arena))
+            return arena;
+    }
+    return NULL;
+}
+
+/*
+    stamp:
+        1. Fill the header of ptr, a block of nbytes in arena, and return
+        ptr.
+*/
+static void *stamp(void *ptr, long nbytes, struct arena_t *arena) {
+    BLOCK_HEADER(ptr)->h.size = nbytes;
+    BLOCK_HEADER(ptr)->h.tag = BLOCK_TAG(ptr, arena);
+    return ptr;
+}
+
+void Mem_push_arena(struct arena_t *arena) {
+    assert(arena != NULL);
+    assert(memhook_narenas < MEMHOOK_MAX_ARENAS);
+
+    arenas[memhook_narenas++] = arena;
+}
+
+struct arena_t *Mem_pop_arena(void) {
+    assert(memhook_narenas > 0);
+
+    return arenas[--memhook_narenas];
+}
+
+void *Memhook_arena_alloc(long nbytes, const char *file, int line) {
+    struct arena_t *arena = arenas[memhook_narenas - 1];
+    union arena_block *block;
+
+    assert(nbytes > 0);
+
+    block = Arena_alloc(arena, sizeof(*block) + nbytes, file, line);
+    return stamp(block + 1, nbytes, arena);
+}
+
+void *Memhook_arena_try_alloc(long nbytes) {
+    struct arena_t *arena = arenas[memhook_narenas - 1];
+    union arena_block *block;
+
+    assert(nbytes > 0);
+
+    block = Arena_try_alloc(arena, sizeof(*block) + nbytes);
+    if (block == NULL) return NULL;
+    return stamp(block + 1, nbytes, arena);
+}
+
+void *Memhook_arena_alloc_aligned(long nbytes, long align, const char *file, int line) {
+    struct arena_t *arena = arenas[memhook_narenas - 1];
+    union arena_block *block;
+    char *ptr;
+
+    assert(nbytes > 0);
+    assert(align > 0 && (align & (align - 1)) == 0);
+
+    if (align <= (long)sizeof(*block)) return Memhook_arena_alloc(nbytes, file, line);
+
+    ptr = Arena_alloc(arena, sizeof(*block) + nbytes + align - sizeof(*block), file, line);
+    ptr = (char *)(((unsigned long)ptr + sizeof(*block) + align - 1) & ~(unsigned long)(align - 1));
+    return stamp(ptr, nbytes, arena);
+}
+
+int Memhook_arena_owns(const void *ptr) {
+    return owner(ptr) != NULL;
+}
+
+void *Memhook_arena_resize(void *ptr, long nbytes, const char *file, int line) {
+    struct arena_t *arena;
+    union arena_block *block;
+    long old, new;
+    void *new_ptr;
+
+    assert(nbytes > 0);
+
+    arena = owner(ptr);
+    assert(arena != NULL);
+    block = BLOCK_HEADER(ptr);
+
+    // the last block of the current chunk can move the bump pointer
+    old = ROUND_UP_TO_ALIGN_BOUND(block->h.size);
+    new = ROUND_UP_TO_ALIGN_BOUND(nbytes);
+    if ((char *)ptr + old == arena->avail && new <= arena->limit - (char *)ptr) {
+        arena->avail = (char *)ptr + new;
+        block->h.size = nbytes;
+        return ptr;
+    }
+
+    block = Arena_alloc(arena, sizeof(*block) + nbytes, file, line);
+    new_ptr = stamp(block + 1, nbytes, arena);
+    memcpy(new_ptr, ptr, (nbytes < BLOCK_HEADER(ptr)->h.size) ? nbytes : BLOCK_HEADER(ptr)->h.size);
+    return new_ptr;
+}
+
+// Heap profiler
+
+// buckets of the sample and site tables
+#define SAMPLE_BUCKETS 4096
+#define SITE_BUCKETS 1024
+
+// counters per hashed address, telling at a glance that a freed block
+// can't be sampled
+#define FILTER_SIZE 65536
+
+#if defined(__GNUC__)
+#define LOCK(l) \
+    while (__atomic_test_and_set(&(l), __ATOMIC_ACQUIRE))
+#define UNLOCK(l) __atomic_clear(&(l), __ATOMIC_RELEASE)
+#define ATOMIC_ADD(x, n) __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+#else
+#define LOCK(l)
+#define UNLOCK(l)
+#define ATOMIC_ADD(x, n) ((x) += (n))
+#endif
+
+// allocation site
+struct site {
+    struct site *link;
+    const char *file;
+    int line;
+    double live_bytes;  // estimates, each sample stands for weight bytes
+    double live_blocks;
+    double total_bytes;
+    double total_blocks;
+};
+
+// sampled block still allocated
+struct sample {
+    struct sample *link;
+    const void *ptr;
+    long size;
+    double weight;  // bytes of allocation the sample stands for
+    struct site *site;
+};
+
+long memhook_sample_rate = 0;
+THREAD_LOCAL long memhook_sample_left = 0;
+long memhook_nsampled = 0;
+
+// bumped by Mem_profile; a thread whose countdown is older draws a new
+// one, instead of sampling its first allocation whatever its size
+static long profile_epoch = 0;
+static THREAD_LOCAL long sample_epoch = 0;
+
+static THREAD_LOCAL unsigned long long random_state = 0;
+
+static char profile_lock;
+static struct sample *samples[SAMPLE_BUCKETS];
+static struct site *sites[SITE_BUCKETS];
+static unsigned char filter[FILTER_SIZE];
+
+/*
+    neg_exp & neg_log:
+        1. Return exp(-x) for x >= 0, and -log(u) for 0 < u <= 1.
+        2. Good to a few digits, which is all sampling needs, without
+        pulling the math library into every program using Mem.
+*/
+static double neg_exp(double x) {
+    double y, r;
+    int k;
+
+    if (x > 40.0) return 0.0;
+    // exp(-x) = exp(-x / 2^k)^(2^k)
+    for (k = 0; x > 0.5; k++) x /= 2;
+    y = -x;
+    r = 1 + y * (1 + y / 2 * (1 + y / 3 * (1 + y / 4 * (1 + y / 5))));
+    while (k-- > 0) r *= r;
+    return r;
+}
+
+static double neg_log(double u) {
+    double t, t2, r;
+    int e;
+
+    // u = m * 2^-e with m in [0.5, 1)
+    for (e = 0; u < 0.5; e++) u *= 2;
+    // log(m) = 2 * atanh((m - 1) / (m + 1))
+    t = (u - 1) / (u + 1);
+    t2 = t * t;
+    r = 2 * t * (1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 / 9))));
+    return e * 0.69314718055994531 - r;
+}
+
+/*
+    next_distance:
+        1. Draw the number of bytes before the next sample from the
+        exponential distribution of mean memhook_sample_rate, so that
+        samples form a Poisson process over the allocated bytes.
+*/
+static long next_distance(void) {
+    double u;
+
+    if (random_state == 0)
+        random_state = mix_hash((unsigned long)&random_state) | 1;
+    // xorshift64*
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    u = ((random_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+    return (long)(neg_log(1.0 - u) * memhook_sample_rate) + 1;
+}
+
+static unsigned long filter_slot(const void *ptr) {
+    return (unsigned long)mix_hash((unsigned long)ptr) & (FILTER_SIZE - 1);
+}
+
+/*
+    site_find:
+        1. Return the record of file and line, created if missing, or NULL
+        if there is no memory.
+*/
+static struct site *site_find(const char *file, int line) {
+    struct site *p;
+    unsigned long h;
+
+    if (file == NULL) file = "?";
+    h = ((unsigned long)line * 31 + strlen(file)) % SITE_BUCKETS;
+    for (p = sites[h]; p != NULL; p = p->link)
+        if (p->line == line && (p->file == file || strcmp(p->file, file) == 0))
+            return p;
+    if ((p = calloc(1, sizeof(*p))) == NULL) return NULL;
+    p->file = file;
+    p->line = line;
+    p->link = sites[h];
+    sites[h] = p;
+    return p;
+}
+
+void Mem_profile(long rate) {
+    assert(rate >= 0);
+
+    memhook_sample_rate = rate;
+    ATOMIC_ADD(profile_epoch, 1);
+}
+
+void Memhook_sample(const void *ptr, long nbytes, const char *file, int line) {
+    struct sample *s;
+    struct site *site;
+    unsigned long h;
+    long rate = memhook_sample_rate;
+    long epoch = MEMHOOK_LOAD(profile_epoch);
+
+    if (sample_epoch != epoch) {
+        sample_epoch = epoch;
+        if ((memhook_sample_left = next_distance() - nbytes) >= 0) return;
+    }
+    memhook_sample_left = next_distance();
+    if (rate == 0 || (s = malloc(sizeof(*s))) == NULL) return;
+
+    s->ptr = ptr;
+    s->size = nbytes;
+    // a block of nbytes is sampled with probability 1 - exp(-nbytes / rate)
+    s->weight = nbytes / (1.0 - neg_exp((double)nbytes / rate));
+
+    LOCK(profile_lock);
+    if ((site = site_find(file, line)) == NULL) {
+        UNLOCK(profile_lock);
+        free(s);
+        return;
+    }
+    s->site = site;
+    site->live_bytes += s->weight;
+    site->live_blocks += s->weight / nbytes;
+    site->total_bytes += s->weight;
+    site->total_blocks += s->weight / nbytes;
+    h = (unsigned long)mix_hash((unsigned long)ptr) % SAMPLE_BUCKETS;
+    s->link = samples[h];
+    samples[h] = s;
+    // written under the lock, but Memhook_unsample reads it without
+    if (filter[filter_slot(ptr)] < 255) ATOMIC_ADD(filter[filter_slot(ptr)], 1);
+    ATOMIC_ADD(memhook_nsampled, 1);
+    UNLOCK(profile_lock);
+}
+
+void Memhook_unsample(const void *ptr) {
+    struct sample **pp, **found = NULL, *s;
+
+    if (ptr == NULL || MEMHOOK_LOAD(filter[filter_slot(ptr)]) == 0) return;
+
+    LOCK(profile_lock);
+    // the oldest sample of ptr: a resize forgets the old address after
+    // realloc, when another thread may already have been given it
+    pp = &samples[(unsigned long)mix_hash((unsigned long)ptr) % SAMPLE_BUCKETS];
+    for (; (s = *pp) != NULL; pp = &s->link)
+        if (s->ptr == ptr) found = pp;
+    if (found != NULL) {
+        s = *found;
+        *found = s->link;
+        s->site->live_bytes -= s->weight;
+        s->site->live_blocks -= s->weight / s->size;
+        // a saturated counter stays, it only costs a lookup
+        if (filter[filter_slot(ptr)] < 255) ATOMIC_ADD(filter[filter_slot(ptr)], -1);
+        ATOMIC_ADD(memhook_nsampled, -1);
+        free(s);
+    }
+    UNLOCK(profile_lock);
+}
+
+static int site_cmp(const void *x, const void *y) {
+    const struct site *lhs = *(struct site *const *)x, *rhs = *(struct site *const *)y;
+
+    if (lhs->live_bytes != rhs->live_bytes) return (lhs->live_bytes < rhs->live_bytes) ? 1 : -1;
+    return (lhs->total_bytes < rhs->total_bytes) ? 1 : (lhs->total_bytes > rhs->total_bytes) ? -1 : 0;
+}
+
+void Mem_profile_dump(FILE *fp) {
+    struct site *p, **arr;
+    long n, i;
+
+    assert(fp != NULL);
+
+    LOCK(profile_lock);
+    for (n = 0, i = 0; i < SITE_BUCKETS; i++)
+        for (p = sites[i]; p != NULL; p = p->link) n++;
+    arr = malloc((n + 1) * sizeof(*arr));
+    if (arr == NULL) {
+        UNLOCK(profile_lock);
+        return;
+    }
+    for (n = 0, i = 0; i < SITE_BUCKETS; i++)
+        for (p = sites[i]; p != NULL; p = p->link) arr[n++] = p;
+    qsort(arr, n, sizeof(*arr), site_cmp);
+
+    fprintf(fp, "# heap profile, one sample per %ld bytes\n", memhook_sample_rate);
+    fprintf(fp, "# %12s %12s %14s %12s  site\n",
+            "live bytes", "live blocks", "total bytes", "total blocks");
+    for (i = 0; i < n; i++) {
+        // live counts of freed sites may drift a hair below zero
+        if (arr[i]->live_bytes < 0) arr[i]->live_bytes = arr[i]->live_blocks = 0;
+        fprintf(fp, "  %12.0f %12.0f %14.0f %12.0f  %s:%d\n",
+                arr[i]->live_bytes, arr[i]->live_blocks,
+                arr[i]->total_bytes, arr[i]->total_blocks,
+                arr[i]->file, arr[i]->line);
+    }
+    UNLOCK(profile_lock);
+    free(arr);
+}
+
+void Memhook_leak(void (*apply)(const void *ptr, long size, const char *file, int line, void *cl),
+                  void *cl) {
+    struct sample *s, *arr;
+    long n, i;
+
+    assert(apply != NULL);
+
+    // apply may allocate and free, so it runs on a copy of the samples
+    // without the lock held
+    LOCK(profile_lock);
+    n = MEMHOOK_LOAD(memhook_nsampled);
+    arr = malloc((n + 1) * sizeof(*arr));
+    if (arr == NULL) {
+        UNLOCK(profile_lock);
+        return;
+    }
+    for (n = 0, i = 0; i < SAMPLE_BUCKETS; i++)
+        for (s = samples[i]; s != NULL; s = s->link) arr[n++] = *s;
+    UNLOCK(profile_lock);
+
+    for (i = 0; i < n; i++)
+        apply(arr[i].ptr, arr[i].size, arr[i].site->file, arr[i].site->line, cl);
+    free(arr);
+}
+
+// Budgets
+
+// stripes of the table of charged blocks, and initial buckets of one
+#define CHARGE_STRIPES 64
+#define CHARGE_BUCKETS 256
+
+// records allocated at once by a thread
+#define CHARGE_CHUNK 128
+
+#if defined(__GNUC__)
+#define ATOMIC_ADD_FETCH(x, n) __atomic_add_fetch(&(x), (n), __ATOMIC_RELAXED)
+#define ATOMIC_CAS(x, old, new) \
+    __atomic_compare_exchange_n(&(x), &(old), (new), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+#define ATOMIC_ADD_FETCH(x, n) ((x) += (n))
+#define ATOMIC_CAS(x, old, new) ((x) = (new), 1)
+#endif
+
+struct mem_budget_t {
+    struct mem_budget_t *parent;
+    long soft, hard;  // 0 for no limit
+    long used, peak;
+    void (*over)(struct mem_budget_t *budget, long used, void *cl);
+    void *cl;
+};
+
+// block charged to a budget
+struct charge {
+    struct charge *link;
+    const void *ptr;
+    long size;
+    struct mem_budget_t *budget;
+};
+
+struct charge_stripe {
+    char lock;
+    struct charge **table;
+    long capacity;
+    long count;
+};
+
+// stack of the budgets pushed by the calling thread
+static THREAD_LOCAL struct mem_budget_t *budgets[MEMHOOK_MAX_BUDGETS];
+THREAD_LOCAL int memhook_nbudgets = 0;
+long memhook_ncharged = 0;
+
+static struct charge_stripe charge_stripes[CHARGE_STRIPES];
+
+// free records of the calling thread, whichever thread charged them
+static THREAD_LOCAL struct charge *free_charges = NULL;
+
+// nonzero while the calling thread runs an over callback
+static THREAD_LOCAL int in_over = 0;
+
+struct mem_budget_t *Mem_budget_new(struct mem_budget_t *parent, long soft, long hard,
+                                    void (*over)(struct mem_budget_t *budget, long used, void *cl),
+                                    void *cl) {
+    struct mem_budget_t *budget;
+
+    assert(soft >= 0 && hard >= 0);
+    assert(soft == 0 || hard == 0 || soft <= hard);
+
+    // outside of Mem, so that no arena or budget holds it
+    if ((budget = malloc(sizeof(*budget))) == NULL) RAISE(mem_failed);
+    budget->parent = parent;
+    budget->soft = soft;
+    budget->hard = hard;
+    budget->used = budget->peak = 0;
+    budget->over = over;
+    budget->cl = cl;
+    return budget;
+}
+
+void Mem_budget_free(struct mem_budget_t **budget) {
+    assert(budget != NULL && *budget != NULL);
+    assert(MEMHOOK_LOAD((*budget)->used) == 0);
+
+    free(*budget);
+    *budget = NULL;
+}
+
+long Mem_budget_used(struct mem_budget_t *budget) {
+    assert(budget != NULL);
+
+    return MEMHOOK_LOAD(budget->used);
+}
+
+long Mem_budget_peak(struct mem_budget_t *budget) {
+    assert(budget != NULL);
+
+    return MEMHOOK_LOAD(budget->peak);
+}
+
+void Mem_push_budget(struct mem_budget_t *budget) {
+    assert(budget != NULL);
+    assert(memhook_nbudgets < MEMHOOK_MAX_BUDGETS);
+
+    budgets[memhook_nbudgets++] = budget;
+}
+
+struct mem_budget_t *Mem_pop_budget(void) {
+    assert(memhook_nbudgets > 0);
+
+    return budgets[--memhook_nbudgets];
+}
+
+static inline struct charge_stripe *charge_stripe(unsigned long long h) {
+    return &charge_stripes[h & (CHARGE_STRIPES - 1)];
+}
+
+static inline struct charge **charge_bucket(struct charge_stripe *s, unsigned long long h) {
+    return &s->table[(h / CHARGE_STRIPES) & (s->capacity - 1)];
+}
+
+/*
+    charge_grow:
+        1. Double the buckets of the locked stripe s, or allocate its first
+        ones. Return 0 if there is no memory, the stripe is then unchanged.
+*/
+static int charge_grow(struct charge_stripe *s) {
+    struct charge **table, **old = s->table, *p, *next;
+    long capacity = (old == NULL) ? CHARGE_BUCKETS : 2 * s->capacity, i;
+    unsigned long long h;
+
+    if ((table = calloc(capacity, sizeof(*table))) == NULL) return 0;
+    for (i = 0; i < s->capacity; i++)
+        for (p = old[i]; p != NULL; p = next) {
+            next = p->link;
+            h = mix_hash((unsigned long)p->ptr);
+            p->link = table[(h / CHARGE_STRIPES) & (capacity - 1)];
+            table[(h / CHARGE_STRIPES) & (capacity - 1)] = p;
+        }
+    s->table = table;
+    s->capacity = capacity;
+    free(old);
+    return 1;
+}
+
+static struct charge *charge_new(void) {
+    struct charge *c;
+    int i;
+
+    if (free_charges == NULL) {
+        if ((c = malloc(CHARGE_CHUNK * sizeof(*c))) == NULL) return NULL;
+        for (i = 0; i < CHARGE_CHUNK; i++) {
+            c[i].link = free_charges;
+            free_charges = &c[i];
+        }
+    }
+    c = free_charges;
+    free_charges = c->link;
+    return c;
+}
+
+/*
+    charge_find:
+        1. Return the size of the charged block ptr and store its budget in
+        *budget, or return 0 if ptr is not charged.
+*/
+static long charge_find(const void *ptr, struct mem_budget_t **budget) {
+    unsigned long long h = mix_hash((unsigned long)ptr);
+    struct charge_stripe *s = charge_stripe(h);
+    struct charge *c;
+    long size = 0;
+
+    LOCK(s->lock);
+    if (s->table != NULL)
+        for (c = *charge_bucket(s, h); c != NULL; c = c->link)
+            if (c->ptr == ptr) {
+                size = c->size;
+                *budget = c->budget;
+                break;
+            }
+    UNLOCK(s->lock);
+    return size;
+}
+
+/*
+    within:
+        1. Return 1, if budget is b or one of the budgets b is part of.
+*/
+static int within(struct mem_budget_t *b, struct mem_budget_t *budget) {
+    for (; b != NULL; b = b->parent)
+        if (b == budget) return 1;
+    return 0;
+}
+
+/*
+    over_hard:
+        1. Return the first budget of the chain of top that nbytes more
+        would take past its hard limit, credit bytes of a block of old
+        being given back, or NULL.
+*/
+static struct mem_budget_t *over_hard(struct mem_budget_t *top, long nbytes,
+                                      struct mem_budget_t *old, long credit) {
+    struct mem_budget_t *b;
+
+    for (b = top; b != NULL; b = b->parent)
+        if (b->hard > 0 &&
+            MEMHOOK_LOAD(b->used) + nbytes - (within(old, b) ? credit : 0) > b->hard)
+            return b;
+    return NULL;
+}
+
+int Memhook_admit(long nbytes, const void *old) {
+    struct mem_budget_t *top = budgets[memhook_nbudgets - 1], *b, *owner = NULL;
+    long credit = 0;
+
+    if ((b = over_hard(top, nbytes, NULL, 0)) == NULL) return 1;
+    if (old != NULL && MEMHOOK_LOAD(memhook_ncharged) > 0)
+        credit = charge_find(old, &owner);
+
+    // the callback may evict enough to let the block in
+    if ((b = over_hard(top, nbytes, owner, credit)) != NULL && b->over != NULL && !in_over) {
+        in_over = 1;
+        b->over(b, MEMHOOK_LOAD(b->used) + nbytes, b->cl);
+        in_over = 0;
+        b = over_hard(top, nbytes, owner, credit);
+    }
+    return b == NULL;
+}
+
+void Memhook_charge(const void *ptr, long nbytes) {
+    struct mem_budget_t *top = budgets[memhook_nbudgets - 1], *b;
+    struct mem_budget_t *crossed[MEMHOOK_MAX_BUDGETS];
+    unsigned long long h = mix_hash((unsigned long)ptr);
+    struct charge_stripe *s = charge_stripe(h);
+    struct charge *c, **pp;
+    long used, peak;
+    int n = 0, i;
+
+    // a block that can't be recorded is left out of the budget
+    if ((c = charge_new()) == NULL) return;
+    c->ptr = ptr;
+    c->size = nbytes;
+    c->budget = top;
+    LOCK(s->lock);
+    if ((s->table == NULL || s->count > 2 * s->capacity) && !charge_grow(s) && s->table == NULL) {
+        UNLOCK(s->lock);
+        c->link = free_charges;
+        free_charges = c;
+        return;
+    }
+    pp = charge_bucket(s, h);
+    c->link = *pp;
+    *pp = c;
+    s->count++;
+    UNLOCK(s->lock);
+    ATOMIC_ADD(memhook_ncharged, 1);
+
+    for (b = top; b != NULL; b = b->parent) {
+        used = ATOMIC_ADD_FETCH(b->used, nbytes);
+        peak = MEMHOOK_LOAD(b->peak);
+        while (used > peak && !ATOMIC_CAS(b->peak, peak, used))
+            ;
+        if (b->soft > 0 && used > b->soft && used - nbytes <= b->soft &&
+            b->over != NULL && n < MEMHOOK_MAX_BUDGETS)
+            crossed[n++] = b;
+    }
+
+    // the callbacks run once the block is charged, without a lock held
+    if (n > 0 && !in_over) {
+        in_over = 1;
+        for (i = 0; i < n; i++)
+            crossed[i]->over(crossed[i], MEMHOOK_LOAD(crossed[i]->used), crossed[i]->cl);
+        in_over = 0;
+    }
+}
+
+void Memhook_uncharge(const void *ptr) {
+    unsigned long long h = mix_hash((unsigned long)ptr);
+    struct charge_stripe *s = charge_stripe(h);
+    struct charge **pp, **found = NULL, *c = NULL;
+    struct mem_budget_t *b;
+
+    LOCK(s->lock);
+    // the oldest charge of ptr, as for Memhook_unsample
+    if (s->table != NULL)
+        for (pp = charge_bucket(s, h); (c = *pp) != NULL; pp = &c->link)
+            if (c->ptr == ptr) found = pp;
+    if (found != NULL) {
+        c = *found;
+        *found = c->link;
+        s->count--;
+    }
+    UNLOCK(s->lock);
+    if (c == NULL) return;
+
+    ATOMIC_ADD(memhook_ncharged, -1);
+    for (b = c->budget; b != NULL; b = b->parent) ATOMIC_ADD(b->used, -c->size);
+    c->link = free_charges;
+    free_charges = c;
+}
@@ -0,0 +1,395 @@
+#define _DEFAULT_SOURCE  // clock_gettime() & nanosleep() with -std=c99
+
+#include "memlog.h"
+
+#include <pthread.h>  // pthread_create() & pthread_join()
+#include <stdlib.h>   // calloc() & malloc() & free() & atexit()
+#include <string.h>   // memcmp() & memcpy() & strlen()
+#include <time.h>     // clock_gettime() & nanosleep()
+
+#include "assert.h"
+#include "mem.h"
+#include "memhook.h"
+
+/*
+    Each logging thread owns a ring of LOG_SLOTS records. It is the only
+    one moving head, and the draining thread the only one moving tail, so
+    the ring needs no lock: a record is filled before head passes it, and
+    read before tail does. Rings are never freed, a thread may exit with
+    records not written out yet.
+*/
+
+// records in the ring of a thread
+#define LOG_SLOTS 1024
+
+// nanoseconds the draining thread sleeps when the rings are empty
+#define DRAIN_PERIOD 1000000
+
+// buckets of the table of file names already written
+#define NAME_BUCKETS 256
+
+// ids above it are written as 0, no file
+#define MAX_NAME_ID 65535
+
+#if defined(__GNUC__)
+#define ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define LOCK(l) \
+    while (__atomic_test_and_set(&(l), __ATOMIC_ACQUIRE))
+#define UNLOCK(l) __atomic_clear(&(l), __ATOMIC_RELEASE)
+#else
+#define ATOMIC_LOAD(x) (x)
+#define ATOMIC_STORE(x, v) ((x) = (v))
+#define LOCK(l)
+#define UNLOCK(l)
+#endif
+
+struct slot {
+    unsigned long long time;
+    const void *ptr;
+    const char *file;
+    const char *alloc_file;
+    long size;
+    int kind;
+    int line;
+    int alloc_line;
+};
+
+struct ring {
+    struct ring *link;
+    unsigned thread;
+    unsigned long head;      // records appended, moved by the owner
+    unsigned long tail;      // records written out, moved by the drainer
+    unsigned long lost;      // records dropped, moved by the owner
+    unsigned long reported;  // drops written out, moved by the drainer
+    struct slot slots[LOG_SLOTS];
+};
+
+// file name written to the log
+struct name {
+    struct name *link;
+    const char *file;
+    int id;
+};
+
+static struct ring *rings;  // all rings, newest first
+static char rings_lock;
+static unsigned nthreads;
+static THREAD_LOCAL struct ring *my_ring = NULL;
+
+static int logging;
+static int stopping;
+static pthread_t drainer;
+static struct timespec log_start;
+
+// touched only by the draining thread, or by Memlog_stop once it is gone
+static FILE *log_stm;
+static struct name *names[NAME_BUCKETS];
+static int nnames;
+
+// Writer
+
+static unsigned char *put_le(unsigned char *p, unsigned long long x, int nbytes) {
+    while (nbytes-- > 0) {
+        *p++ = (unsigned char)(x & 0xFF);
+        x >>= 8;
+    }
+    return p;
+}
+
+/*
+    name_id:
+        1. Return the id of file in the log, writing its MEMLOG_FILE record
+        the first time it is seen. Names are told apart by address.
+*/
+static int name_id(const char *file) {
+    unsigned char buf[5], *p;
+    struct name *np;
+    unsigned long h;
+    size_t len;
+
+    if (file == NULL) return 0;
+    h = ((unsigned long)file >> 3) % NAME_BUCKETS;
+    for (np = names[h]; np != NULL; np = np->link)
+        if (np->file == file) return np->id;
+    if (nnames == MAX_NAME_ID || (np = malloc(sizeof(*np))) == NULL) return 0;
+    np->file = file;
+    np->id = ++nnames;
+    np->link = names[h];
+    names[h] = np;
+
+    if ((len = strlen(file)) > 0xFFFF) len = 0xFFFF;
+    p = put_le(buf, MEMLOG_FILE, 1);
+    p = put_le(p, np->id, 2);
+    p = put_le(p, len, 2);
+    fwrite(buf, 1, p - buf, log_stm);
+    fwrite(file, 1, len, log_stm);
+    return np->id;
+}
+
+static void encode(unsigned thread, const struct slot *s) {
+    unsigned char buf[41], *p;
+    int file, alloc_file;
+
+    file = name_id(s->file);
+    alloc_file = name_id(s->alloc_file);
+    p = put_le(buf, s->kind, 1);
+    p = put_le(p, thread, 4);
+    p = put_le(p, s->time, 8);
+    p = put_le(p, (unsigned long)s->ptr, 8);
+    p = put_le(p, file, 2);
+    p = put_le(p, (unsigned)s->line, 4);
+    p = put_le(p, s->size, 8);
+    p = put_le(p, alloc_file, 2);
+    p = put_le(p, (unsigned)s->alloc_line, 4);
+    fwrite(buf, 1, p - buf, log_stm);
+}
+
+/*
+    drain:
+        1. Write out the records of every ring, and return how many.
+*/
+static long drain(void) {
+    struct ring *r;
+    struct slot lost = {0, NULL, NULL, NULL, 0, MEMLOG_LOST, 0, 0};
+    struct timespec now;
+    unsigned long head, n;
+    long count = 0;
+
+    for (r = ATOMIC_LOAD(rings); r != NULL; r = r->link) {
+        head = ATOMIC_LOAD(r->head);
+        count += head - r->tail;
+        // the owner may reuse a slot once tail is past it
+        for (n = r->tail; n != head; n++) encode(r->thread, &r->slots[n % LOG_SLOTS]);
+        ATOMIC_STORE(r->tail, head);
+        if ((n = ATOMIC_LOAD(r->lost)) != r->reported) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            lost.time = (unsigned long long)(now.tv_sec - log_start.tv_sec) * 1000000000ULL +
+                        now.tv_nsec - log_start.tv_nsec;
+            lost.size = n - r->reported;
+            encode(r->thread, &lost);
+            r->reported = n;
+            count++;
+        }
+    }
+    if (count > 0) fflush(log_stm);
+    return count;
+}
+
+static void *drain_loop(void *cl) {
+    struct timespec period = {0, DRAIN_PERIOD};
+
+    (void)cl;
+    while (!ATOMIC_LOAD(stopping))
+        if (drain() == 0) nanosleep(&period, NULL);
+    return NULL;
+}
+
+void Memlog_put(int kind, const void *ptr, const char *file, int line,
+                long size, const char *alloc_file, int alloc_line) {
+    struct timespec now;
+    struct ring *r = my_ring;
+    struct slot *s;
+
+    if (r == NULL) {
+        if ((r = calloc(1, sizeof(*r))) == NULL) return;
+        LOCK(rings_lock);
+        r->thread = ++nthreads;
+        r->link = rings;
+        ATOMIC_STORE(rings, r);
+        UNLOCK(rings_lock);
+        my_ring = r;
+    }
+    if (r->head - ATOMIC_LOAD(r->tail) == LOG_SLOTS) {
+        ATOMIC_STORE(r->lost, r->lost + 1);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    s = &r->slots[r->head % LOG_SLOTS];
+    s->time = (unsigned long long)(now.tv_sec - log_start.tv_sec) * 1000000000ULL +
+              now.tv_nsec - log_start.tv_nsec;
+    s->kind = kind;
+    s->ptr = ptr;
+    s->file = file;
+    s->line = line;
+    s->size = size;
+    s->alloc_file = alloc_file;
+    s->alloc_line = alloc_line;
+    ATOMIC_STORE(r->head, r->head + 1);
+}
+
+int Memlog_start(FILE *stm) {
+    static int registered = 0;
+
+    assert(stm != NULL);
+    assert(!logging);
+
+    if (fwrite(MEMLOG_MAGIC, 1, 8, stm) != 8) return -1;
+    if (!registered) registered = (atexit(Memlog_stop) == 0);
+
+    log_stm = stm;
+    nnames = 0;
+    clock_gettime(CLOCK_MONOTONIC, &log_start);
+    ATOMIC_STORE(stopping, 0);
+    if (pthread_create(&drainer, NULL, drain_loop, NULL) != 0) return -1;
+    logging = 1;
+    return 0;
+}
+
+void Memlog_stop(void) {
+    struct name *np;
+    int i;
+
+    if (!logging) return;
+    ATOMIC_STORE(stopping, 1);
+    pthread_join(drainer, NULL);
+    drain();
+    fflush(log_stm);
+    log_stm = NULL;
+    logging = 0;
+    for (i = 0; i < NAME_BUCKETS; i++)
+        while ((np = names[i]) != NULL) {
+            names[i] = np->link;
+            free(np);
+        }
+}
+
+// Reader
+
+struct memlog_t {
+    FILE *fp;
+    int nfiles;
+    int capacity;
+    char **files;  // name of file id i + 1
+};
+
+static int read_le(FILE *fp, int nbytes, unsigned long long *x) {
+    int c, i;
+
+    *x = 0;
+    for (i = 0; i < nbytes; i++) {
+        if ((c = getc(fp)) == EOF) return 0;
+        *x |= (unsigned long long)c << (8 * i);
+    }
+    return 1;
+}
+
+struct memlog_t *Memlog_open(FILE *fp) {
+    struct memlog_t *log;
+    char magic[8];
+
+    assert(fp != NULL);
+
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, MEMLOG_MAGIC, 8) != 0)
+        return NULL;
+
+    NEW(log);
+    log->fp = fp;
+    log->nfiles = 0;
+    log->capacity = 0;
+    log->files = NULL;
+    return log;
+}
+
+static int read_file(struct memlog_t *log) {
+    unsigned long long id, len;
+    char *name;
+
+    if (!read_le(log->fp, 2, &id) || !read_le(log->fp, 2, &len)) return 0;
+    if (id != (unsigned long long)log->nfiles + 1) return 0;
+
+    name = ALLOC(len + 1);
+    if (fread(name, 1, len, log->fp) != len) {
+        FREE(name);
+        return 0;
+    }
+    name[len] = '\0';
+
+    if (log->nfiles == log->capacity) {
+        log->capacity = (log->capacity == 0) ? 64 : 2 * log->capacity;
+        if (log->files == NULL)
+            log->files = ALLOC(log->capacity * sizeof(log->files[0]));
+        else
+            RESIZE(log->files, log->capacity * sizeof(log->files[0]));
+    }
+    log->files[log->nfiles++] = name;
+    return 1;
+}
+
+int Memlog_read(struct memlog_t *log, struct memlog_event_t *ev) {
+    unsigned long long thread, file, line, size, alloc_file, alloc_line;
+    FILE *fp;
+    int kind;
+
+    assert(log != NULL);
+    assert(ev != NULL);
+
+    fp = log->fp;
+    while ((kind = getc(fp)) == MEMLOG_FILE)
+        if (!read_file(log)) return -1;
+    if (kind == EOF) return 0;
+    if (kind < MEMLOG_FREE_INVALID || kind > MEMLOG_LOST) return -1;
+
+    if (!read_le(fp, 4, &thread) || !read_le(fp, 8, &ev->time) ||
+        !read_le(fp, 8, &ev->ptr) || !read_le(fp, 2, &file) ||
+        !read_le(fp, 4, &line) || !read_le(fp, 8, &size) ||
+        !read_le(fp, 2, &alloc_file) || !read_le(fp, 4, &alloc_line))
+        return -1;
+    if (file > (unsigned long long)log->nfiles || alloc_file > (unsigned long long)log->nfiles)
+        return -1;
+    ev->kind = kind;
+    ev->thread = (unsigned)thread;
+    ev->file = (file == 0) ? NULL : log->files[file - 1];
+    ev->line = (int)line;
+    ev->size = (long)size;
+    ev->alloc_file = (alloc_file == 0) ? NULL : log->files[alloc_file - 1];
+    ev->alloc_line = (int)alloc_line;
+    return 1;
+}
+
+void Memlog_render(const struct memlog_event_t *ev, FILE *fp) {
+    const char *file;
+
+    assert(ev != NULL);
+    assert(fp != NULL);
+
+    file = (ev->file == NULL) ? "?" : ev->file;
+
+    fprintf(fp, "[thread %u, %.6f s] ", ev->thread, ev->time * 1e-9);
+    switch (ev->kind) {
+        case MEMLOG_FREE_INVALID:
+        case MEMLOG_RESIZE_INVALID:
+            fprintf(fp, "** invalid pointer argument\n");
+            fprintf(fp, "%s(%llx) called from %s:%d\n",
+                    (ev->kind == MEMLOG_FREE_INVALID) ? "Mem_free" : "Mem_resize",
+                    ev->ptr, file, ev->line);
+            break;
+        case MEMLOG_FREE_FREED:
+            fprintf(fp, "** freeing free memory\n");
+            fprintf(fp, "Mem_free(%llx) called from %s:%d\n", ev->ptr, file, ev->line);
+            fprintf(fp, "This block is %ld bytes and was allocated from %s:%d\n",
+                    ev->size, (ev->alloc_file == NULL) ? "?" : ev->alloc_file, ev->alloc_line);
+            break;
+        case MEMLOG_RESIZE_UNALLOC:
+            fprintf(fp, "** resizing unallocated memory\n");
+            fprintf(fp, "Mem_resize(%llx) called from %s:%d\n", ev->ptr, file, ev->line);
+            break;
+        case MEMLOG_LOST:
+            fprintf(fp, "** %ld events lost, the log fell behind\n", ev->size);
+            break;
+        default:
+            break;
+    }
+}
+
+void Memlog_close(struct memlog_t **log) {
+    int i;
+
+    assert(log != NULL);
+    assert(*log != NULL);
+
+    for (i = 0; i < (*log)->nfiles; i++) FREE((*log)->files[i]);
+    FREE((*log)->files);
+    FREE(*log);
+}
@@ -0,0 +1,442 @@
+/*
+    Pool Implementation
+    In the pool implementation, small blocks are served from slabs of
+    blocks of the same size class, and larger ones from the standard
+    library. Each thread keeps a list of free blocks per size class, so
+    the common allocation and deallocation is a pop or a push on that
+    list, without lock and without header in front of the block. Lists
+    that run dry or grow too long exchange blocks in batches with the
+    central list of their class, under a spin lock.
+
+    A slab is 64 KB and aligned on 64 KB, and a two-level page map gives
+    the size class of the slab holding an address, or 0 if the address
+    doesn't belong to a slab and so came from malloc().
+
+    Like memchk.c, it is selected by linking its object file before the
+    library.
+*/
+
+#define _DEFAULT_SOURCE  // posix_memalign() with -std=c99
+
+#include "mem.h"
+
+#include <stdlib.h>  // malloc() & free() & posix_memalign()
+#include <string.h>  // memcpy() & memset()
+
+#include "align.h"
+#include "assert.h"
+#include "except.h"
+#include "memhook.h"
+#include "memtrace.h"
+
+// blocks up to POOL_MAX_SMALL bytes come from slabs, in classes of
+// POOL_CLASS_BYTES apart
+#define POOL_CLASS_BYTES 16
+#define POOL_MAX_SMALL 512
+#define POOL_NCLASSES (POOL_MAX_SMALL / POOL_CLASS_BYTES)
+
+#define SLAB_SHIFT 16
+#define SLAB_SIZE (1L << SLAB_SHIFT)
+
+// blocks moved at once between a thread list and the central list,
+// and bound on the length of a thread list
+#define POOL_BATCH 32
+#define POOL_CACHE_MAX (2 * POOL_BATCH)
+
+// page map, indexed by the slab number of an address
+#define PAGEMAP_BITS 16
+#define PAGEMAP_SIZE (1L << PAGEMAP_BITS)
+
+#define CLASS_OF(nbytes) (((nbytes) + POOL_CLASS_BYTES - 1) / POOL_CLASS_BYTES - 1)
+#define CLASS_SIZE(c) (((c) + 1) * POOL_CLASS_BYTES)
+
+#if defined(__GNUC__)
+#define LOCK(l) \
+    while (__atomic_test_and_set(&(l), __ATOMIC_ACQUIRE))
+#define UNLOCK(l) __atomic_clear(&(l), __ATOMIC_RELEASE)
+#define LOAD_PTR(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define STORE_PTR(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else
+#define LOCK(l)
+#define UNLOCK(l)
+#define LOAD_PTR(p) (p)
+#define STORE_PTR(p, v) ((p) = (v))
+#endif
+
+// free block, linked through its first word
+struct block {
+    struct block *next;
+};
+
+// free blocks of a size class on the calling thread
+struct cache {
+    struct block *head;
+    int n;
+};
+
+// free blocks of a size class shared by all threads
+struct central {
+    char lock;
+    struct block *head;
+    char *avail;  // unused part of the last slab
+    char *limit;
+};
+
+const struct except_t mem_failed = {"Allocation Failed"};
+
+static THREAD_LOCAL struct cache caches[POOL_NCLASSES];
+static struct central centrals[POOL_NCLASSES];
+
+// size class + 1 of each slab, the leaves are allocated on demand
+static unsigned char *pagemap[PAGEMAP_SIZE];
+static char pagemap_lock;
+
+/*
+    slab_class:
+        1. Return the size class + 1 of the slab holding ptr, or 0.
+*/
+static inline int slab_class(const void *ptr) {
+    unsigned long n = (unsigned long)ptr >> SLAB_SHIFT;
+    unsigned char *leaf;
+
+    if ((n >> PAGEMAP_BITS) >= PAGEMAP_SIZE) return 0;
+    leaf = LOAD_PTR(pagemap[n >> PAGEMAP_BITS]);
+    return (leaf == NULL) ? 0 : leaf[n & (PAGEMAP_SIZE - 1)];
+}
+
+/*
+    slab_new:
+        1. Allocate a slab for size class c, record it in the page map and
+        return it, or return NULL if there is no memory.
+*/
+static char *slab_new(int c) {
+    void *slab;
+    unsigned long n;
+    unsigned char *leaf;
+
+    if (posix_memalign(&slab, SLAB_SIZE, SLAB_SIZE) != 0) return NULL;
+    n = (unsigned long)slab >> SLAB_SHIFT;
+    assert((n >> PAGEMAP_BITS) < PAGEMAP_SIZE);
+
+    LOCK(pagemap_lock);
+    leaf = pagemap[n >> PAGEMAP_BITS];
+    if (leaf == NULL) {
+        leaf = calloc(PAGEMAP_SIZE, sizeof(*leaf));
+        if (leaf == NULL) {
+            UNLOCK(pagemap_lock);
+            free(slab);
+            return NULL;
+        }
+        STORE_PTR(pagemap[n >> PAGEMAP_BITS], leaf);
+    }
+    leaf[n & (PAGEMAP_SIZE - 1)] = (unsigned char)(c + 1);
+    UNLOCK(pagemap_lock);
+
+    return slab;
+}
+
+/*
+    refill:
+        1. Move up to POOL_BATCH free blocks of class c from the central
+        list, or from new slabs, into the list of the calling thread.
+        2. Return 0 if there is no memory, otherwise 1.
+*/
+static int refill(int c) {
+    struct central *central = &centrals[c];
+    struct cache *cache = &caches[c];
+    struct block *b;
+    long size = CLASS_SIZE(c);
+
+    LOCK(central->lock);
+    while (cache->n < POOL_BATCH && central->head != NULL) {
+        b = central->head;
+        central->head = b->next;
+        b->next = cache->head;
+        cache->head = b;
+        cache->n++;
+    }
+    while (cache->n < POOL_BATCH) {
+        if (central->limit - central->avail < size) {
+            if ((central->avail = slab_new(c)) == NULL) {
+                central->limit = NULL;
+                break;
+            }
+            central->limit = central->avail + SLAB_SIZE;
+        }
+        b = (struct block *)central->avail;
+        central->avail += size;
+        b->next = cache->head;
+        cache->head = b;
+        cache->n++;
+    }
+    UNLOCK(central->lock);
+
+    return cache->n > 0;
+}
+
+/*
+    release:
+        1. Move POOL_BATCH blocks of class c from the list of the calling
+        thread to the central list.
+*/
+static void release(int c) {
+    struct central *central = &centrals[c];
+    struct cache *cache = &caches[c];
+    struct block *first, *last;
+    int i;
+
+    first = last = cache->head;
+    for (i = 1; i < POOL_BATCH; i++) last = last->next;
+    cache->head = last->next;
+    cache->n -= POOL_BATCH;
+
+    LOCK(central->lock);
+    last->next = central->head;
+    central->head = first;
+    UNLOCK(central->lock);
+}
+
+/*
+    pool_alloc & pool_free:
+        1. Allocate or free a block as Mem_alloc and Mem_free do outside
+        an arena, hooks included, but leave the call out of the trace, for
+        the Mem_* functions built on them, which trace themselves.
+*/
+static inline void *pool_alloc(long nbytes, const char *file, int line) {
+    struct cache *cache;
+    struct block *b;
+    void *ptr;
+    int c;
+
+    MEMHOOK_ADMIT(nbytes, NULL, file, line);
+    if (nbytes <= POOL_MAX_SMALL) {
+        c = CLASS_OF(nbytes);
+        cache = &caches[c];
+        if (cache->head != NULL || refill(c)) {
+            b = cache->head;
+            cache->head = b->next;
+            cache->n--;
+            MEMHOOK_ALLOC(b, nbytes, file, line);
+            return b;
+        }
+        ptr = NULL;
+    } else
+        ptr = malloc(nbytes);
+
+    if (ptr == NULL) {
+        if (file == NULL)
+            RAISE(mem_failed);
+        else
+            Except_raise(&mem_failed, file, line);
+    }
+    MEMHOOK_ALLOC(ptr, nbytes, file, line);
+
+    return ptr;
+}
+
+static inline void pool_free(void *ptr) {
+    struct cache *cache;
+    struct block *b;
+    int c;
+
+    MEMHOOK_FREE(ptr);
+    if ((c = slab_class(ptr)) == 0) {
+        free(ptr);
+        return;
+    }
+    cache = &caches[c - 1];
+    b = ptr;
+    b->next = cache->head;
+    cache->head = b;
+    if (++cache->n > POOL_CACHE_MAX) release(c - 1);
+}
+
+void *Mem_alloc(long nbytes, const char *file, int line) {
+    void *ptr;
+
+    assert(nbytes > 0);
+
+    if (memhook_narenas > 0) return Memhook_arena_alloc(nbytes, file, line);
+
+    ptr = pool_alloc(nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_ALLOC, ptr, NULL, nbytes, file, line);
+
+    return ptr;
+}
+
+void *Mem_try_alloc(long nbytes, const char *file, int line) {
+    struct cache *cache;
+    void *ptr;
+    int c;
+
+    assert(nbytes > 0);
+
+    if (memhook_narenas > 0) return Memhook_arena_try_alloc(nbytes);
+
+    if (memhook_nbudgets > 0 && !Memhook_admit(nbytes, NULL)) return NULL;
+    if (nbytes <= POOL_MAX_SMALL) {
+        c = CLASS_OF(nbytes);
+        cache = &caches[c];
+        if (cache->head == NULL && !refill(c)) return NULL;
+        ptr = cache->head;
+        cache->head = cache->head->next;
+        cache->n--;
+    } else if ((ptr = malloc(nbytes)) == NULL)
+        return NULL;
+    MEMHOOK_ALLOC(ptr, nbytes, file, line);
+    MEMHOOK_TRACE(MEMTRACE_ALLOC, ptr, NULL, nbytes, file, line);
+
+    return ptr;
+}
+
+void *Mem_alloc_aligned(long nbytes, long align, const char *file, int line) {
+    void *ptr;
+    long size;
+
+    assert(nbytes > 0);
+    assert(align > 0 && (align & (align - 1)) == 0);
+
+    if (memhook_narenas > 0) return Memhook_arena_alloc_aligned(nbytes, align, file, line);
+    if (align <= POOL_CLASS_BYTES) return Mem_alloc(nbytes, file, line);
+
+    // slabs are aligned on SLAB_SIZE and cut in blocks of the class size,
+    // so the blocks of a class that is a multiple of align are aligned
+    size = ROUND_UP(nbytes, align);
+    if (size <= POOL_MAX_SMALL) return Mem_alloc(size, file, line);
+
+    // the rounded size, so that Mem_resize finds the block larger than
+    // any class, as every block of malloc()
+    MEMHOOK_ADMIT(size, NULL, file, line);
+    if (posix_memalign(&ptr, align, size) != 0) {
+        if (file == NULL)
+            RAISE(mem_failed);
+        else
+            Except_raise(&mem_failed, file, line);
+    }
+    MEMHOOK_ALLOC(ptr, size, file, line);
+    MEMHOOK_TRACE(MEMTRACE_ALLOC, ptr, NULL, size, file, line);
+
+    return ptr;
+}
+
+void Mem_alloc_batch(long n, long nbytes, void **ptrs, const char *file, int line) {
+    struct cache *cache;
+    struct block *b;
+    long i;
+    int c;
+
+    assert(n >= 0);
+    assert(nbytes > 0);
+    assert(ptrs != NULL || n == 0);
+
+    if (memhook_narenas > 0) {
+        for (i = 0; i < n; i++) ptrs[i] = Memhook_arena_alloc(nbytes, file, line);
+        return;
+    }
+
+    MEMHOOK_ADMIT(n * nbytes, NULL, file, line);
+    if (nbytes <= POOL_MAX_SMALL) {
+        c = CLASS_OF(nbytes);
+        cache = &caches[c];
+        for (i = 0; i < n; i++) {
+            if (cache->head == NULL && !refill(c)) break;
+            b = cache->head;
+            cache->head = b->next;
+            cache->n--;
+            ptrs[i] = b;
+        }
+    } else {
+        for (i = 0; i < n; i++)
+            if ((ptrs[i] = malloc(nbytes)) == NULL) break;
+    }
+
+    if (i < n) {
+        // the blocks were not seen by the hooks yet
+        while (i-- > 0) pool_free(ptrs[i]);
+        if (file == NULL)
+            RAISE(mem_failed);
+        else
+            Except_raise(&mem_failed, file, line);
+    }
+    for (i = 0; i < n; i++) {
+        MEMHOOK_ALLOC(ptrs[i], nbytes, file, line);
+        MEMHOOK_TRACE(MEMTRACE_ALLOC, ptrs[i], NULL, nbytes, file, line);
+    }
+}
+
+void *Mem_calloc(long count, long nbytes, const char *file, int line) {
+    void *ptr;
+
+    assert(count > 0);
+    assert(nbytes > 0);
+
+    if (memhook_narenas > 0) {
+        ptr = Memhook_arena_alloc(count * nbytes, file, line);
+        return memset(ptr, 0, count * nbytes);
+    }
+
+    ptr = pool_alloc(count * nbytes, file, line);
+    memset(ptr, 0, count * nbytes);
+    MEMHOOK_TRACE(MEMTRACE_CALLOC, ptr, NULL, count * nbytes, file, line);
+
+    return ptr;
+}
+
+void Mem_free(void *ptr, const char *file, int line) {
+    if (ptr == NULL) return;
+    if (memhook_narenas > 0 && Memhook_arena_owns(ptr)) return;
+    MEMHOOK_TRACE(MEMTRACE_FREE, ptr, NULL, 0, file, line);
+    pool_free(ptr);
+}
+
+void *Mem_resize(void *ptr, long nbytes, const char *file, int line) {
+    unsigned long old = (unsigned long)ptr;  // id of the block in a trace
+    void *new_ptr;
+    long size;
+    int c;
+
+    assert(ptr != NULL);
+    assert(nbytes > 0);
+
+    if (memhook_narenas > 0 && Memhook_arena_owns(ptr))
+        return Memhook_arena_resize(ptr, nbytes, file, line);
+
+    if ((c = slab_class(ptr)) == 0 && nbytes > POOL_MAX_SMALL) {
+        MEMHOOK_ADMIT(nbytes, ptr, file, line);
+        new_ptr = realloc(ptr, nbytes);
+        if (new_ptr == NULL) {
+            if (file == NULL)
+                RAISE(mem_failed);
+            else
+                Except_raise(&mem_failed, file, line);
+        }
+        // the caller keeps ptr if realloc fails, so it is forgotten only
+        // now, by its address
+        MEMHOOK_FREE((void *)old);
+        MEMHOOK_ALLOC(new_ptr, nbytes, file, line);
+        MEMHOOK_TRACE(MEMTRACE_RESIZE, new_ptr, (void *)old, nbytes, file, line);
+        return new_ptr;
+    }
+
+    // a small block that still fits its class stays where it is
+    if (c > 0) {
+        size = CLASS_SIZE(c - 1);
+        if (nbytes <= size) {
+            MEMHOOK_TRACE(MEMTRACE_RESIZE, ptr, ptr, nbytes, file, line);
+            return ptr;
+        }
+    } else
+        size = nbytes;  // a malloc'd block is larger than any class
+
+    // a heap block stays on the heap, even with an arena pushed
+    new_ptr = pool_alloc(nbytes, file, line);
+    memcpy(new_ptr, ptr, (nbytes < size) ? nbytes : size);
+    pool_free(ptr);
+    MEMHOOK_TRACE(MEMTRACE_RESIZE, new_ptr, (void *)old, nbytes, file, line);
+    return new_ptr;
+}
+
+void Mem_leak(void (*apply)(const void *ptr, long size, const char *file, int line, void *cl),
+              void *cl) {
+    Memhook_leak(apply, cl);
+}
@@ -0,0 +1,363 @@
+#define _DEFAULT_SOURCE  // clock_gettime() & sched_yield() with -std=c99
+
+#include "memtrace.h"
+
+#include <sched.h>   // sched_yield()
+#include <stdlib.h>  // malloc() & free() & atexit()
+#include <string.h>  // memset() & strlen()
+#include <time.h>    // clock_gettime()
+
+#include "assert.h"
+#include "mem.h"
+#include "memhook.h"
+
+/*
+    The trace buffer is a ring of slots shared by all threads. A thread
+    takes a ticket from head with one atomic add, waits until the slot of
+    the ticket is free (it is behind only when the disk is), fills it, and
+    publishes it by storing ticket + 1 in its seq. The thread taking the
+    last ticket of a block of TRACE_BLOCK slots writes the block out once
+    all of its slots are published and the block before it is written, and
+    then moves flushed past it, which frees the slots. So no lock is taken
+    and only one thread in TRACE_BLOCK calls fwrite().
+*/
+
+// slots in the ring, and slots written out at once
+#define TRACE_SLOTS 16384
+#define TRACE_BLOCK 1024
+
+// bytes buffered before fwrite()
+#define TRACE_OUT 65536
+
+// buckets of the table of file names already written
+#define NAME_BUCKETS 256
+
+// ids above it are written as 0, no file
+#define MAX_NAME_ID 65535
+
+#if defined(__GNUC__)
+#define ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define ATOMIC_TICKET(x) __atomic_fetch_add(&(x), 1, __ATOMIC_RELAXED)
+#else
+#define ATOMIC_LOAD(x) (x)
+#define ATOMIC_STORE(x, v) ((x) = (v))
+#define ATOMIC_TICKET(x) ((x)++)
+#endif
+
+struct slot {
+    unsigned long long seq;  // ticket + 1 once the event is published
+    unsigned long long time;
+    const void *ptr;
+    const void *old;
+    const char *file;
+    long size;
+    int op;
+    int line;
+};
+
+// file name written to the trace
+struct name {
+    struct name *link;
+    const char *file;
+    int id;
+};
+
+int memhook_tracing = 0;
+
+static struct slot slots[TRACE_SLOTS];
+static unsigned long long head;     // next ticket
+static unsigned long long flushed;  // tickets before it are written out
+
+// touched only by the thread writing a block out
+static FILE *trace_fp;
+static int trace_error;
+static struct timespec trace_start;
+static unsigned char out[TRACE_OUT];
+static long nout;
+static struct name *names[NAME_BUCKETS];
+static int nnames;
+
+// Writer
+
+static void out_flush(void) {
+    if (nout > 0 && fwrite(out, 1, nout, trace_fp) != (size_t)nout)
+        trace_error = 1;
+    nout = 0;
+}
+
+static void out_put(const unsigned char *p, long n) {
+    long m;
+
+    while (n > 0) {
+        if (nout == TRACE_OUT) out_flush();
+        m = (n < TRACE_OUT - nout) ? n : TRACE_OUT - nout;
+        memcpy(out + nout, p, m);
+        nout += m;
+        p += m;
+        n -= m;
+    }
+}
+
+/*
+    put_le:
+        1. Store the low nbytes bytes of x at p in little-endian order,
+        and return the end of them.
+*/
+static unsigned char *put_le(unsigned char *p, unsigned long long x, int nbytes) {
+    while (nbytes-- > 0) {
+        *p++ = (unsigned char)(x & 0xFF);
+        x >>= 8;
+    }
+    return p;
+}
+
+/*
+    name_id:
+        1. Return the id of file in the trace, writing its MEMTRACE_FILE
+        record the first time it is seen.
+        2. Names are told apart by address, as __FILE__ strings are.
+*/
+static int name_id(const char *file) {
+    unsigned char buf[5], *p;
+    struct name *np;
+    unsigned long h;
+    size_t len;
+
+    if (file == NULL) return 0;
+    h = ((unsigned long)file >> 3) % NAME_BUCKETS;
+    for (np = names[h]; np != NULL; np = np->link)
+        if (np->file == file) return np->id;
+    if (nnames == MAX_NAME_ID || (np = malloc(sizeof(*np))) == NULL) return 0;
+    np->file = file;
+    np->id = ++nnames;
+    np->link = names[h];
+    names[h] = np;
+
+    if ((len = strlen(file)) > 0xFFFF) len = 0xFFFF;
+    p = put_le(buf, MEMTRACE_FILE, 1);
+    p = put_le(p, np->id, 2);
+    p = put_le(p, len, 2);
+    out_put(buf, p - buf);
+    out_put((const unsigned char *)file, (long)len);
+    return np->id;
+}
+
+static void encode(struct slot *s) {
+    unsigned char buf[40], *p;
+    int id;
+
+    id = name_id(s->file);
+    p = put_le(buf, s->op, 1);
+    p = put_le(p, id, 2);
+    p = put_le(p, (unsigned)s->line, 4);
+    p = put_le(p, s->time, 8);
+    p = put_le(p, (unsigned long)s->ptr, 8);
+    if (s->op != MEMTRACE_FREE) p = put_le(p, s->size, 8);
+    if (s->op == MEMTRACE_RESIZE) p = put_le(p, (unsigned long)s->old, 8);
+    out_put(buf, p - buf);
+}
+
+/*
+    flush:
+        1. Write out the events with tickets in [begin, end), after those
+        before begin, and free their slots.
+*/
+static void flush(unsigned long long begin, unsigned long long end) {
+    unsigned long long t;
+    struct slot *s;
+
+    while (ATOMIC_LOAD(flushed) != begin) sched_yield();
+    for (t = begin; t < end; t++) {
+        s = &slots[t & (TRACE_SLOTS - 1)];
+        while (ATOMIC_LOAD(s->seq) != t + 1) sched_yield();
+        encode(s);
+    }
+    out_flush();
+    ATOMIC_STORE(flushed, end);
+}
+
+void Memhook_trace(int op, const void *ptr, const void *old, long nbytes,
+                   const char *file, int line) {
+    struct timespec now;
+    unsigned long long t;
+    struct slot *s;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    t = ATOMIC_TICKET(head);
+    // the slot still holds the event TRACE_SLOTS tickets before
+    while (t - ATOMIC_LOAD(flushed) >= TRACE_SLOTS) sched_yield();
+
+    s = &slots[t & (TRACE_SLOTS - 1)];
+    s->time = (unsigned long long)(now.tv_sec - trace_start.tv_sec) * 1000000000ULL +
+              now.tv_nsec - trace_start.tv_nsec;
+    s->ptr = ptr;
+    s->old = old;
+    s->file = file;
+    s->size = nbytes;
+    s->op = op;
+    s->line = line;
+    ATOMIC_STORE(s->seq, t + 1);
+
+    if ((t + 1) % TRACE_BLOCK == 0) flush(t + 1 - TRACE_BLOCK, t + 1);
+}
+
+static void trace_stop(void) {
+    Mem_trace(NULL);
+}
+
+int Mem_trace(const char *path) {
+    static int registered = 0;
+    struct name *np;
+    unsigned long long end;
+    int i, error;
+    FILE *fp;
+
+    if (path == NULL) {
+        if (!ATOMIC_LOAD(memhook_tracing)) return 0;
+        ATOMIC_STORE(memhook_tracing, 0);
+
+        // write the partial block after the last full one
+        end = ATOMIC_LOAD(head);
+        flush(end - end % TRACE_BLOCK, end);
+
+        error = trace_error;
+        if (fclose(trace_fp) != 0) error = 1;
+        trace_fp = NULL;
+        for (i = 0; i < NAME_BUCKETS; i++)
+            while ((np = names[i]) != NULL) {
+                names[i] = np->link;
+                free(np);
+            }
+        return error ? -1 : 0;
+    }
+
+    assert(!memhook_tracing);
+
+    if ((fp = fopen(path, "wb")) == NULL) return -1;
+    if (fwrite(MEMTRACE_MAGIC, 1, 8, fp) != 8) {
+        fclose(fp);
+        return -1;
+    }
+    if (!registered) registered = (atexit(trace_stop) == 0);
+
+    trace_fp = fp;
+    trace_error = 0;
+    nout = 0;
+    nnames = 0;
+    memset(slots, 0, sizeof(slots));
+    head = flushed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+    ATOMIC_STORE(memhook_tracing, 1);
+    return 0;
+}
+
+// Reader
+
+struct memtrace_t {
+    FILE *fp;
+    int nfiles;
+    int capacity;
+    char **files;  // name of file id i + 1
+};
+
+static int read_le(FILE *fp, int nbytes, unsigned long long *x) {
+    int c, i;
+
+    *x = 0;
+    for (i = 0; i < nbytes; i++) {
+        if ((c = getc(fp)) == EOF) return 0;
+        *x |= (unsigned long long)c << (8 * i);
+    }
+    return 1;
+}
+
+struct memtrace_t *Memtrace_open(FILE *fp) {
+    struct memtrace_t *trace;
+    char magic[8];
+
+    assert(fp != NULL);
+
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, MEMTRACE_MAGIC, 8) != 0)
+        return NULL;
+
+    NEW(trace);
+    trace->fp = fp;
+    trace->nfiles = 0;
+    trace->capacity = 0;
+    trace->files = NULL;
+    return trace;
+}
+
+/*
+    read_file:
+        1. Read the rest of a MEMTRACE_FILE record into the names of trace.
+        2. Ids come in order from 1, so anything else is malformed.
+*/
+static int read_file(struct memtrace_t *trace) {
+    unsigned long long id, len;
+    char *name;
+
+    if (!read_le(trace->fp, 2, &id) || !read_le(trace->fp, 2, &len)) return 0;
+    if (id != (unsigned long long)trace->nfiles + 1) return 0;
+
+    name = ALLOC(len + 1);
+    if (fread(name, 1, len, trace->fp) != len) {
+        FREE(name);
+        return 0;
+    }
+    name[len] = '\0';
+
+    if (trace->nfiles == trace->capacity) {
+        trace->capacity = (trace->capacity == 0) ? 64 : 2 * trace->capacity;
+        if (trace->files == NULL)
+            trace->files = ALLOC(trace->capacity * sizeof(trace->files[0]));
+        else
+            RESIZE(trace->files, trace->capacity * sizeof(trace->files[0]));
+    }
+    trace->files[trace->nfiles++] = name;
+    return 1;
+}
+
+int Memtrace_read(struct memtrace_t *trace, struct memtrace_event_t *ev) {
+    unsigned long long file, line, x;
+    FILE *fp;
+    int op;
+
+    assert(trace != NULL);
+    assert(ev != NULL);
+
+    fp = trace->fp;
+    while ((op = getc(fp)) == MEMTRACE_FILE)
+        if (!read_file(trace)) return -1;
+    if (op == EOF) return 0;
+    if (op < MEMTRACE_ALLOC || op > MEMTRACE_FREE) return -1;
+
+    if (!read_le(fp, 2, &file) || !read_le(fp, 4, &line) ||
+        !read_le(fp, 8, &ev->time) || !read_le(fp, 8, &ev->id))
+        return -1;
+    if (file > (unsigned long long)trace->nfiles) return -1;
+    ev->op = op;
+    ev->file = (file == 0) ? NULL : trace->files[file - 1];
+    ev->line = (int)line;
+    ev->size = 0;
+    ev->old = 0;
+
+    if (op != MEMTRACE_FREE) {
+        if (!read_le(fp, 8, &x)) return -1;
+        ev->size = (long)x;
+    }
+    if (op == MEMTRACE_RESIZE && !read_le(fp, 8, &ev->old)) return -1;
+    return 1;
+}
+
+void Memtrace_close(struct memtrace_t **trace) {
+    int i;
+
+    assert(trace != NULL);
+    assert(*trace != NULL);
+
+    for (i = 0; i < (*trace)->nfiles; i++) FREE((*trace)->files[i]);
+    FREE((*trace)->files);
+    FREE(*trace);
+}
@@ -1,29 +1,122 @@
 #include "set.h"
 
 #include <limits.h>  // INT_MAX
-#include <string.h>  // memset()
+#include <string.h>  // memset() & memcpy()
 
 #include "algo.h"
+#include "arena.h"
 #include "assert.h"
 #include "atom.h"
+#include "bitvec.h"
+#include "bloom.h"
 #include "mem.h"
 
 // Size of set (the same with table)
 // Set_create will choose the greatest value which is less than hint
 static int primes[] = {
     509,
-    509,    // 512   = 2 ^ 9
-    1021,   // 1025  = 2 ^ 10
-    2039,   // 2048  = 2 ^ 11
-    4093,   // 4096  = 2 ^ 12
-    8191,   // 8192  = 2 ^ 13
-    16381,  // 16384 = 2 ^ 14
-    32771,  // 32768 = 2 ^ 15
-    65521,  // 65535 = 2 ^ 16
+    509,         // 512   = 2 ^ 9
+    1021,        // 1025  = 2 ^ 10
+    2039,        // 2048  = 2 ^ 11
+    4093,        // 4096  = 2 ^ 12
+    8191,        // 8192  = 2 ^ 13
+    16381,       // 16384 = 2 ^ 14
+    32771,       // 32768 = 2 ^ 15
+    65521,       // 65535 = 2 ^ 16
+    131071,      // 2 ^ 17
+    262139,      // 2 ^ 18
+    524287,      // 2 ^ 19
+    1048573,     // 2 ^ 20
+    2097143,     // 2 ^ 21
+    4194301,     // 2 ^ 22
+    8388593,     // 2 ^ 23
+    16777213,    // 2 ^ 24
+    33554393,    // 2 ^ 25
+    67108859,    // 2 ^ 26
+    134217689,   // 2 ^ 27
+    268435399,   // 2 ^ 28
+    536870909,   // 2 ^ 29
+    1073741789,  // 2 ^ 30
     INT_MAX,
 };
 
-struct set_t *Set_create(int hint, cmp_t cmp, hash_t hash) {
+// The set grows when the average chain length exceeds this bound.
+#define SET_LOAD_FACTOR 2
+
+// Filters are sized for FILTER_SLACK times the members they are built
+// with, so that they don't have to be rebuilt at each put.
+#define FILTER_SLACK 2
+
+// allocation and deallocation in the storage of set, see Set_create_in()
+#define SET_ALLOC(set, nbytes)                                       \
+    ((set)->arena != NULL                                            \
+         ? Arena_alloc((set)->arena, (nbytes), __FILE__, __LINE__)   \
+         : ALLOC(nbytes))
+#define SET_CALLOC(set, count, nbytes)                                         \
+    ((set)->arena != NULL                                                      \
+         ? Arena_calloc((set)->arena, (count), (nbytes), __FILE__, __LINE__)   \
+         : CALLOC((count), (nbytes)))
+#define SET_TRY_ALLOC(set, nbytes)                                   \
+    ((set)->arena != NULL                                            \
+         ? Arena_try_alloc((set)->arena, (nbytes))                   \
+         : Mem_try_alloc((nbytes), __FILE__, __LINE__))
+#define SET_FREE(set, ptr) \
+    ((void)((set)->arena == NULL ? FREE(ptr) : ((ptr) = 0)))
+
+/*
+    set_rehash:
+        1. Move all members of set into buckets, a zeroed array of
+        capacity buckets.
+        2. Members are relinked, not reallocated, so the values seen
+        by clients are unchanged.
+*/
+static void set_rehash(struct set_t *set, struct member **buckets, int capacity) {
+    struct member *p, *q;
+    unsigned long h;
+    int i;
+
+    for (i = 0; i < set->capacity; i++) {
+        for (p = set->buckets[i]; p != NULL; p = q) {
+            q = p->link;
+            h = (*set->hash)(p->value) % capacity;
+            p->link = buckets[h];
+            buckets[h] = p;
+        }
+    }
+    SET_FREE(set, set->buckets);
+    set->buckets = buckets;
+    set->capacity = capacity;
+}
+
+/*
+    set_grow_capacity:
+        1. Return the smallest prime of primes[] which brings the load
+        factor of set back under SET_LOAD_FACTOR, or 0 if set needn't or
+        can't grow. Sets at the last prime keep their capacity.
+*/
+static int set_grow_capacity(struct set_t *set) {
+    int i;
+
+    if (set->size <= SET_LOAD_FACTOR * (long)set->capacity) return 0;
+    for (i = 1; primes[i] != INT_MAX &&
+                (primes[i] <= set->capacity ||
+                 set->size > SET_LOAD_FACTOR * (long)primes[i]);
+         i++)
+        ;
+    if (primes[i] == INT_MAX) i--;
+    return (primes[i] > set->capacity) ? primes[i] : 0;
+}
+
+// rehash set into the capacity given by set_grow_capacity, if any
+static void set_grow(struct set_t *set) {
+    int capacity;
+
+    if ((capacity = set_grow_capacity(set)) > 0)
+        set_rehash(set, SET_CALLOC(set, capacity, sizeof(struct member *)), capacity);
+}
+
+static struct set_t *set_create(struct arena_t *arena, int hint,
+                                cmp_t cmp, hash_t hash) {
     struct set_t *set;
     int i;
 
@@ -34,7 +127,11 @@ struct set_t *Set_create(int hint, cmp_t cmp, hash_t hash) {
         ;
     hint = primes[i - 1];
 
-    set = ALLOC(sizeof(*set) + hint * sizeof(set->buckets[0]));
+    if (arena != NULL)
+        set = Arena_alloc(arena, sizeof(*set), __FILE__, __LINE__);
+    else
+        NEW(set);
+    set->arena = arena;
     set->capacity = hint;
     if (cmp == NULL) {
         set->cmp = (cmp_t)Atom_cmp;  // avoid warnings
@@ -46,18 +143,196 @@ struct set_t *Set_create(int hint, cmp_t cmp, hash_t hash) {
     } else {
         set->hash = hash;
     }
-    set->buckets = (struct member **)(set + 1);
-    memset(set->buckets, 0, sizeof(set->buckets[0]) * hint);
+    set->buckets = SET_CALLOC(set, hint, sizeof(set->buckets[0]));
+    set->filter = NULL;
+    set->words = NULL;
+    set->lo = set->nwords = 0;
     set->size = 0;
     set->time_stamp = 0;
 
     return set;
 }
 
+struct set_t *Set_create(int hint, cmp_t cmp, hash_t hash) {
+    return set_create(NULL, hint, cmp, hash);
+}
+
+struct set_t *Set_create_in(struct arena_t *arena, int hint, cmp_t cmp, hash_t hash) {
+    assert(arena != NULL);
+    return set_create(arena, hint, cmp, hash);
+}
+
+// Dense mode
+
+// Operations between dense sets
+enum {
+    DENSE_UNION,
+    DENSE_INTER,
+    DENSE_MINUS,
+    DENSE_DIFF,
+};
+
+// cmp() and hash() of dense sets, members are pointers to int
+static int dense_cmp(const void *x, const void *y) {
+    int lhs = *(const int *)x, rhs = *(const int *)y;
+    return (lhs < rhs) ? -1 : (lhs > rhs);
+}
+
+static unsigned long dense_hash(const void *x) {
+    return (unsigned long)*(const int *)x;
+}
+
+/*
+    dense_create:
+        1. Create an empty dense set whose bit 0 is lo with nwords words.
+        2. nwords > 0
+*/
+static struct set_t *dense_create(int lo, long nwords) {
+    struct set_t *set;
+
+    assert(nwords > 0 && nwords <= INT_MAX);
+
+    NEW(set);
+    set->arena = NULL;
+    set->capacity = 0;
+    set->cmp = dense_cmp;
+    set->hash = dense_hash;
+    set->buckets = NULL;
+    set->filter = NULL;
+    set->words = CALLOC(nwords, sizeof(set->words[0]));
+    set->lo = lo;
+    set->nwords = nwords;
+    set->size = 0;
+    set->time_stamp = 0;
+
+    return set;
+}
+
+// length of the vector of set holding bit i, at least doubled
+static long dense_grow_words(struct set_t *set, long i) {
+    long n;
+
+    n = BITVEC_NWORDS(i + 1);
+    if (n < 2L * set->nwords) n = 2L * set->nwords;
+    if (n > INT_MAX) n = INT_MAX;
+    assert(i < n * BITVEC_WORD_BITS);
+    return n;
+}
+
+/*
+    dense_grow:
+        1. Extend the vector of set so that it holds bit i, at least
+        doubling it to keep repeated growth linear.
+*/
+static void dense_grow(struct set_t *set, long i) {
+    long n = dense_grow_words(set, i);
+
+    RESIZE(set->words, n * (long)sizeof(set->words[0]));
+    memset(set->words + set->nwords, 0,
+           (n - set->nwords) * sizeof(set->words[0]));
+    set->nwords = n;
+}
+
+// dense_grow, returning -1 with set unchanged if there is no memory
+static int dense_try_grow(struct set_t *set, long i) {
+    long n = dense_grow_words(set, i);
+    unsigned long *words;
+
+    if ((words = Mem_try_alloc(n * (long)sizeof(words[0]), __FILE__, __LINE__)) == NULL)
+        return -1;
+    memcpy(words, set->words, set->nwords * sizeof(words[0]));
+    memset(words + set->nwords, 0, (n - set->nwords) * sizeof(words[0]));
+    FREE(set->words);
+    set->words = words;
+    set->nwords = n;
+    return 0;
+}
+
+// bit of member in dense set, may be out of the vector
+static inline long dense_bit(struct set_t *set, const void *member) {
+    return (long)*(const int *)member - set->lo;
+}
+
+static inline int dense_has(struct set_t *set, long i) {
+    return i >= 0 && i < (long)set->nwords * BITVEC_WORD_BITS &&
+           BITVEC_GET(set->words, i);
+}
+
+/*
+    dense_op:
+        1. Combine dense sets s and t word by word.
+        2. Words past the end of the shorter vector count as zeros.
+*/
+static struct set_t *dense_op(struct set_t *s, struct set_t *t, int op) {
+    struct set_t *res;
+    long n, common;
+
+    assert(s->words != NULL && t->words != NULL);
+    assert(s->lo == t->lo);
+
+    common = (s->nwords < t->nwords) ? s->nwords : t->nwords;
+    if (op == DENSE_INTER)
+        n = common;
+    else if (op == DENSE_MINUS)
+        n = s->nwords;
+    else
+        n = (s->nwords > t->nwords) ? s->nwords : t->nwords;
+
+    res = dense_create(s->lo, n);
+    switch (op) {
+        case DENSE_UNION:
+            Bitvec_or(res->words, s->words, t->words, common);
+            break;
+        case DENSE_INTER:
+            Bitvec_and(res->words, s->words, t->words, common);
+            break;
+        case DENSE_MINUS:
+            Bitvec_andnot(res->words, s->words, t->words, common);
+            break;
+        default:
+            Bitvec_xor(res->words, s->words, t->words, common);
+            break;
+    }
+    // copy the tail of the longer vector where needed
+    if (op != DENSE_INTER && s->nwords > common)
+        memcpy(res->words + common, s->words + common,
+               (s->nwords - common) * sizeof(res->words[0]));
+    if ((op == DENSE_UNION || op == DENSE_DIFF) && t->nwords > common)
+        memcpy(res->words + common, t->words + common,
+               (t->nwords - common) * sizeof(res->words[0]));
+    res->size = Bitvec_count(res->words, n);
+
+    return res;
+}
+
+struct set_t *Set_create_dense(int lo, int hi) {
+    assert(lo <= hi);
+    return dense_create(lo, BITVEC_NWORDS((long)hi - lo + 1));
+}
+
+/*
+    set_empty_like:
+        1. Create an empty set of the same kind as t.
+*/
+static struct set_t *set_empty_like(struct set_t *t) {
+    if (t->words != NULL)
+        return dense_create(t->lo, 1);
+    else
+        return Set_create(t->capacity, t->cmp, t->hash);
+}
+
 void Set_free(struct set_t **set) {
     assert(set != NULL);
     assert(*set != NULL);
 
+    // the storage of the set goes with its arena, only the filter
+    // lives on the heap
+    if ((*set)->arena != NULL) {
+        if ((*set)->filter != NULL) Bloom_free(&(*set)->filter);
+        *set = NULL;
+        return;
+    }
+
     if ((*set)->size > 0) {
         int i;
         struct member *p, *q;
@@ -68,17 +343,63 @@ void Set_free(struct set_t **set) {
             }
         }
     }
+    if ((*set)->filter != NULL) Bloom_free(&(*set)->filter);
+    FREE((*set)->buckets);
+    FREE((*set)->words);
     FREE(*set);
 }
 
+// number of keys to size the filter of set for, leaving room to grow
+static long set_filter_keys(struct set_t *set) {
+    long nkeys = FILTER_SLACK * (long)set->size;
+
+    return (nkeys < set->capacity) ? set->capacity : nkeys;
+}
+
+// add all the members of set to its filter
+static void set_filter_fill(struct set_t *set) {
+    struct member *p;
+    int i;
+
+    for (i = 0; i < set->capacity; i++)
+        for (p = set->buckets[i]; p != NULL; p = p->link)
+            Bloom_add(set->filter, (*set->hash)(p->value));
+}
+
+/*
+    set_filter_build:
+        1. Replace the filter of set with a new one of bits_per_key bits
+        per key holding all the current members.
+*/
+static void set_filter_build(struct set_t *set, int bits_per_key) {
+    if (set->filter != NULL) Bloom_free(&set->filter);
+    set->filter = Bloom_new(set_filter_keys(set), bits_per_key);
+    set_filter_fill(set);
+}
+
+void Set_filter(struct set_t *set, int bits_per_key) {
+    assert(set != NULL);
+    assert(set->words == NULL);  // dense sets need no filter
+    assert(bits_per_key >= 0);
+
+    if (bits_per_key > 0)
+        set_filter_build(set, bits_per_key);
+    else if (set->filter != NULL)
+        Bloom_free(&set->filter);
+}
+
 int Set_has(struct set_t *set, const void *member) {
-    unsigned long h;
+    unsigned long hash, h;
     struct member *p;
 
     assert(set != NULL);
     assert(member != NULL);
 
-    h = (*set->hash)(member) % set->capacity;
+    if (set->words != NULL) return dense_has(set, dense_bit(set, member));
+
+    hash = (*set->hash)(member);
+    if (set->filter != NULL && !Bloom_has(set->filter, hash)) return 0;
+    h = hash % set->capacity;
     for (p = set->buckets[h]; p != NULL; p = p->link) {
         if ((*set->cmp)(member, p->value) == 0) {
             break;
@@ -88,27 +409,68 @@ int Set_has(struct set_t *set, const void *member) {
     return (p != NULL);
 }
 
+// member of a chained set equal to member, whose hash number is hash, or NULL
+static struct member *set_find(struct set_t *set, const void *member, unsigned long hash) {
+    struct member *p = NULL;
+
+    if (set->filter == NULL || Bloom_has(set->filter, hash)) {
+        for (p = set->buckets[hash % set->capacity]; p != NULL; p = p->link) {
+            if ((*set->cmp)(member, p->value) == 0) {
+                break;
+            }
+        }
+    }
+    return p;
+}
+
+// link the new member p into a chained set
+static void set_link(struct set_t *set, struct member *p, const void *member,
+                     unsigned long hash) {
+    unsigned long h = hash % set->capacity;
+
+    p->value = member;
+    p->link = set->buckets[h];
+    set->buckets[h] = p;
+    set->size++;
+}
+
+// set bit i of a dense set, which holds it
+static void dense_put(struct set_t *set, long i) {
+    if (!BITVEC_GET(set->words, i)) {
+        BITVEC_SET(set->words, i);
+        set->size++;
+    }
+    set->time_stamp++;
+}
+
 void Set_put(struct set_t *set, const void *member) {
-    unsigned long h;
+    unsigned long hash;
     struct member *p;
 
     assert(set != NULL);
     assert(member != NULL);
 
-    h = (*set->hash)(member) % set->capacity;
-    for (p = set->buckets[h]; p != NULL; p = p->link) {
-        if ((*set->cmp)(member, p->value) == 0) {
-            break;
-        }
+    if (set->words != NULL) {
+        long i = dense_bit(set, member);
+
+        assert(i >= 0);  // member < lo
+        if (i >= (long)set->nwords * BITVEC_WORD_BITS) dense_grow(set, i);
+        dense_put(set, i);
+        return;
     }
 
-    if (p == NULL) {
+    hash = (*set->hash)(member);
+    if ((p = set_find(set, member, hash)) == NULL) {
         // add member
-        NEW(p);
-        p->value = member;
-        p->link = set->buckets[h];
-        set->buckets[h] = p;
-        set->size++;
+        p = SET_ALLOC(set, sizeof(*p));
+        set_link(set, p, member, hash);
+        if (set->filter != NULL) {
+            if (set->size > set->filter->capacity)
+                set_filter_build(set, set->filter->bits_per_key);
+            else
+                Bloom_add(set->filter, hash);
+        }
+        set_grow(set);
     } else {
         // overwrite the previous one
         p->value = member;
@@ -117,8 +479,55 @@ void Set_put(struct set_t *set, const void *member) {
     set->time_stamp++;
 }
 
+int Set_try_put(struct set_t *set, const void *member) {
+    struct member **buckets, *p;
+    struct bloom_t *filter;
+    unsigned long hash;
+    int capacity;
+
+    assert(set != NULL);
+    assert(member != NULL);
+
+    if (set->words != NULL) {
+        long i = dense_bit(set, member);
+
+        assert(i >= 0);  // member < lo
+        if (i >= (long)set->nwords * BITVEC_WORD_BITS && dense_try_grow(set, i) != 0)
+            return -1;
+        dense_put(set, i);
+        return 0;
+    }
+
+    hash = (*set->hash)(member);
+    if ((p = set_find(set, member, hash)) == NULL) {
+        if ((p = SET_TRY_ALLOC(set, sizeof(*p))) == NULL) return -1;
+        set_link(set, p, member, hash);
+        // a filter or buckets that can't be reallocated stay as they are,
+        // the set is only slower
+        if (set->filter != NULL) {
+            if (set->size > set->filter->capacity &&
+                (filter = Bloom_try_new(set_filter_keys(set),
+                                        set->filter->bits_per_key)) != NULL) {
+                Bloom_free(&set->filter);
+                set->filter = filter;
+                set_filter_fill(set);
+            } else
+                Bloom_add(set->filter, hash);
+        }
+        if ((capacity = set_grow_capacity(set)) > 0 &&
+            (buckets = SET_TRY_ALLOC(set, capacity * (long)sizeof(*buckets))) != NULL) {
+            memset(buckets, 0, capacity * sizeof(*buckets));
+            set_rehash(set, buckets, capacity);
+        }
+    } else
+        p->value = member;
+
+    set->time_stamp++;
+    return 0;
+}
+
 void *Set_remove(struct set_t *set, const void *member) {
-    unsigned long h;
+    unsigned long hash, h;
     struct member **pp, *p;
     void *prev;
 
@@ -126,17 +535,35 @@ void *Set_remove(struct set_t *set, const void *member) {
     assert(member != NULL);
 
     prev = NULL;
-    h = (*set->hash)(member) % set->size;
+    if (set->words != NULL) {
+        long i = dense_bit(set, member);
+
+        if (dense_has(set, i)) {
+            BITVEC_CLEAR(set->words, i);
+            prev = (void *)member;
+            set->size--;
+        }
+        set->time_stamp++;
+        return prev;
+    }
+
+    set->time_stamp++;
+    hash = (*set->hash)(member);
+    if (set->filter != NULL && !Bloom_has(set->filter, hash)) return NULL;
+    h = hash % set->capacity;
     for (pp = &set->buckets[h]; *pp != NULL; pp = &(*pp)->link) {
         if ((*set->cmp)(member, (*pp)->value) == 0) {
             p = *pp;
-            prev = p->link;
-            FREE(p);
+            *pp = p->link;
+            prev = (void *)p->value;
+            SET_FREE(set, p);
             set->size--;
+            // the filter still answers for the removed member
+            if (set->filter != NULL && ++set->filter->nremoved > set->size)
+                set_filter_build(set, set->filter->bits_per_key);
             break;
         }
     }
-    set->time_stamp++;
     return prev;
 }
 
@@ -149,6 +576,18 @@ void Set_map(struct set_t *set,
     assert(set != NULL);
     assert(apply != NULL);
     stamp = set->time_stamp;
+    if (set->words != NULL) {
+        long k;
+        int x;
+
+        for (k = Bitvec_next(set->words, set->nwords, 0); k >= 0;
+             k = Bitvec_next(set->words, set->nwords, k + 1)) {
+            x = set->lo + (int)k;
+            apply(&x, cl);
+            assert(stamp == set->time_stamp);
+        }
+        return;
+    }
     for (i = 0; i < set->capacity; ++i) {
         for (p = set->buckets[i]; p != NULL; p = p->link) {
             apply(p->value, cl);
@@ -164,6 +603,24 @@ void **Set_to_array(struct set_t *set, void *end) {
 
     assert(set != NULL);
 
+    if (set->words != NULL) {
+        long k;
+        int *values;
+
+        // the values live right after the pointers, in the same block
+        arr = ALLOC((set->size + 1) * sizeof(*arr) +
+                    set->size * sizeof(*values));
+        values = (int *)(arr + set->size + 1);
+        for (j = 0, k = Bitvec_next(set->words, set->nwords, 0); k >= 0;
+             k = Bitvec_next(set->words, set->nwords, k + 1)) {
+            values[j] = set->lo + (int)k;
+            arr[j] = &values[j];
+            j++;
+        }
+        arr[j] = end;
+        return arr;
+    }
+
     arr = ALLOC((set->size + 1) * sizeof(*arr));
     for (i = 0, j = 0; i < set->capacity; i++) {
         for (p = set->buckets[i]; p != NULL; p = p->link) {
@@ -179,7 +636,9 @@ void **Set_to_array(struct set_t *set, void *end) {
 /*
     Set_copy:
         1. Copy the set t.
-        2. The capacity of the duplicate will be no less than the original one.
+        2. The capacity of the duplicate is chosen for t->size members,
+        not inherited from t, so copies of sparse or grown sets are
+        right-sized.
 */
 static struct set_t *Set_copy(struct set_t *t) {
     assert(t != NULL);
@@ -188,10 +647,16 @@ static struct set_t *Set_copy(struct set_t *t) {
     const void *member;
     unsigned long h;
     int i;
-    // dup and t may have different capacity
-    // dup.capacity >= t.capacity
-    dup = Set_create(t->capacity, t->cmp, t->hash);
-    for (i = 0; i < t->size; ++i) {
+
+    if (t->words != NULL) {
+        dup = dense_create(t->lo, t->nwords);
+        memcpy(dup->words, t->words, t->nwords * sizeof(t->words[0]));
+        dup->size = t->size;
+        return dup;
+    }
+
+    dup = Set_create(t->size, t->cmp, t->hash);
+    for (i = 0; i < t->capacity; ++i) {
         for (p = t->buckets[i]; p != NULL; p = p->link) {
             member = p->value;
             h = (*dup->hash)(member) % dup->capacity;
@@ -202,6 +667,7 @@ static struct set_t *Set_copy(struct set_t *t) {
             dup->size++;
         }
     }
+    set_grow(dup);
     return dup;
 }
 
@@ -212,6 +678,9 @@ struct set_t *Set_union(struct set_t *s, struct set_t *t) {
     } else if (t == NULL) {
         return Set_copy(s);
     } else {
+        if (s->words != NULL || t->words != NULL)
+            return dense_op(s, t, DENSE_UNION);
+
         assert(s->cmp == t->cmp);
         assert(s->hash == t->hash);
 
@@ -220,7 +689,7 @@ struct set_t *Set_union(struct set_t *s, struct set_t *t) {
         int i;
 
         res = Set_copy(s);
-        for (i = 0; i < t->size; ++i) {
+        for (i = 0; i < t->capacity; ++i) {
             for (p = t->buckets[i]; p != NULL; p = p->link) {
                 Set_put(res, p->value);
             }
@@ -234,12 +703,15 @@ static int min(int lhs, int rhs) { return (lhs < rhs) ? lhs : rhs; }
 struct set_t *Set_inter(struct set_t *s, struct set_t *t) {
     if (s == NULL) {
         assert(t != NULL);
-        return Set_create(t->capacity, t->cmp, t->hash);
+        return set_empty_like(t);
     } else if (t == NULL) {
-        return Set_create(s->capacity, s->cmp, s->hash);
+        return set_empty_like(s);
     } else if (s->size < t->size) {
         return Set_inter(t, s);  // to traverse the smaller set
     } else {
+        if (s->words != NULL || t->words != NULL)
+            return dense_op(s, t, DENSE_INTER);
+
         assert(s->cmp == t->cmp);
         assert(s->hash == t->hash);
 
@@ -263,6 +735,7 @@ struct set_t *Set_inter(struct set_t *s, struct set_t *t) {
                 }
             }
         }
+        set_grow(res);
         return res;
     }
 }
@@ -271,10 +744,13 @@ struct set_t *Set_minus(struct set_t *s, struct set_t *t) {
     // return s - t;
     if (s == NULL) {  // if s = {}, then s - t = {}
         assert(t != NULL);
-        return Set_create(t->capacity, t->cmp, t->hash);
+        return set_empty_like(t);
     } else if (t == NULL) {  // if t = {}, then s - t = s
         return Set_copy(s);
     } else {
+        if (s->words != NULL || t->words != NULL)
+            return dense_op(s, t, DENSE_MINUS);
+
         assert(s->cmp == t->cmp);
         assert(s->hash == t->hash);
 
@@ -298,6 +774,7 @@ struct set_t *Set_minus(struct set_t *s, struct set_t *t) {
                 }
             }
         }
+        set_grow(res);
         return res;
     }
 }
@@ -310,6 +787,9 @@ struct set_t *Set_diff(struct set_t *s, struct set_t *t) {
     } else if (t == NULL) {  // if t == {}, s ^ t = s
         return Set_copy(s);
     } else {
+        if (s->words != NULL || t->words != NULL)
+            return dense_op(s, t, DENSE_DIFF);
+
         assert(s->cmp == t->cmp);
         assert(s->hash == t->hash);
 
@@ -348,7 +828,7 @@ struct set_t *Set_diff(struct set_t *s, struct set_t *t) {
                 }
             }
         }
-
+        set_grow(res);
         return res;
     }
 }
\ No newline at end of file
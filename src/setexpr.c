@@ -0,0 +1,207 @@
+#include "setexpr.h"
+
+#include "assert.h"
+#include "mem.h"
+#include "set.h"
+
+// state of a streaming evaluation, passed to eval_member by Set_map
+struct eval {
+    struct setexpr_t *expr;
+    struct set_t **drivers;  // operands streamed, in order
+    int k;                   // index of the driver being streamed
+    struct set_t *res;       // result, or NULL when only counting
+    int count;
+};
+
+static struct setexpr_t *setexpr_new(int op, struct setexpr_t *lhs,
+                                     struct setexpr_t *rhs) {
+    struct setexpr_t *expr;
+
+    assert(lhs != NULL && rhs != NULL);
+
+    NEW(expr);
+    expr->op = op;
+    expr->set = NULL;
+    expr->lhs = lhs;
+    expr->rhs = rhs;
+    return expr;
+}
+
+struct setexpr_t *Setexpr_set(struct set_t *set) {
+    struct setexpr_t *expr;
+
+    assert(set != NULL);
+
+    NEW(expr);
+    expr->op = SETEXPR_SET;
+    expr->set = set;
+    expr->lhs = expr->rhs = NULL;
+    return expr;
+}
+
+struct setexpr_t *Setexpr_union(struct setexpr_t *lhs, struct setexpr_t *rhs) {
+    return setexpr_new(SETEXPR_UNION, lhs, rhs);
+}
+
+struct setexpr_t *Setexpr_inter(struct setexpr_t *lhs, struct setexpr_t *rhs) {
+    return setexpr_new(SETEXPR_INTER, lhs, rhs);
+}
+
+struct setexpr_t *Setexpr_minus(struct setexpr_t *lhs, struct setexpr_t *rhs) {
+    return setexpr_new(SETEXPR_MINUS, lhs, rhs);
+}
+
+struct setexpr_t *Setexpr_diff(struct setexpr_t *lhs, struct setexpr_t *rhs) {
+    return setexpr_new(SETEXPR_DIFF, lhs, rhs);
+}
+
+void Setexpr_free(struct setexpr_t **expr) {
+    assert(expr != NULL);
+    assert(*expr != NULL);
+
+    if ((*expr)->op != SETEXPR_SET) {
+        Setexpr_free(&(*expr)->lhs);
+        Setexpr_free(&(*expr)->rhs);
+    }
+    FREE(*expr);
+}
+
+int Setexpr_has(struct setexpr_t *expr, const void *member) {
+    assert(expr != NULL);
+    assert(member != NULL);
+
+    switch (expr->op) {
+        case SETEXPR_SET:
+            return Set_has(expr->set, member);
+        case SETEXPR_UNION:
+            return Setexpr_has(expr->lhs, member) ||
+                   Setexpr_has(expr->rhs, member);
+        case SETEXPR_INTER:
+            return Setexpr_has(expr->lhs, member) &&
+                   Setexpr_has(expr->rhs, member);
+        case SETEXPR_MINUS:
+            return Setexpr_has(expr->lhs, member) &&
+                   !Setexpr_has(expr->rhs, member);
+        default:
+            return Setexpr_has(expr->lhs, member) !=
+                   Setexpr_has(expr->rhs, member);
+    }
+}
+
+/*
+    first_set:
+        1. Return the leftmost operand of expr, checking on the way that
+        all the operands share cmp() and hash() with it.
+*/
+static struct set_t *first_set(struct setexpr_t *expr, struct set_t *first) {
+    if (expr->op == SETEXPR_SET) {
+        if (first != NULL) {
+            assert(expr->set->cmp == first->cmp);
+            assert(expr->set->hash == first->hash);
+        }
+        return (first != NULL) ? first : expr->set;
+    }
+    first = first_set(expr->lhs, first);
+    return first_set(expr->rhs, first);
+}
+
+static int nleaves(struct setexpr_t *expr) {
+    if (expr->op == SETEXPR_SET) return 1;
+    return nleaves(expr->lhs) + nleaves(expr->rhs);
+}
+
+/*
+    add_drivers:
+        1. Append to drivers[*n] the operands whose members cover the
+        value of expr, and return the sum of their sizes.
+        2. Any member of a union or a symmetric difference comes from one
+        of its sides, and any member of a difference from its left side.
+        An intersection is covered by either side, the cheaper one is
+        taken.
+*/
+static long add_drivers(struct setexpr_t *expr, struct set_t **drivers, int *n) {
+    int i, mark, split;
+    long lsize, rsize;
+
+    switch (expr->op) {
+        case SETEXPR_SET:
+            drivers[(*n)++] = expr->set;
+            return expr->set->size;
+        case SETEXPR_MINUS:
+            return add_drivers(expr->lhs, drivers, n);
+        case SETEXPR_INTER:
+            mark = *n;
+            lsize = add_drivers(expr->lhs, drivers, n);
+            split = *n;
+            rsize = add_drivers(expr->rhs, drivers, n);
+            if (lsize <= rsize) {
+                *n = split;  // drop the right side
+                return lsize;
+            }
+            // keep the right side only
+            for (i = split; i < *n; i++) drivers[mark + i - split] = drivers[i];
+            *n = mark + *n - split;
+            return rsize;
+        default:
+            lsize = add_drivers(expr->lhs, drivers, n);
+            return lsize + add_drivers(expr->rhs, drivers, n);
+    }
+}
+
+static void eval_member(const void *member, void *cl) {
+    struct eval *ev = cl;
+    int i;
+
+    // members shared with an earlier driver have been seen already
+    for (i = 0; i < ev->k; i++)
+        if (Set_has(ev->drivers[i], member)) return;
+    if (Setexpr_has(ev->expr, member)) {
+        if (ev->res != NULL) Set_put(ev->res, member);
+        ev->count++;
+    }
+}
+
+/*
+    eval:
+        1. Stream the drivers of expr into res, if not NULL, and return
+        the number of members of the value of expr.
+*/
+static int eval(struct setexpr_t *expr, struct set_t *res) {
+    struct eval ev;
+    int i, n;
+
+    ev.drivers = ALLOC(nleaves(expr) * (long)sizeof(ev.drivers[0]));
+    n = 0;
+    add_drivers(expr, ev.drivers, &n);
+    ev.expr = expr;
+    ev.res = res;
+    ev.count = 0;
+    for (ev.k = 0; ev.k < n; ev.k++) {
+        for (i = 0; i < ev.k; i++)
+            if (ev.drivers[i] == ev.drivers[ev.k]) break;
+        if (i == ev.k) Set_map(ev.drivers[ev.k], eval_member, &ev);
+    }
+    FREE(ev.drivers);
+    return ev.count;
+}
+
+struct set_t *Setexpr_eval(struct setexpr_t *expr) {
+    struct set_t *first, *res;
+
+    assert(expr != NULL);
+
+    first = first_set(expr, NULL);
+    if (first->words != NULL)
+        res = Set_create_dense(first->lo, first->lo);
+    else
+        res = Set_create(0, first->cmp, first->hash);
+    eval(expr, res);
+    return res;
+}
+
+int Setexpr_count(struct setexpr_t *expr) {
+    assert(expr != NULL);
+
+    first_set(expr, NULL);
+    return eval(expr, NULL);
+}
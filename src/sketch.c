@@ -0,0 +1,214 @@
+#include "sketch.h"
+
+#include <math.h>    // log()
+#include <string.h>  // memset()
+
+#include "algo.h"
+#include "assert.h"
+#include "atom.h"
+#include "mem.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // __m128i & _mm_*_epi8() & _mm_*_epi64()
+#endif
+
+// bounds on the precision of HyperLogLog
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+
+// bound on the depth of Count-Min, which picks its rows from one hash
+#define CMS_MAX_DEPTH 16
+
+/*
+    leading_zeros:
+        1. Number of leading zero bits of a nonzero 64-bit word.
+*/
+static inline int leading_zeros(unsigned long long x) {
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#else
+    int n;
+    for (n = 0; (x & (1ULL << 63)) == 0; n++) x <<= 1;
+    return n;
+#endif
+}
+
+// HyperLogLog
+
+struct hll_t *Hll_new(int precision, hash_t hash) {
+    struct hll_t *hll;
+
+    assert(precision >= HLL_MIN_PRECISION && precision <= HLL_MAX_PRECISION);
+
+    NEW(hll);
+    hll->precision = precision;
+    hll->m = 1L << precision;
+    hll->hash = (hash == NULL) ? (hash_t)Atom_hash : hash;
+    hll->registers = CALLOC(hll->m, sizeof(hll->registers[0]));
+
+    return hll;
+}
+
+void Hll_free(struct hll_t **hll) {
+    assert(hll != NULL);
+    assert(*hll != NULL);
+
+    FREE((*hll)->registers);
+    FREE(*hll);
+}
+
+void Hll_add(struct hll_t *hll, const void *key) {
+    unsigned long long x, w;
+    long i;
+    int rank;
+
+    assert(hll != NULL);
+    assert(key != NULL);
+
+    // the first p bits pick the register, the position of the first set
+    // bit among the others is the observed rank
+    x = mix_hash((*hll->hash)(key));
+    i = (long)(x >> (64 - hll->precision));
+    w = (x << hll->precision) | (1ULL << (hll->precision - 1));
+    rank = leading_zeros(w) + 1;
+    if (rank > hll->registers[i]) hll->registers[i] = (unsigned char)rank;
+}
+
+double Hll_count(struct hll_t *hll) {
+    double alpha, sum, estimate;
+    long i, zeros;
+
+    assert(hll != NULL);
+
+    switch (hll->m) {
+        case 16:
+            alpha = 0.673;
+            break;
+        case 32:
+            alpha = 0.697;
+            break;
+        case 64:
+            alpha = 0.709;
+            break;
+        default:
+            alpha = 0.7213 / (1.0 + 1.079 / hll->m);
+            break;
+    }
+
+    for (i = 0, sum = 0.0, zeros = 0; i < hll->m; i++) {
+        sum += 1.0 / (double)(1ULL << hll->registers[i]);
+        if (hll->registers[i] == 0) zeros++;
+    }
+    estimate = alpha * hll->m * hll->m / sum;
+
+    // small cardinalities are better estimated by linear counting
+    if (estimate <= 2.5 * hll->m && zeros > 0)
+        estimate = hll->m * log((double)hll->m / zeros);
+
+    return estimate;
+}
+
+void Hll_merge(struct hll_t *dst, struct hll_t *src) {
+    unsigned char *d, *s;
+    long i = 0;
+
+    assert(dst != NULL && src != NULL);
+    assert(dst->precision == src->precision);
+    assert(dst->hash == src->hash);
+
+    d = dst->registers;
+    s = src->registers;
+#if defined(__SSE2__)
+    for (; i + (long)sizeof(__m128i) <= dst->m; i += sizeof(__m128i)) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(d + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_max_epu8(x, y));
+    }
+#endif
+    for (; i < dst->m; i++)
+        if (s[i] > d[i]) d[i] = s[i];
+}
+
+// Count-Min
+
+struct cms_t *Cms_new(int width, int depth, hash_t hash) {
+    struct cms_t *cms;
+
+    assert(width > 0);
+    assert(depth > 0 && depth <= CMS_MAX_DEPTH);
+
+    NEW(cms);
+    cms->width = width;
+    cms->depth = depth;
+    cms->hash = (hash == NULL) ? (hash_t)Atom_hash : hash;
+    cms->total = 0;
+    cms->counters = CALLOC((long)width * depth, sizeof(cms->counters[0]));
+
+    return cms;
+}
+
+void Cms_free(struct cms_t **cms) {
+    assert(cms != NULL);
+    assert(*cms != NULL);
+
+    FREE((*cms)->counters);
+    FREE(*cms);
+}
+
+/*
+    The counter of key in row i is picked by the double hashing a + i * b,
+    from the two halves of one mixed hash number.
+*/
+#define CMS_ROWS(cms, key, stmt)                                   \
+    do {                                                           \
+        unsigned long long x = mix_hash((*(cms)->hash)(key));      \
+        unsigned a = (unsigned)x, b = (unsigned)(x >> 32) | 1;     \
+        unsigned long long *c;                                     \
+        int i;                                                     \
+        for (i = 0; i < (cms)->depth; i++, a += b) {               \
+            c = (cms)->counters + (long)i * (cms)->width +         \
+                a % (unsigned)(cms)->width;                        \
+            stmt;                                                  \
+        }                                                          \
+    } while (0)
+
+void Cms_add(struct cms_t *cms, const void *key, long count) {
+    assert(cms != NULL);
+    assert(key != NULL);
+    assert(count >= 0);
+
+    CMS_ROWS(cms, key, *c += count);
+    cms->total += count;
+}
+
+unsigned long long Cms_estimate(struct cms_t *cms, const void *key) {
+    unsigned long long min = ~0ULL;
+
+    assert(cms != NULL);
+    assert(key != NULL);
+
+    CMS_ROWS(cms, key, if (*c < min) min = *c);
+    return min;
+}
+
+void Cms_merge(struct cms_t *dst, struct cms_t *src) {
+    unsigned long long *d, *s;
+    long i = 0, n;
+
+    assert(dst != NULL && src != NULL);
+    assert(dst->width == src->width && dst->depth == src->depth);
+    assert(dst->hash == src->hash);
+
+    n = (long)dst->width * dst->depth;
+    d = dst->counters;
+    s = src->counters;
+#if defined(__SSE2__)
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(d + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_si128((__m128i *)(d + i), _mm_add_epi64(x, y));
+    }
+#endif
+    for (; i < n; i++) d[i] += s[i];
+    dst->total += src->total;
+}
@@ -0,0 +1,252 @@
+#include "sorted.h"
+
+#include <stdlib.h>  // qsort()
+#include <string.h>  // memcpy()
+
+#include "assert.h"
+#include "mem.h"
+#include "set.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // __m128i & _mm_*_epi32() & _mm_movemask_ps()
+#endif
+
+// Sorted_inter gallops when one operand is this many times larger
+#define GALLOP_RATIO 32
+
+// operations merged by sorted_merge()
+enum {
+    OP_UNION,
+    OP_MINUS,
+    OP_DIFF,
+};
+
+static int cmp_int(const void *x, const void *y) {
+    int lhs = *(const int *)x, rhs = *(const int *)y;
+    return (lhs < rhs) ? -1 : (lhs > rhs);
+}
+
+/*
+    sorted_alloc:
+        1. Create a sorted set with room for n values and size 0.
+*/
+static struct sorted_t *sorted_alloc(int n) {
+    struct sorted_t *s;
+
+    NEW(s);
+    s->size = 0;
+    s->values = ALLOC(((n > 0) ? n : 1) * (long)sizeof(s->values[0]));
+    return s;
+}
+
+struct sorted_t *Sorted_new(const int *values, int n) {
+    struct sorted_t *s;
+    int i;
+
+    assert(n >= 0);
+    assert(n == 0 || values != NULL);
+
+    s = sorted_alloc(n);
+    if (n > 0) {
+        memcpy(s->values, values, n * sizeof(values[0]));
+        qsort(s->values, n, sizeof(s->values[0]), cmp_int);
+        for (i = 1, s->size = 1; i < n; i++)
+            if (s->values[i] != s->values[s->size - 1])
+                s->values[s->size++] = s->values[i];
+    }
+    return s;
+}
+
+static void freeze_member(const void *member, void *cl) {
+    struct sorted_t *s = cl;
+    s->values[s->size++] = *(const int *)member;
+}
+
+struct sorted_t *Sorted_freeze(struct set_t *set) {
+    struct sorted_t *s;
+
+    assert(set != NULL);
+
+    s = sorted_alloc(set->size);
+    Set_map(set, freeze_member, s);
+    // dense sets are visited in ascending order already
+    if (set->words == NULL)
+        qsort(s->values, s->size, sizeof(s->values[0]), cmp_int);
+    return s;
+}
+
+void Sorted_free(struct sorted_t **s) {
+    assert(s != NULL);
+    assert(*s != NULL);
+
+    FREE((*s)->values);
+    FREE(*s);
+}
+
+/*
+    lower_bound:
+        1. Return the index of the first of v[lo, n) not less than x.
+*/
+static int lower_bound(const int *v, int lo, int n, int x) {
+    int hi = n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (v[mid] < x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+    gallop:
+        1. Like lower_bound, but probe v[lo + 1], v[lo + 2], v[lo + 4] ...
+        before the binary search, so that the cost is logarithmic in the
+        distance from lo rather than in n.
+*/
+static int gallop(const int *v, int lo, int n, int x) {
+    int step, hi;
+
+    if (lo >= n || v[lo] >= x) return lo;
+    // v[lo] < x from now on
+    for (step = 1, hi = lo + 1; hi < n && v[hi] < x; step *= 2) {
+        lo = hi;
+        hi = lo + step;
+    }
+    return lower_bound(v, lo + 1, (hi < n) ? hi : n, x);
+}
+
+int Sorted_has(struct sorted_t *s, int x) {
+    int i;
+
+    assert(s != NULL);
+
+    i = lower_bound(s->values, 0, s->size, x);
+    return i < s->size && s->values[i] == x;
+}
+
+/*
+    inter_gallop:
+        1. Intersect the small array a with the large array b by galloping
+        through b for each member of a.
+*/
+static int inter_gallop(const int *a, int na, const int *b, int nb, int *out) {
+    int i, j, n;
+
+    for (i = 0, j = 0, n = 0; i < na && j < nb; i++) {
+        j = gallop(b, j, nb, a[i]);
+        if (j < nb && b[j] == a[i]) out[n++] = a[i];
+    }
+    return n;
+}
+
+/*
+    inter_block:
+        1. Intersect a and b, four members of each at a time.
+        2. Each block of a is compared with all four rotations of the block
+        of b, then the block with the smaller last member is consumed. No
+        member of it can match beyond the other block, whose members
+        following it are all greater.
+*/
+static int inter_block(const int *a, int na, const int *b, int nb, int *out) {
+    int i = 0, j = 0, n = 0;
+
+#if defined(__SSE2__)
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i eq;
+        int mask, amax, bmax;
+
+        eq = _mm_cmpeq_epi32(va, vb);
+        vb = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, vb));
+        vb = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, vb));
+        vb = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, vb));
+
+        mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (mask & 1) out[n++] = a[i];
+        if (mask & 2) out[n++] = a[i + 1];
+        if (mask & 4) out[n++] = a[i + 2];
+        if (mask & 8) out[n++] = a[i + 3];
+
+        amax = a[i + 3];
+        bmax = b[j + 3];
+        if (amax <= bmax) i += 4;
+        if (bmax <= amax) j += 4;
+    }
+#endif
+    // scalar merge for the rest
+    while (i < na && j < nb) {
+        if (a[i] < b[j])
+            i++;
+        else if (b[j] < a[i])
+            j++;
+        else {
+            out[n++] = a[i];
+            i++, j++;
+        }
+    }
+    return n;
+}
+
+struct sorted_t *Sorted_inter(struct sorted_t *s, struct sorted_t *t) {
+    struct sorted_t *res;
+
+    assert(s != NULL && t != NULL);
+
+    if (s->size > t->size) return Sorted_inter(t, s);  // s is the smaller
+
+    res = sorted_alloc(s->size);
+    if ((long)s->size * GALLOP_RATIO < t->size)
+        res->size = inter_gallop(s->values, s->size, t->values, t->size,
+                                 res->values);
+    else
+        res->size = inter_block(s->values, s->size, t->values, t->size,
+                                res->values);
+    return res;
+}
+
+/*
+    sorted_merge:
+        1. Merge s and t into a new sorted set for union, minus and diff.
+*/
+static struct sorted_t *sorted_merge(struct sorted_t *s, struct sorted_t *t, int op) {
+    struct sorted_t *res;
+    const int *a = s->values, *b = t->values;
+    int i, j, n;
+
+    res = sorted_alloc((op == OP_MINUS) ? s->size : s->size + t->size);
+    for (i = 0, j = 0, n = 0; i < s->size || j < t->size;) {
+        if (j == t->size || (i < s->size && a[i] < b[j])) {
+            res->values[n++] = a[i++];
+        } else if (i == s->size || b[j] < a[i]) {
+            if (op != OP_MINUS) res->values[n++] = b[j];
+            j++;
+        } else {
+            if (op == OP_UNION) res->values[n++] = a[i];
+            i++, j++;
+        }
+    }
+    res->size = n;
+    return res;
+}
+
+struct sorted_t *Sorted_union(struct sorted_t *s, struct sorted_t *t) {
+    assert(s != NULL && t != NULL);
+    return sorted_merge(s, t, OP_UNION);
+}
+
+struct sorted_t *Sorted_minus(struct sorted_t *s, struct sorted_t *t) {
+    assert(s != NULL && t != NULL);
+    return sorted_merge(s, t, OP_MINUS);
+}
+
+struct sorted_t *Sorted_diff(struct sorted_t *s, struct sorted_t *t) {
+    assert(s != NULL && t != NULL);
+    return sorted_merge(s, t, OP_DIFF);
+}
@@ -1,5 +1,6 @@
 #include "stack.h"
 
+#include "arena.h"
 #include "assert.h"
 #include "mem.h"
 
@@ -9,6 +10,21 @@ struct stack_t *Stack_new(void) {
     NEW(stk);
     stk->count = 0;
     stk->head = NULL;
+    stk->arena = NULL;
+    stk->spare = NULL;
+    return stk;
+}
+
+struct stack_t *Stack_new_in(struct arena_t *arena) {
+    struct stack_t *stk;
+
+    assert(arena != NULL);
+
+    stk = Arena_alloc(arena, sizeof(*stk), __FILE__, __LINE__);
+    stk->count = 0;
+    stk->head = NULL;
+    stk->arena = arena;
+    stk->spare = NULL;
     return stk;
 }
 
@@ -22,7 +38,13 @@ void Stack_push(struct stack_t *stk, void *x) {
 
     assert(stk != NULL);
 
-    NEW(t);
+    if (stk->arena == NULL)
+        NEW(t);
+    else if (stk->spare != NULL) {
+        t = stk->spare;
+        stk->spare = t->link;
+    } else
+        t = Arena_alloc(stk->arena, sizeof(*t), __FILE__, __LINE__);
     t->x = x;
     t->link = stk->head;
     stk->head = t;
@@ -40,7 +62,12 @@ void *Stack_pop(struct stack_t *stk) {
     stk->head = t->link;
     stk->count--;
     x = t->x;
-    FREE(t);
+    if (stk->arena == NULL)
+        FREE(t);
+    else {
+        t->link = stk->spare;
+        stk->spare = t;
+    }
 
     return x;
 }
@@ -51,6 +78,12 @@ void Stack_free(struct stack_t **stkp) {
     assert(stkp != NULL);
     assert(*stkp != NULL);
 
+    // the storage of the stack goes with its arena
+    if ((*stkp)->arena != NULL) {
+        *stkp = NULL;
+        return;
+    }
+
     for (t = (*stkp)->head; t != NULL; t = u) {
         u = t->link;
         FREE(t);
@@ -3,8 +3,10 @@
 #include <limits.h>  // INT_MAX
 #include <string.h>  // memset()
 
+#include "arena.h"
 #include "assert.h"
 #include "atom.h"
+#include "bloom.h"
 #include "mem.h"
 
 // Size of table
@@ -22,8 +24,26 @@ static int primes[] = {
     INT_MAX,
 };
 
-struct table_t *Table_create(int hint, cmp_t cmp, hash_t hash) {
+// Filters are sized for FILTER_SLACK times the keys they are built
+// with, so that they don't have to be rebuilt at each put.
+#define FILTER_SLACK 2
+
+// allocation and deallocation in the storage of table, see Table_create_in()
+#define TABLE_ALLOC(table, nbytes)                                       \
+    ((table)->arena != NULL                                              \
+         ? Arena_alloc((table)->arena, (nbytes), __FILE__, __LINE__)     \
+         : ALLOC(nbytes))
+#define TABLE_TRY_ALLOC(table, nbytes)                                   \
+    ((table)->arena != NULL                                              \
+         ? Arena_try_alloc((table)->arena, (nbytes))                     \
+         : Mem_try_alloc((nbytes), __FILE__, __LINE__))
+#define TABLE_FREE(table, ptr) \
+    ((void)((table)->arena == NULL ? FREE(ptr) : ((ptr) = 0)))
+
+static struct table_t *table_create(struct arena_t *arena, int hint,
+                                    cmp_t cmp, hash_t hash) {
     struct table_t *table;
+    long nbytes;
     int i;
 
     assert(hint >= 0);
@@ -32,7 +52,12 @@ struct table_t *Table_create(int hint, cmp_t cmp, hash_t hash) {
         ;
     hint = primes[i - 1];
 
-    table = ALLOC(sizeof(*table) + hint * sizeof(table->buckets[0]));
+    nbytes = sizeof(*table) + hint * sizeof(table->buckets[0]);
+    if (arena != NULL)
+        table = Arena_alloc(arena, nbytes, __FILE__, __LINE__);
+    else
+        table = ALLOC(nbytes);
+    table->arena = arena;
     table->capacity = hint;
     // table->cmp = ((cmp == NULL) ? (Atom_cmp) : (cmp));
     // table->hash = ((hash == NULL) ? (Atom_hash) : (hash));
@@ -46,16 +71,34 @@ struct table_t *Table_create(int hint, cmp_t cmp, hash_t hash) {
         table->hash = hash;
     table->buckets = (struct binding **)(table + 1);
     memset(table->buckets, 0, sizeof(table->buckets[0]) * hint);
+    table->filter = NULL;
     table->size = 0;
     table->time_stamp = 0;
 
     return table;
 }
 
+struct table_t *Table_create(int hint, cmp_t cmp, hash_t hash) {
+    return table_create(NULL, hint, cmp, hash);
+}
+
+struct table_t *Table_create_in(struct arena_t *arena, int hint, cmp_t cmp, hash_t hash) {
+    assert(arena != NULL);
+    return table_create(arena, hint, cmp, hash);
+}
+
 void Table_free(struct table_t **table) {
     assert(table != NULL);
     assert(*table != NULL);
 
+    // the storage of the table goes with its arena, only the filter
+    // lives on the heap
+    if ((*table)->arena != NULL) {
+        if ((*table)->filter != NULL) Bloom_free(&(*table)->filter);
+        *table = NULL;
+        return;
+    }
+
     if ((*table)->size > 0) {
         int i;
         struct binding *p, *q;
@@ -66,28 +109,90 @@ void Table_free(struct table_t **table) {
             }
         }
     }
+    if ((*table)->filter != NULL) Bloom_free(&(*table)->filter);
     FREE(*table);
 }
 
+// number of keys to size the filter of table for, leaving room to grow
+static long table_filter_keys(struct table_t *table) {
+    long nkeys = FILTER_SLACK * (long)table->size;
+
+    return (nkeys < table->capacity) ? table->capacity : nkeys;
+}
+
+// add all the keys of table to its filter
+static void table_filter_fill(struct table_t *table) {
+    struct binding *p;
+    int i;
+
+    for (i = 0; i < table->capacity; i++)
+        for (p = table->buckets[i]; p != NULL; p = p->link)
+            Bloom_add(table->filter, (*table->hash)(p->key));
+}
+
+/*
+    table_filter_build:
+        1. Replace the filter of table with a new one of bits_per_key bits
+        per key holding all the current keys.
+*/
+static void table_filter_build(struct table_t *table, int bits_per_key) {
+    if (table->filter != NULL) Bloom_free(&table->filter);
+    table->filter = Bloom_new(table_filter_keys(table), bits_per_key);
+    table_filter_fill(table);
+}
+
+void Table_filter(struct table_t *table, int bits_per_key) {
+    assert(table != NULL);
+    assert(bits_per_key >= 0);
+
+    if (bits_per_key > 0)
+        table_filter_build(table, bits_per_key);
+    else if (table->filter != NULL)
+        Bloom_free(&table->filter);
+}
+
+// binding of key, whose hash number is hash, or NULL
+static struct binding *table_find(struct table_t *table, const void *key, unsigned long hash) {
+    struct binding *p = NULL;
+
+    if (table->filter == NULL || Bloom_has(table->filter, hash)) {
+        for (p = table->buckets[hash % table->capacity]; p != NULL; p = p->link) {
+            if ((*table->cmp)(key, p->key) == 0) break;
+        }
+    }
+    return p;
+}
+
+// link the new binding p of key into table
+static void table_link(struct table_t *table, struct binding *p, const void *key,
+                       unsigned long hash) {
+    unsigned long h = hash % table->capacity;
+
+    p->key = key;
+    p->link = table->buckets[h];
+    table->buckets[h] = p;
+    table->size++;
+}
+
 void *Table_put(struct table_t *table, const void *key, void *value) {
-    unsigned long h;
+    unsigned long hash;
     struct binding *p;
     void *prev;
 
     assert(table != NULL);
     assert(key != NULL);
 
-    h = (*table->hash)(key) % table->capacity;
-    for (p = table->buckets[h]; p != NULL; p = p->link) {
-        if ((*table->cmp)(key, p->key) == 0) break;
-    }
-    if (p == NULL) {
-        NEW(p);
-        p->key = key;
-        p->link = table->buckets[h];
-        table->buckets[h] = p;
-        table->size++;
+    hash = (*table->hash)(key);
+    if ((p = table_find(table, key, hash)) == NULL) {
+        p = TABLE_ALLOC(table, sizeof(*p));
+        table_link(table, p, key, hash);
         prev = NULL;
+        if (table->filter != NULL) {
+            if (table->size > table->filter->capacity)
+                table_filter_build(table, table->filter->bits_per_key);
+            else
+                Bloom_add(table->filter, hash);
+        }
     } else
         prev = p->value;
     p->value = value;  // overwrite or initialize
@@ -95,14 +200,48 @@ void *Table_put(struct table_t *table, const void *key, void *value) {
     return prev;
 }
 
+int Table_try_put(struct table_t *table, const void *key, void *value, void **prev) {
+    struct bloom_t *filter;
+    unsigned long hash;
+    struct binding *p;
+
+    assert(table != NULL);
+    assert(key != NULL);
+
+    hash = (*table->hash)(key);
+    if ((p = table_find(table, key, hash)) == NULL) {
+        if ((p = TABLE_TRY_ALLOC(table, sizeof(*p))) == NULL) return -1;
+        table_link(table, p, key, hash);
+        if (prev != NULL) *prev = NULL;
+        if (table->filter != NULL) {
+            // a filter that can't be rebuilt takes the key all the same,
+            // it only lets more probes through
+            if (table->size > table->filter->capacity &&
+                (filter = Bloom_try_new(table_filter_keys(table),
+                                        table->filter->bits_per_key)) != NULL) {
+                Bloom_free(&table->filter);
+                table->filter = filter;
+                table_filter_fill(table);
+            } else
+                Bloom_add(table->filter, hash);
+        }
+    } else if (prev != NULL)
+        *prev = p->value;
+    p->value = value;
+    table->time_stamp++;
+    return 0;
+}
+
 void *Table_get(struct table_t *table, const void *key) {
-    unsigned long h;
+    unsigned long hash, h;
     struct binding *p;
 
     assert(table != NULL);
     assert(key != NULL);
 
-    h = (*table->hash)(key) % table->capacity;
+    hash = (*table->hash)(key);
+    if (table->filter != NULL && !Bloom_has(table->filter, hash)) return NULL;
+    h = hash % table->capacity;
     for (p = table->buckets[h]; p != NULL; p = p->link) {
         if ((*table->cmp)(key, p->key) == 0) break;
     }
@@ -111,7 +250,7 @@ void *Table_get(struct table_t *table, const void *key) {
 }
 
 void *Table_remove(struct table_t *table, const void *key) {
-    unsigned long h;
+    unsigned long hash, h;
     struct binding **pp, *p;
     void *prev;
 
@@ -119,20 +258,46 @@ void *Table_remove(struct table_t *table, const void *key) {
     assert(key != NULL);
 
     prev = NULL;
-    h = (*table->hash)(key) % table->capacity;
+    table->time_stamp++;
+    hash = (*table->hash)(key);
+    if (table->filter != NULL && !Bloom_has(table->filter, hash)) return NULL;
+    h = hash % table->capacity;
     for (pp = &table->buckets[h]; *pp != NULL; pp = &(*pp)->link) {
         if ((*table->cmp)(key, (*pp)->key) == 0) {
             p = *pp;
-            prev = p->link;
-            FREE(p);
+            *pp = p->link;
+            prev = p->value;
+            TABLE_FREE(table, p);
             table->size--;
+            // the filter still answers for the removed key
+            if (table->filter != NULL && ++table->filter->nremoved > table->size)
+                table_filter_build(table, table->filter->bits_per_key);
             break;
         }
     }
-    table->time_stamp++;
     return prev;
 }
 
+void Table_clear(struct table_t *table) {
+    int i;
+    struct binding *p, *q;
+
+    assert(table != NULL);
+
+    if (table->arena == NULL && table->size > 0) {
+        for (i = 0; i < table->capacity; i++) {
+            for (p = table->buckets[i]; p != NULL; p = q) {
+                q = p->link;
+                FREE(p);
+            }
+        }
+    }
+    memset(table->buckets, 0, sizeof(table->buckets[0]) * table->capacity);
+    table->size = 0;
+    table->time_stamp++;
+    if (table->filter != NULL) Bloom_clear(table->filter);
+}
+
 void Table_map(struct table_t *table,
                void (*apply)(const void *key, void **value, void *cl),
                void *cl) {